@@ -0,0 +1,50 @@
+
+-- Copyright 2022 Aeva Palecek
+--
+-- Licensed under the Apache License, Version 2.0 (the "License");
+-- you may not use this file except in compliance with the License.
+-- You may obtain a copy of the License at
+--
+--     http://www.apache.org/licenses/LICENSE-2.0
+--
+-- Unless required by applicable law or agreed to in writing, software
+-- distributed under the License is distributed on an "AS IS" BASIS,
+-- WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+-- See the License for the specific language governing permissions and
+
+-- Set operators with unbounded operands.  The planes here have infinite bounds, and tilting them
+-- makes their bounding boxes NaN, so none of these operands may be skipped or dropped because of
+-- their bounds.  Each case is its own instance, so that validate_models.py checks each of them
+-- over its own bounds.
+
+model = nil
+
+local tilted = plane(0, 0, 1):rotate_x(30)
+
+local diff_union =
+	sphere(1)
+	:diff(union(box(1, 1, 1):move_x(10), tilted))
+	:instance()
+	:move_x(-3)
+
+local big_union =
+	union(
+		box(.5, .5, .5):move_x(2),
+		sphere(.5):move_x(-2),
+		torus(1, .25):move_y(2),
+		blend_union(sphere(1), tilted, .2))
+	:inter(cube(6))
+	:instance()
+	:move_y(-6)
+
+local inter =
+	cube(1)
+	:inter(tilted)
+	:instance()
+	:move_x(3)
+
+local diff =
+	sphere(1)
+	:diff(tilted:rotate_y(45):move_x(.5))
+	:instance()
+	:move_y(3)
@@ -21,7 +21,7 @@
 #error "Missing required define: INTERPRETER_STACK"
 #endif
 
-MaterialDist Interpret(const vec3 EvalPoint)
+MaterialDist Interpret(vec3 EvalPoint)
 {
 	MaterialDist Stack[INTERPRETER_STACK];
 	for (int i = 0; i < INTERPRETER_STACK; ++i)
@@ -193,6 +193,20 @@ MaterialDist Interpret(const vec3 EvalPoint)
 				Point = MatrixTransform(Point, Matrix);
 				continue;
 			}
+			else if (Opcode == OPCODE_ROTATE)
+			{
+				vec3 Offset = vec3(
+					PARAMS[ProgramCounter++],
+					PARAMS[ProgramCounter++],
+					PARAMS[ProgramCounter++]);
+				vec4 Quat = vec4(
+					PARAMS[ProgramCounter++],
+					PARAMS[ProgramCounter++],
+					PARAMS[ProgramCounter++],
+					PARAMS[ProgramCounter++]);
+				Point = QuaternionTransform(Point - Offset, Quat);
+				continue;
+			}
 			else if (Opcode == OPCODE_SCALE)
 			{
 				Stack[StackPointer].Dist *= PARAMS[ProgramCounter++];
@@ -210,6 +224,93 @@ MaterialDist Interpret(const vec3 EvalPoint)
 				Stack[StackPointer].Color.b = PARAMS[ProgramCounter++];
 				continue;
 			}
+			else if (Opcode >= OPCODE_MOVED_SPHERE && Opcode <= OPCODE_MOVED_BOX)
+			{
+				// Brushes that are only translated have the offset built in.
+				Point -= vec3(
+					PARAMS[ProgramCounter++],
+					PARAMS[ProgramCounter++],
+					PARAMS[ProgramCounter++]);
+				if (Opcode == OPCODE_MOVED_SPHERE)
+				{
+					Stack[StackPointer].Dist = SphereBrush(Point,
+						PARAMS[ProgramCounter++]);
+				}
+				else if (Opcode == OPCODE_MOVED_ELLIPSOID)
+				{
+					Stack[StackPointer].Dist = EllipsoidBrush(Point,
+						PARAMS[ProgramCounter++],
+						PARAMS[ProgramCounter++],
+						PARAMS[ProgramCounter++]);
+				}
+				else
+				{
+					Stack[StackPointer].Dist = BoxBrush(Point,
+						PARAMS[ProgramCounter++],
+						PARAMS[ProgramCounter++],
+						PARAMS[ProgramCounter++]);
+				}
+				Point = EvalPoint;
+				continue;
+			}
+			else if (Opcode >= OPCODE_REPEAT_GRID && Opcode <= OPCODE_MIRROR_PLANE)
+			{
+				// The point the folded subtree was entered with is saved in the next three stack slots
+				// for OPCODE_FOLD_END to restore, and the subtree is evaluated with the folded point.
+				Stack[StackPointer++].Dist = EvalPoint.x;
+				Stack[StackPointer++].Dist = EvalPoint.y;
+				Stack[StackPointer++].Dist = EvalPoint.z;
+				Stack[StackPointer].Color = vec3(-1.0);
+				if (Opcode == OPCODE_REPEAT_GRID)
+				{
+					vec3 Period = vec3(
+						PARAMS[ProgramCounter++],
+						PARAMS[ProgramCounter++],
+						PARAMS[ProgramCounter++]);
+					vec3 Low = vec3(
+						PARAMS[ProgramCounter++],
+						PARAMS[ProgramCounter++],
+						PARAMS[ProgramCounter++]);
+					vec3 High = vec3(
+						PARAMS[ProgramCounter++],
+						PARAMS[ProgramCounter++],
+						PARAMS[ProgramCounter++]);
+					EvalPoint = RepeatGrid(Point, Period, Low, High);
+				}
+				else if (Opcode == OPCODE_REPEAT_POLAR)
+				{
+					EvalPoint = RepeatPolar(Point, PARAMS[ProgramCounter++]);
+				}
+				else if (Opcode == OPCODE_MIRROR_AXES)
+				{
+					vec3 Axes = vec3(
+						PARAMS[ProgramCounter++],
+						PARAMS[ProgramCounter++],
+						PARAMS[ProgramCounter++]);
+					EvalPoint = MirrorAxes(Point, Axes);
+				}
+				else
+				{
+					vec3 Normal = vec3(
+						PARAMS[ProgramCounter++],
+						PARAMS[ProgramCounter++],
+						PARAMS[ProgramCounter++]);
+					EvalPoint = MirrorPlane(Point, Normal, PARAMS[ProgramCounter++]);
+				}
+				Point = EvalPoint;
+				continue;
+			}
+			else if (Opcode == OPCODE_FOLD_END)
+			{
+				StackPointer -= 3;
+				EvalPoint = vec3(
+					Stack[StackPointer].Dist,
+					Stack[StackPointer + 1].Dist,
+					Stack[StackPointer + 2].Dist);
+				Stack[StackPointer] = Stack[StackPointer + 3];
+				Point = EvalPoint;
+				continue;
+			}
 			else if (Opcode == OPCODE_PUSH)
 			{
 				++StackPointer;
@@ -13,32 +13,6 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
-#define OPCODE_UNION 0
-#define OPCODE_INTER 1
-#define OPCODE_DIFF  2
-#define OPCODE_SMOOTH 3
-#define OPCODE_SMOOTH_UNION (OPCODE_SMOOTH + OPCODE_UNION)
-#define OPCODE_SMOOTH_INTER (OPCODE_SMOOTH + OPCODE_INTER)
-#define OPCODE_SMOOTH_DIFF  (OPCODE_SMOOTH + OPCODE_DIFF)
-
-#define OPCODE_SPHERE    6
-#define OPCODE_ELLIPSOID 7
-#define OPCODE_BOX       8
-#define OPCODE_TORUS     9
-#define OPCODE_CYLINDER  10
-#define OPCODE_PLANE     11
-#define OPCODE_CONE      12
-#define OPCODE_CONINDER 13
-
-#define OPCODE_OFFSET 14
-#define OPCODE_MATRIX 15
-#define OPCODE_SCALE  16
-#define OPCODE_FLATE  17
-#define OPCODE_PAINT  18
-
-#define OPCODE_RETURN 0xFFFFFFFF
-#define OPCODE_PUSH   (OPCODE_RETURN - 1)
-
 
 float SphereBrush(vec3 Point, float Radius)
 {
@@ -171,6 +145,55 @@ float FlateOp(float Dist, float Radius)
 }
 
 
+float ScaleOp(float Dist, float Scale)
+{
+	return Dist * Scale;
+}
+
+
+// Domain repetition folds the point into a single cell, so that the repeated subtree is only
+// evaluated once.  Cells are Period apart, and the cell indices are clamped to [Low, High] on
+// each axis, which may be infinite.
+vec3 RepeatGrid(vec3 Point, vec3 Period, vec3 Low, vec3 High)
+{
+	return Point - Period * clamp(round(Point / Period), Low, High);
+}
+
+
+// Returns the angle of the polar repetition sector that contains the point.
+float RepeatPolarAngle(vec3 Point, float Count)
+{
+	float Sector = 6.283185307179586f / Count;
+	return Sector * floor(atan(Point.y, Point.x) / Sector + 0.5f);
+}
+
+
+// Polar repetition folds the point into the sector around the positive X axis, repeating the
+// subtree Count times around the Z axis.
+vec3 RepeatPolar(vec3 Point, float Count)
+{
+	float Angle = RepeatPolarAngle(Point, Count);
+	float C = cos(Angle);
+	float S = sin(Angle);
+	return vec3(C * Point.x + S * Point.y, C * Point.y - S * Point.x, Point.z);
+}
+
+
+// Mirrors the point across each axis where Axes is one, so that the subtree only needs to cover
+// the positive side of those axes.
+vec3 MirrorAxes(vec3 Point, vec3 Axes)
+{
+	return mix(Point, abs(Point), Axes);
+}
+
+
+// Mirrors points behind the plane to the front of it.
+vec3 MirrorPlane(vec3 Point, vec3 Normal, float Offset)
+{
+	return Point - (2.0f * min(dot(Point, Normal) - Offset, 0.0f)) * Normal;
+}
+
+
 #ifndef SDF_MATH_ONLY
 
 struct MaterialDist
@@ -303,6 +326,13 @@ MaterialDist FlateOp(MaterialDist Dist, float Radius)
 }
 
 
+MaterialDist ScaleOp(MaterialDist Dist, float Scale)
+{
+	Dist.Dist *= Scale;
+	return Dist;
+}
+
+
 MaterialDist TreeRoot(MaterialDist Dist)
 {
 	return Dist;
@@ -21,6 +21,29 @@
 using namespace glm;
 
 
+// Every handle returned to the caller owns one reference to its tree.  Trees may share nodes,
+// so handles must be freed with DiscardTree rather than deleted directly.
+void* Retain(SDFNode* Tree)
+{
+	Tree->Hold();
+	return Tree;
+}
+
+
+// Returns a handle for a tree that was built from the given handles, and releases the caller's
+// references to them.  This is used by every function below that consumes its input handles.
+// Tree must already be held, as the trees returned by SDF::Intern and the SDF constructors are,
+// and that reference is passed on to the new handle.
+void* Adopt(SDFNode* Tree, std::initializer_list<void*> Consumed)
+{
+	for (void* Handle : Consumed)
+	{
+		((SDFNode*)Handle)->Release();
+	}
+	return Tree;
+}
+
+
 // Evaluate a SDF tree.
 extern "C" TANGERINE_API float EvalTree(void* Handle, float X, float Y, float Z)
 {
@@ -28,15 +51,20 @@ extern "C" TANGERINE_API float EvalTree(void* Handle, float X, float Y, float Z)
 	return ((SDFNode*)Handle)->Eval(vec3(X, Y, Z));
 }
 
-// Returns a clipped SDF tree.  This will need to be freed separately from the
-// original SDF tree.
+// Returns a clipped SDF tree.  This will need to be released separately from the
+// original SDF tree, which it may share unchanged subtrees with.
 extern "C" TANGERINE_API void* ClipTree(void* Handle, float X, float Y, float Z, float Radius)
 {
 	ProfileScope("ClipTree");
 	vec3 Point = vec3(X, Y, Z);
 
 	SDFNode* Clipped = ((SDFNode*)Handle)->Clip(Point, Radius);
-	if (Clipped && abs(Clipped->Eval(Point)) > Radius)
+	if (!Clipped)
+	{
+		return nullptr;
+	}
+	Retain(Clipped);
+	if (abs(Clipped->Eval(Point)) > Radius)
 	{
 		Clipped->Release();
 		return nullptr;
@@ -61,11 +89,11 @@ extern "C" TANGERINE_API RayHit RayMarchTree(
 }
 
 
-// Delete a CSG operator tree that was constructed with the functions below.
+// Release a CSG operator tree that was constructed with the functions below.
 extern "C" TANGERINE_API void DiscardTree(void* Handle)
 {
 	ProfileScope("DiscardTree");
-	delete ((SDFNode*)Handle);
+	((SDFNode*)Handle)->Release();
 }
 
 // Returns true if the evaluator has a finite boundary.
@@ -75,41 +103,47 @@ extern "C" TANGERINE_API bool TreeHasFiniteBounds(void* Handle)
 }
 
 
-// The following functions apply transforms to the evaluator tree.  These will return
-// a new handle if the tree root was a brush with no transforms applied, otherwise these
-// will return the original tree handle.
-extern "C" TANGERINE_API void MoveTree(void* Handle, float X, float Y, float Z)
+// The following functions apply transforms to the evaluator tree.  Trees are shared and so are
+// never modified in place.  Instead, these consume the given handle and return a new one.  The
+// transformed copy is owned by nothing until SDF::Intern returns a held canonical tree for it, and
+// the new handle takes over that reference.
+extern "C" TANGERINE_API void* MoveTree(void* Handle, float X, float Y, float Z)
 {
 	ProfileScope("Move");
-	SDFNode* Tree = ((SDFNode*)Handle);
+	SDFNode* Tree = ((SDFNode*)Handle)->Copy();
 	Tree->Move(vec3(X, Y, Z));
+	return Adopt(SDF::Intern(Tree), { Handle });
 }
 
-extern "C" TANGERINE_API void RotateTree(void* Handle, float X, float Y, float Z, float W)
+extern "C" TANGERINE_API void* RotateTree(void* Handle, float X, float Y, float Z, float W)
 {
 	ProfileScope("RotateTree");
-	SDFNode* Tree = ((SDFNode*)Handle);
+	SDFNode* Tree = ((SDFNode*)Handle)->Copy();
 	Tree->Rotate(quat(W, X, Y, Z));
+	return Adopt(SDF::Intern(Tree), { Handle });
 }
 
-extern "C" TANGERINE_API void AlignTree(void* Handle, float X, float Y, float Z)
+extern "C" TANGERINE_API void* AlignTree(void* Handle, float X, float Y, float Z)
 {
 	ProfileScope("AlignTree");
-	SDFNode* Tree = ((SDFNode*)Handle);
+	SDFNode* Tree = ((SDFNode*)Handle)->Copy();
 	const vec3 Anchors = vec3(X, Y, Z);
 	SDF::Align(Tree, Anchors);
+	return Adopt(SDF::Intern(Tree), { Handle });
 }
 
 
 // Material annotation functions
-extern "C" TANGERINE_API void PaintTree(float Red, float Green, float Blue, void* Handle)
+extern "C" TANGERINE_API void* PaintTree(float Red, float Green, float Blue, void* Handle)
 {
-	SDFNode* Tree = ((SDFNode*)Handle);
+	SDFNode* Tree = ((SDFNode*)Handle)->Copy();
 	Tree->ApplyMaterial(vec3(Red, Green, Blue), false);
+	return Adopt(SDF::Intern(Tree), { Handle });
 }
 
 
-// The following functions construct Brush nodes.
+// The following functions construct Brush nodes.  The constructors return held nodes, which the
+// new handles take over.
 extern "C" TANGERINE_API void* MakeSphereBrush(float Radius)
 {
 	return SDF::Sphere(Radius);
@@ -141,33 +175,58 @@ extern "C" TANGERINE_API void* MakePlaneOperand(float NormalX, float NormalY, fl
 }
 
 
-// The following functions construct CSG set operator nodes.
+// The following functions construct CSG set operator nodes.  These consume the operand handles.
 extern "C" TANGERINE_API void* MakeUnionOp(void* LHS, void* RHS)
 {
-	return SDF::Union((SDFNode*)LHS, (SDFNode*)RHS);
+	return Adopt(SDF::Union((SDFNode*)LHS, (SDFNode*)RHS), { LHS, RHS });
 }
 
 extern "C" TANGERINE_API void* MakeDiffOp(void* LHS, void* RHS)
 {
-	return SDF::Diff((SDFNode*)LHS, (SDFNode*)RHS);
+	return Adopt(SDF::Diff((SDFNode*)LHS, (SDFNode*)RHS), { LHS, RHS });
 }
 
 extern "C" TANGERINE_API void* MakeInterOp(void* LHS, void* RHS)
 {
-	return SDF::Inter((SDFNode*)LHS, (SDFNode*)RHS);
+	return Adopt(SDF::Inter((SDFNode*)LHS, (SDFNode*)RHS), { LHS, RHS });
 }
 
 extern "C" TANGERINE_API void* MakeBlendUnionOp(float Threshold, void* LHS, void* RHS)
 {
-	return SDF::BlendUnion(Threshold, (SDFNode*)LHS, (SDFNode*)RHS);
+	return Adopt(SDF::BlendUnion(Threshold, (SDFNode*)LHS, (SDFNode*)RHS), { LHS, RHS });
 }
 
 extern "C" TANGERINE_API void* MakeBlendDiffOp(float Threshold, void* LHS, void* RHS)
 {
-	return SDF::BlendDiff(Threshold, (SDFNode*)LHS, (SDFNode*)RHS);
+	return Adopt(SDF::BlendDiff(Threshold, (SDFNode*)LHS, (SDFNode*)RHS), { LHS, RHS });
 }
 
 extern "C" TANGERINE_API void* MakeBlendInterOp(float Threshold, void* LHS, void* RHS)
 {
-	return SDF::BlendInter(Threshold, (SDFNode*)LHS, (SDFNode*)RHS);
+	return Adopt(SDF::BlendInter(Threshold, (SDFNode*)LHS, (SDFNode*)RHS), { LHS, RHS });
+}
+
+
+// The following functions construct repetition nodes.
+extern "C" TANGERINE_API void* MakeRepeatGridOp(float PeriodX, float PeriodY, float PeriodZ, float CountX, float CountY, float CountZ, void* Handle)
+{
+	const vec3 Period = vec3(PeriodX, PeriodY, PeriodZ);
+	const vec3 Count = vec3(CountX, CountY, CountZ);
+	return Adopt(SDF::RepeatGrid((SDFNode*)Handle, Period, Count), { Handle });
+}
+
+extern "C" TANGERINE_API void* MakeRepeatPolarOp(int Count, void* Handle)
+{
+	return Adopt(SDF::RepeatPolar((SDFNode*)Handle, Count), { Handle });
+}
+
+extern "C" TANGERINE_API void* MakeMirrorOp(bool X, bool Y, bool Z, void* Handle)
+{
+	return Adopt(SDF::Mirror((SDFNode*)Handle, bvec3(X, Y, Z)), { Handle });
+}
+
+extern "C" TANGERINE_API void* MakeMirrorPlaneOp(float NormalX, float NormalY, float NormalZ, float Offset, void* Handle)
+{
+	const vec3 Normal = vec3(NormalX, NormalY, NormalZ);
+	return Adopt(SDF::Mirror((SDFNode*)Handle, Normal, Offset), { Handle });
 }
@@ -14,14 +14,18 @@
 // limitations under the License.
 
 #include <functional>
+#include <memory>
 #include <fstream>
 #include <vector>
-#include <map>
+#include <unordered_map>
 #include <cmath>
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
 #include <atomic>
-#include <mutex>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <string>
 #include <fmt/format.h>
 #include "threadpool.h"
@@ -34,15 +38,136 @@ using namespace glm;
 using namespace std::placeholders;
 
 
-struct  Vec3Less
+// Returns false if the distance field shows that the block of cells is too far from the surface to
+// intersect it.  The full tree is used for this rather than the octree, because the octree's cells
+// are only accurate within their own bounds.
+bool MayContainSurface(const SDFInterpreter& Field, const vec3 Start, const vec3 Step, const ivec3 Min, const ivec3 Size)
+{
+	// Cells also sample their negative neighbors, so the block's bounds are padded by one cell.
+	const vec3 Low = vec3(Min - ivec3(1)) * Step + Start;
+	const vec3 High = vec3(Min + Size) * Step + Start;
+	const float Radius = distance(Low, High) * 0.5f + length(Step);
+	return abs(Field.Eval((Low + High) * vec3(0.5))) <= Radius;
+}
+
+
+// Exports only need to sample the narrow band of cells around the surface, so the grid is searched
+// hierarchically rather than scanned.  Blocks of cells are split into octants, and any block that
+// can't contain the surface is skipped along with all of its cells.  Callback is called on each
+// remaining block once it spans no more than Limit cells along every axis.
+template<typename CallbackT>
+void FindSurfaceBlocks(const SDFInterpreter& Field, const vec3 Start, const vec3 Step, const ivec3 Min, const ivec3 Size, const int Limit, CallbackT& Callback)
 {
-	bool operator() (const vec3& LHS, const vec3& RHS) const
+	if (!MayContainSurface(Field, Start, Step, Min, Size))
+	{
+		return;
+	}
+
+	if (all(lessThanEqual(Size, ivec3(Limit))))
+	{
+		Callback(Min, Size);
+		return;
+	}
+
+	const ivec3 Split = (Size + ivec3(1)) / ivec3(2);
+	for (int Octant = 0; Octant < 8; ++Octant)
 	{
-		return LHS.x < RHS.x || (LHS.x == RHS.x && LHS.y < RHS.y) || (LHS.x == RHS.x && LHS.y == RHS.y && LHS.z < RHS.z);
+		ivec3 ChildMin = Min;
+		ivec3 ChildSize = Size;
+		for (int Axis = 0; Axis < 3; ++Axis)
+		{
+			if (Size[Axis] > Limit)
+			{
+				if (Octant & (1 << Axis))
+				{
+					ChildMin[Axis] += Split[Axis];
+					ChildSize[Axis] -= Split[Axis];
+				}
+				else
+				{
+					ChildSize[Axis] = Split[Axis];
+				}
+			}
+			else if (Octant & (1 << Axis))
+			{
+				// This axis is not being split, so only the lower octant along it is kept.
+				ChildSize[Axis] = 0;
+			}
+		}
+		if (all(greaterThan(ChildSize, ivec3(0))))
+		{
+			FindSurfaceBlocks(Field, Start, Step, ChildMin, ChildSize, Limit, Callback);
+		}
 	}
+}
+
+
+struct CellBlock
+{
+	ivec3 Min;
+	ivec3 Size;
+};
+
+
+// Blocks of up to this many cells per axis are handed out to the export threads, which then split them
+// further into bricks of BrickSize cells per axis before sampling individual cells.
+static constexpr int TaskSize = 64;
+static constexpr int BrickSize = 8;
+
+
+inline uint64_t CornerKey(ivec3 Corner)
+{
+	return uint64_t(Corner.x) | (uint64_t(Corner.y) << 21) | (uint64_t(Corner.z) << 42);
+}
+
+
+// The uniform mesher meshes each block of cells independently.  Vertices are identified by the
+// grid corner they were placed on, and quad corners index into the block's own vertices.
+struct MeshChunk
+{
+	std::vector<ivec3> Corners;
+	std::vector<ivec4> Quads;
 };
 
 
+// Joins the meshes of each block in order, so the result doesn't depend on which threads meshed
+// which blocks.  Only corners on the boundary of a block can be shared with its neighbors, so only
+// those need to be looked up.
+void MergeChunks(std::vector<MeshChunk>& Chunks, const std::vector<CellBlock>& Blocks, const vec3 Start, const vec3 Step, std::vector<vec3>& Vertices, std::vector<ivec4>& Quads)
+{
+	std::unordered_map<uint64_t, int> Shared;
+	std::vector<int> Remap;
+	for (size_t i = 0; i < Chunks.size(); ++i)
+	{
+		MeshChunk& Chunk = Chunks[i];
+		const ivec3 Low = Blocks[i].Min;
+		const ivec3 High = Blocks[i].Min + Blocks[i].Size;
+
+		Remap.resize(Chunk.Corners.size());
+		for (size_t v = 0; v < Chunk.Corners.size(); ++v)
+		{
+			const ivec3 Corner = Chunk.Corners[v];
+			int Index = int(Vertices.size());
+			if (any(equal(Corner, Low)) || any(equal(Corner, High)))
+			{
+				Index = Shared.try_emplace(CornerKey(Corner), Index).first->second;
+			}
+			if (Index == Vertices.size())
+			{
+				Vertices.push_back(vec3(Corner) * Step + Start);
+			}
+			Remap[v] = Index;
+		}
+
+		for (const ivec4& Quad : Chunk.Quads)
+		{
+			Quads.push_back(ivec4(Remap[Quad.x], Remap[Quad.y], Remap[Quad.z], Remap[Quad.w]));
+		}
+		Chunk = {};
+	}
+}
+
+
 std::atomic_bool ExportActive;
 std::atomic_int ExportState(0);
 std::atomic_int VoxelCount;
@@ -55,76 +180,195 @@ std::atomic_int WriteCount;
 std::atomic_int WriteProgress;
 
 
-void WriteSTL(SDFOctree* Octree, std::string Path, std::vector<vec3> Vertices, std::vector<ivec4> Quads, float Scale)
+// Adaptive meshes can produce quads where two neighboring corners share a vertex.  These are
+// rotated so that the shared vertex is in the last two corners, and only the first half of the
+// quad is written as a triangle.
+inline bool IsTriangle(const ivec4& Quad)
 {
-	std::ofstream OutFile;
-	OutFile.open(Path, std::ios::out | std::ios::binary);
+	return Quad.z == Quad.w;
+}
+
 
-	// Write 80 bytes for the header.
-	for (int i = 0; i < 80; ++i)
+size_t CountTriangles(const std::vector<ivec4>& Quads)
+{
+	size_t Triangles = 0;
+	for (const ivec4& Quad : Quads)
 	{
-		OutFile << '\0';
+		Triangles += IsTriangle(Quad) ? 1 : 2;
 	}
+	return Triangles;
+}
 
-	SecondaryCount.store(Quads.size());
-	std::vector<glm::vec3> Normals;
-	Normals.reserve(Quads.size());
-	for (ivec4& Quad : Quads)
+
+// Records are written in large chunks rather than one field at a time.  Each chunk is laid out
+// serially, since the size of each record may vary, and then the export threads fill their own
+// parts of it in parallel.  The same threads are kept for the whole file: whichever one finishes
+// the last batch of a chunk writes it out and lays out the next, while the others wait for it.
+// RecordSize returns the number of bytes for a given record, and Fill writes that record to the
+// given address.  Returns false if the export was cancelled.
+template<typename SizeT, typename FillT>
+bool WriteRecords(std::ofstream& OutFile, const size_t Count, SizeT& RecordSize, FillT& Fill)
+{
+	static constexpr size_t ChunkRecords = 1 << 18;
+	static constexpr size_t BatchRecords = 1 << 10;
+	std::vector<size_t> Offsets(std::min(Count, ChunkRecords) + 1);
+	std::vector<char> Buffer;
+
+	size_t Begin = 0;
+	size_t End = 0;
+	bool Cancelled = false;
+	auto LayoutChunk = [&]() -> bool
 	{
+		if (Begin >= Count)
+		{
+			return false;
+		}
 		if (ExportState.load() != 3 || !ExportActive.load())
 		{
-			break;
+			Cancelled = true;
+			return false;
 		}
-		SecondaryProgress.fetch_add(1);
-		vec3 Center = (Vertices[Quad.x] + Vertices[Quad.y] + Vertices[Quad.z] + Vertices[Quad.w]) / vec3(4.0);
-		vec3 Normal = Octree->Gradient(Center);
-		Normals.push_back(Normal);
-	}
+		End = std::min(Begin + ChunkRecords, Count);
+		Offsets[0] = 0;
+		for (size_t i = Begin; i < End; ++i)
+		{
+			Offsets[i - Begin + 1] = Offsets[i - Begin] + RecordSize(i);
+		}
+		Buffer.resize(Offsets[End - Begin]);
+		return true;
+	};
 
-	for (glm::vec3& Vertex : Vertices)
+	if (LayoutChunk())
 	{
-		Vertex *= Scale;
+		std::mutex ChunkCS;
+		std::condition_variable ChunkReady;
+		size_t Next = Begin;
+		size_t Filling = 0;
+		bool Finished = false;
+
+		Pool([&]() \
+		{
+			std::unique_lock<std::mutex> Lock(ChunkCS);
+			while (!Finished)
+			{
+				if (Next < End)
+				{
+					const size_t Batch = Next;
+					const size_t BatchEnd = std::min(Batch + BatchRecords, End);
+					const size_t ChunkBegin = Begin;
+					Next = BatchEnd;
+					++Filling;
+					Lock.unlock();
+					for (size_t i = Batch; i < BatchEnd; ++i)
+					{
+						Fill(i, Buffer.data() + Offsets[i - ChunkBegin]);
+					}
+					Lock.lock();
+					if (--Filling == 0 && Next == End)
+					{
+						OutFile.write(Buffer.data(), Buffer.size());
+						WriteProgress.fetch_add(int(End - Begin));
+						Begin = End;
+						Finished = !LayoutChunk();
+						Next = Begin;
+						ChunkReady.notify_all();
+					}
+				}
+				else
+				{
+					ChunkReady.wait(Lock);
+				}
+			}
+		});
 	}
+	return !Cancelled;
+}
 
-	WriteCount.store(Quads.size());
-	uint32_t Triangles = Quads.size() * 2;
-	OutFile.write(reinterpret_cast<char*>(&Triangles), 4);
-	for (int q = 0; q < Quads.size(); ++q)
+
+// Runs Thunk on every index up to Count across the export threads, and updates the progress for
+// vertex attributes as it goes.
+template<typename ThunkT>
+void ComputeAttributes(const size_t Count, ThunkT& Thunk)
+{
+	static constexpr size_t BatchSize = 1 << 10;
+	SecondaryCount.store(int(Count));
+	std::atomic_size_t Next = 0;
+	Pool([&]() \
 	{
-		if (ExportState.load() != 3 || !ExportActive.load())
+		for (size_t Batch = Next.fetch_add(BatchSize); Batch < Count; Batch = Next.fetch_add(BatchSize))
 		{
-			break;
+			if (ExportState.load() != 3 || !ExportActive.load())
+			{
+				break;
+			}
+			const size_t BatchEnd = std::min(Batch + BatchSize, Count);
+			for (size_t i = Batch; i < BatchEnd; ++i)
+			{
+				Thunk(i);
+			}
+			SecondaryProgress.fetch_add(int(BatchEnd - Batch));
 		}
-		WriteProgress.fetch_add(1);
-		ivec4& Quad = Quads[q];
-		vec3& Normal = Normals[q];
-		{
-			OutFile.write(reinterpret_cast<char*>(&Normal), 12);
+	});
+}
 
-			OutFile.write(reinterpret_cast<char*>(&Vertices[Quad.x]), 12);
-			OutFile.write(reinterpret_cast<char*>(&Vertices[Quad.y]), 12);
-			OutFile.write(reinterpret_cast<char*>(&Vertices[Quad.z]), 12);
 
-			uint16_t Attributes = 0;
-			OutFile.write(reinterpret_cast<char*>(&Attributes), 2);
-		}
+void WriteSTL(SDFOctree* Octree, std::string Path, const std::vector<vec3>& Vertices, const std::vector<ivec4>& Quads, float Scale)
+{
+	std::vector<vec3> Normals(Quads.size());
+	{
+		auto FindNormal = [&](size_t q)
 		{
-			OutFile.write(reinterpret_cast<char*>(&Normal), 12);
+			const ivec4& Quad = Quads[q];
+			vec3 Center = (Vertices[Quad.x] + Vertices[Quad.y] + Vertices[Quad.z] + Vertices[Quad.w]) / vec3(4.0);
+			Normals[q] = Octree->Gradient(Center);
+		};
+		ComputeAttributes(Quads.size(), FindNormal);
+	}
 
-			OutFile.write(reinterpret_cast<char*>(&Vertices[Quad.x]), 12);
-			OutFile.write(reinterpret_cast<char*>(&Vertices[Quad.z]), 12);
-			OutFile.write(reinterpret_cast<char*>(&Vertices[Quad.w]), 12);
+	std::ofstream OutFile;
+	OutFile.open(Path, std::ios::out | std::ios::binary);
 
-			uint16_t Attributes = 0;
-			OutFile.write(reinterpret_cast<char*>(&Attributes), 2);
-		}
+	// Write 80 bytes for the header, followed by the triangle count.
+	{
+		char Header[84] = {};
+		uint32_t Triangles = CountTriangles(Quads);
+		memcpy(Header + 80, &Triangles, 4);
+		OutFile.write(Header, 84);
 	}
 
-	// Align to 4 bytes for good luck.
-	size_t Written = 84 + 100 * Quads.size();
-	for (int i = 0; i < Written % 4; ++i)
+	// Each triangle is a normal, three vertices, and two bytes of attributes.
+	static constexpr size_t TriangleSize = 50;
+	auto RecordSize = [&](size_t q) -> size_t
 	{
-		OutFile << '\0';
+		return IsTriangle(Quads[q]) ? TriangleSize : TriangleSize * 2;
+	};
+	auto Fill = [&](size_t q, char* Out)
+	{
+		const ivec4& Quad = Quads[q];
+		const int Triangles = IsTriangle(Quad) ? 1 : 2;
+		for (int t = 0; t < Triangles; ++t)
+		{
+			const vec3 Triangle[4] = {
+				Normals[q],
+				Vertices[Quad.x] * Scale,
+				Vertices[t == 0 ? Quad.y : Quad.z] * Scale,
+				Vertices[t == 0 ? Quad.z : Quad.w] * Scale
+			};
+			const uint16_t Attributes = 0;
+			memcpy(Out, Triangle, 48);
+			memcpy(Out + 48, &Attributes, 2);
+			Out += TriangleSize;
+		}
+	};
+	WriteCount.store(Quads.size());
+	if (WriteRecords(OutFile, Quads.size(), RecordSize, Fill))
+	{
+		// Align to 4 bytes for good luck.
+		size_t Written = 84 + TriangleSize * CountTriangles(Quads);
+		for (int i = 0; i < Written % 4; ++i)
+		{
+			OutFile << '\0';
+		}
 	}
 
 	OutFile.close();
@@ -190,38 +434,32 @@ std::string PlyHeader(size_t VertexCount, size_t TriangleCount, bool ExportColor
 }
 
 
-void WritePLY(SDFOctree* Octree, std::string Path, std::vector<vec3> Vertices, std::vector<ivec4> Quads, float Scale)
+void WritePLY(SDFOctree* Octree, std::string Path, const std::vector<vec3>& Vertices, const std::vector<ivec4>& Quads, float Scale)
 {
 	const bool ExportColor = Octree->Evaluator->HasPaint();
 	std::string Header;
 	{
 		size_t VertexCount = Vertices.size();
-		size_t TriangleCount = Quads.size() * 2;
+		size_t TriangleCount = CountTriangles(Quads);
 		Header = PlyHeader(VertexCount, TriangleCount, ExportColor);
 	}
 
 	// Populate vertex attributes.
-	SecondaryCount.store(Vertices.size());
-	std::vector<glm::vec3> Normals;
-	std::vector<uint8_t> Colors;
-	Normals.reserve(Vertices.size());
-	if (ExportColor)
-	{
-		Colors.reserve(Vertices.size() * 3);
-	}
-
-	for (int v = 0; v < Vertices.size(); ++v)
+	std::vector<glm::vec3> Normals(Vertices.size());
+	std::vector<uint8_t> Colors(ExportColor ? Vertices.size() * 3 : 0);
 	{
-		SecondaryProgress.fetch_add(1);
-		Normals.push_back(Octree->Gradient(Vertices[v]));
-		if (ExportColor)
+		auto FindAttributes = [&](size_t v)
 		{
-			vec3 Color = Octree->Sample(Vertices[v]);
-			Colors.push_back(0xFF * Color.r);
-			Colors.push_back(0xFF * Color.g);
-			Colors.push_back(0xFF * Color.b);
-		}
-		Vertices[v] *= Scale;
+			Normals[v] = Octree->Gradient(Vertices[v]);
+			if (ExportColor)
+			{
+				vec3 Color = Octree->EvalMaterial(Vertices[v]).Color;
+				Colors[v * 3 + 0] = 0xFF * Color.r;
+				Colors[v * 3 + 1] = 0xFF * Color.g;
+				Colors[v * 3 + 2] = 0xFF * Color.b;
+			}
+		};
+		ComputeAttributes(Vertices.size(), FindAttributes);
 	}
 
 	// Write vertex data.
@@ -229,32 +467,46 @@ void WritePLY(SDFOctree* Octree, std::string Path, std::vector<vec3> Vertices, s
 	std::ofstream OutFile;
 	OutFile.open(Path, std::ios::out | std::ios::binary);
 	OutFile.write(Header.c_str(), Header.size());
-	for (int v = 0; v < Vertices.size(); ++v)
+
+	const size_t VertexSize = ExportColor ? 27 : 24;
+	auto VertexRecordSize = [&](size_t) -> size_t
+	{
+		return VertexSize;
+	};
+	auto FillVertex = [&](size_t v, char* Out)
 	{
-		WriteProgress.fetch_add(1);
-		OutFile.write(reinterpret_cast<char*>(&Vertices[v]), 12);
-		OutFile.write(reinterpret_cast<char*>(&Normals[v]), 12);
+		const vec3 Position = Vertices[v] * Scale;
+		memcpy(Out, &Position, 12);
+		memcpy(Out + 12, &Normals[v], 12);
 		if (ExportColor)
 		{
-			OutFile.write(reinterpret_cast<char*>(&Colors[v * 3]), 3);
+			memcpy(Out + 24, &Colors[v * 3], 3);
 		}
-	}
+	};
 
-	// Write face data.
-	const int8_t FaceVerts = 3;
-	for (int q = 0; q < Quads.size(); ++q)
+	// Write face data.  Each face is a vertex count followed by three vertex indices.
+	static constexpr size_t FaceSize = 13;
+	auto FaceRecordSize = [&](size_t q) -> size_t
 	{
-		WriteProgress.fetch_add(1);
-		{
-			ivec3 FaceA = Quads[q].xyz;
-			OutFile.write(reinterpret_cast<const char*>(&FaceVerts), 1);
-			OutFile.write(reinterpret_cast<char*>(&FaceA), 12);
-		}
+		return IsTriangle(Quads[q]) ? FaceSize : FaceSize * 2;
+	};
+	auto FillFace = [&](size_t q, char* Out)
+	{
+		const uint8_t FaceVerts = 3;
+		const ivec3 FaceA = Quads[q].xyz;
+		memcpy(Out, &FaceVerts, 1);
+		memcpy(Out + 1, &FaceA, 12);
+		if (!IsTriangle(Quads[q]))
 		{
-			ivec3 FaceB = Quads[q].xzw;
-			OutFile.write(reinterpret_cast<const char*>(&FaceVerts), 1);
-			OutFile.write(reinterpret_cast<char*>(&FaceB), 12);
+			const ivec3 FaceB = Quads[q].xzw;
+			memcpy(Out + FaceSize, &FaceVerts, 1);
+			memcpy(Out + FaceSize + 1, &FaceB, 12);
 		}
+	};
+
+	if (WriteRecords(OutFile, Vertices.size(), VertexRecordSize, FillVertex))
+	{
+		WriteRecords(OutFile, Quads.size(), FaceRecordSize, FillFace);
 	}
 
 	OutFile.close();
@@ -268,111 +520,139 @@ void MeshExportThread(SDFNode* Evaluator, vec3 ModelMin, vec3 ModelMax, vec3 Ste
 	SDFOctree* Octree = SDFOctree::Create(Evaluator, 0.25);
 
 	std::vector<vec3> Vertices;
-	std::map<vec3, int, Vec3Less> VertMemo;
-	std::mutex VerticesCS;
-
-	auto NewVert = [&](vec3 Vertex) -> int
-	{
-		VerticesCS.lock();
-		auto Found = VertMemo.find(Vertex);
-		if (Found != VertMemo.end())
-		{
-			VerticesCS.unlock();
-			return Found->second;
-		}
-		else
-		{
-			int Next = Vertices.size();
-			VertMemo[Vertex] = Next;
-			Vertices.push_back(Vertex);
-			VerticesCS.unlock();
-			return Next;
-		}
-	};
-
 	std::vector<ivec4> Quads;
-	std::mutex QuadsCS;
 
 	{
 		const vec3 Start = ModelMin;
 		const vec3 Stop = ModelMax + Step;
 		const ivec3 Iterations = ivec3(ceil((Stop - Start) / Step));
-		const int Slice = Iterations.x * Iterations.y;
-		const int TotalCells = Iterations.x * Iterations.y * Iterations.z;
-		VoxelCount.store(TotalCells);
 
+		const SDFInterpreter Field(Evaluator);
+		std::vector<CellBlock> Tasks;
+		{
+			auto AddTask = [&](ivec3 Min, ivec3 Size)
+			{
+				Tasks.push_back({ Min, Size });
+			};
+			FindSurfaceBlocks(Field, Start, Step, ivec3(0), Iterations, TaskSize, AddTask);
+		}
+		VoxelCount.store(int(Tasks.size()));
+
+		std::vector<MeshChunk> Chunks(Tasks.size());
 		Pool([&]() \
 		{
-			while (ExportState.load() == 1 && ExportActive.load())
+			// Vertices are deduplicated within a block through a table of the block's corners, which
+			// is cleared again after each block.
+			constexpr int Span = TaskSize + 1;
+			std::vector<int> CornerIndex(Span * Span * Span, -1);
+			MeshChunk* Chunk = nullptr;
+			ivec3 ChunkMin;
+			auto NewVert = [&](ivec3 Corner) -> int
 			{
-				int i = GenerationProgress.fetch_add(1);
-				if (i < TotalCells)
+				const ivec3 Local = Corner - ChunkMin;
+				int& Index = CornerIndex[(Local.z * Span + Local.y) * Span + Local.x];
+				if (Index == -1)
 				{
-					float Z = float(i / Slice) * Step.z + Start.z;
-					float Y = float((i % Slice) / Iterations.x) * Step.y + Start.y;
-					float X = float(i % Iterations.x) * Step.x + Start.x;
+					Index = int(Chunk->Corners.size());
+					Chunk->Corners.push_back(Corner);
+				}
+				return Index;
+			};
+
+			auto ExtractCell = [&](const ivec3 Cell)
+			{
+				float Z = float(Cell.z) * Step.z + Start.z;
+				float Y = float(Cell.y) * Step.y + Start.y;
+				float X = float(Cell.x) * Step.x + Start.x;
 
-					vec3 Cursor = vec3(X, Y, Z) + Half;
+				vec3 Cursor = vec3(X, Y, Z) + Half;
 
-					vec4 Dist;
+				vec4 Dist;
+				{
+					float Coarse = Octree->Eval(vec3(X, Y, Z));
+					if (Coarse > Diagonal * 2.0)
 					{
-						float Coarse = Octree->Eval(vec3(X, Y, Z));
-						if (Coarse > Diagonal * 2.0)
-						{
-							continue;
-						}
-						Dist.x = Octree->Eval(Cursor - vec3(Step.x, 0.0, 0.0));
-						Dist.y = Octree->Eval(Cursor - vec3(0.0, Step.y, 0.0));
-						Dist.z = Octree->Eval(Cursor - vec3(0.0, 0.0, Step.z));
-						Dist.w = Octree->Eval(Cursor);
+						return;
 					}
+					const vec3 Samples[4] = {
+						Cursor - vec3(Step.x, 0.0, 0.0),
+						Cursor - vec3(0.0, Step.y, 0.0),
+						Cursor - vec3(0.0, 0.0, Step.z),
+						Cursor
+					};
+					Octree->EvalBatch(Samples, &Dist.x, 4);
+				}
 
-					if (sign(Dist.w) != sign(Dist.x))
+				if (sign(Dist.w) != sign(Dist.x))
+				{
+					ivec4 Quad(
+						NewVert(Cell + ivec3(0, 0, 0)),
+						NewVert(Cell + ivec3(0, 1, 0)),
+						NewVert(Cell + ivec3(0, 1, 1)),
+						NewVert(Cell + ivec3(0, 0, 1)));
+					if (sign(Dist.w) < sign(Dist.x))
 					{
-						ivec4 Quad(
-							NewVert(Half * vec3(-1.0, -1.0, -1.0) + Cursor),
-							NewVert(Half * vec3(-1.0, 1.0, -1.0) + Cursor),
-							NewVert(Half * vec3(-1.0, 1.0, 1.0) + Cursor),
-							NewVert(Half * vec3(-1.0, -1.0, 1.0) + Cursor));
-						if (sign(Dist.w) < sign(Dist.x))
-						{
-							Quad = Quad.wzyx;
-						}
-						QuadsCS.lock();
-						Quads.push_back(Quad);
-						QuadsCS.unlock();
+						Quad = Quad.wzyx;
+					}
+					Chunk->Quads.push_back(Quad);
+				}
+
+				if (sign(Dist.w) != sign(Dist.y))
+				{
+					ivec4 Quad(
+						NewVert(Cell + ivec3(0, 0, 1)),
+						NewVert(Cell + ivec3(1, 0, 1)),
+						NewVert(Cell + ivec3(1, 0, 0)),
+						NewVert(Cell + ivec3(0, 0, 0)));
+					if (sign(Dist.w) < sign(Dist.y))
+					{
+						Quad = Quad.wzyx;
 					}
+					Chunk->Quads.push_back(Quad);
+				}
 
-					if (sign(Dist.w) != sign(Dist.y))
+				if (sign(Dist.w) != sign(Dist.z))
+				{
+					ivec4 Quad(
+						NewVert(Cell + ivec3(0, 0, 0)),
+						NewVert(Cell + ivec3(1, 0, 0)),
+						NewVert(Cell + ivec3(1, 1, 0)),
+						NewVert(Cell + ivec3(0, 1, 0)));
+					if (sign(Dist.w) < sign(Dist.z))
 					{
-						ivec4 Quad(
-							NewVert(Half * vec3(-1.0, -1.0, 1.0) + Cursor),
-							NewVert(Half * vec3(1.0, -1.0, 1.0) + Cursor),
-							NewVert(Half * vec3(1.0, -1.0, -1.0) + Cursor),
-							NewVert(Half * vec3(-1.0, -1.0, -1.0) + Cursor));
-						if (sign(Dist.w) < sign(Dist.y))
-						{
-							Quad = Quad.wzyx;
-						}
-						QuadsCS.lock();
-						Quads.push_back(Quad);
-						QuadsCS.unlock();
+						Quad = Quad.wzyx;
 					}
+					Chunk->Quads.push_back(Quad);
+				}
+			};
 
-					if (sign(Dist.w) != sign(Dist.z))
+			auto ExtractBrick = [&](ivec3 Min, ivec3 Size)
+			{
+				const ivec3 Max = Min + Size;
+				for (int z = Min.z; z < Max.z; ++z)
+				{
+					for (int y = Min.y; y < Max.y; ++y)
 					{
-						ivec4 Quad(
-							NewVert(Half * vec3(-1.0, -1.0, -1.0) + Cursor),
-							NewVert(Half * vec3(1.0, -1.0, -1.0) + Cursor),
-							NewVert(Half * vec3(1.0, 1.0, -1.0) + Cursor),
-							NewVert(Half * vec3(-1.0, 1.0, -1.0) + Cursor));
-						if (sign(Dist.w) < sign(Dist.z))
+						for (int x = Min.x; x < Max.x; ++x)
 						{
-							Quad = Quad.wzyx;
+							ExtractCell(ivec3(x, y, z));
 						}
-						QuadsCS.lock();
-						Quads.push_back(Quad);
-						QuadsCS.unlock();
+					}
+				}
+			};
+
+			while (ExportState.load() == 1 && ExportActive.load())
+			{
+				int i = GenerationProgress.fetch_add(1);
+				if (i < Tasks.size())
+				{
+					Chunk = &Chunks[i];
+					ChunkMin = Tasks[i].Min;
+					FindSurfaceBlocks(Field, Start, Step, Tasks[i].Min, Tasks[i].Size, BrickSize, ExtractBrick);
+					for (const ivec3 Corner : Chunk->Corners)
+					{
+						const ivec3 Local = Corner - ChunkMin;
+						CornerIndex[(Local.z * Span + Local.y) * Span + Local.x] = -1;
 					}
 				}
 				else
@@ -381,6 +661,8 @@ void MeshExportThread(SDFNode* Evaluator, vec3 ModelMin, vec3 ModelMax, vec3 Ste
 				}
 			}
 		});
+
+		MergeChunks(Chunks, Tasks, Start, Step, Vertices, Quads);
 	}
 
 	ExportState.store(2);
@@ -402,17 +684,20 @@ void MeshExportThread(SDFNode* Evaluator, vec3 ModelMin, vec3 ModelMax, vec3 Ste
 					vec3 Cursor = Vertex;
 					for (int r = 0; r < RefineIterations; ++r)
 					{
-						vec3 RayDir = Octree->Gradient(Cursor);
-						float Dist = Octree->Eval(Cursor) * -1.0;
-						Cursor += RayDir * Dist;
+						vec3 Gradient;
+						float Dist = Octree->Eval(Cursor, Gradient);
+						float LengthSquared = dot(Gradient, Gradient);
+						if (LengthSquared == 0.0 || !std::isfinite(Dist * LengthSquared))
+						{
+							// Stepping along a degenerate gradient would throw the cursor off into NaN land.
+							break;
+						}
+						Cursor -= Gradient * (Dist / sqrt(LengthSquared));
 					}
 					Cursor = clamp(Cursor, Low, High);
 
 					if (distance(Cursor, Vertex) <= Diagonal)
 					{
-						// TODO: despite the above clamp, some times the Cursor will end up on 0,0,0 when it would be
-						// well outside a half voxel distance.  This branch should at least prevent that, but there is
-						// probably a problem with the Gradient function that is causing this.
 						Vertex = Cursor;
 					}
 				}
@@ -447,43 +732,69 @@ void PointCloudExportThread(SDFNode* Evaluator, vec3 ModelMin, vec3 ModelMax, ve
 	SDFOctree* Octree = SDFOctree::Create(Evaluator, 0.25);
 
 	std::vector<glm::vec3> Vertices;
-	std::mutex VerticesCS;
 
 	{
 		const vec3 Start = ModelMin;
 		const vec3 Stop = ModelMax;
 		const ivec3 Iterations = ivec3(ceil((Stop - Start) / Step));
-		const int Slice = Iterations.x * Iterations.y;
-		const int TotalCells = Iterations.x * Iterations.y * Iterations.z;
-		VoxelCount.store(TotalCells);
 
+		const SDFInterpreter Field(Evaluator);
+		std::vector<CellBlock> Tasks;
+		{
+			auto AddTask = [&](ivec3 Min, ivec3 Size)
+			{
+				Tasks.push_back({ Min, Size });
+			};
+			FindSurfaceBlocks(Field, Start, Step, ivec3(0), Iterations, TaskSize, AddTask);
+		}
+		VoxelCount.store(int(Tasks.size()));
+
+		// Points are collected per block and then joined in order, so the output is always the same.
+		std::vector<std::vector<vec3>> Chunks(Tasks.size());
 		Pool([&]() \
 		{
-			while (ExportState.load() == 1 && ExportActive.load())
+			std::vector<vec3>* Chunk = nullptr;
+			auto ExtractBrick = [&](ivec3 Min, ivec3 Size)
 			{
-				int i = GenerationProgress.fetch_add(1);
-				if (i < TotalCells)
+				const ivec3 Max = Min + Size;
+				for (int z = Min.z; z < Max.z; ++z)
 				{
-					float Z = float(i / Slice) * Step.z + Start.z;
-					float Y = float((i % Slice) / Iterations.x) * Step.y + Start.y;
-					float X = float(i % Iterations.x) * Step.x + Start.x;
-
-					vec3 Cursor = vec3(X, Y, Z) + Half;
-
-					float Dist = Octree->Eval(Cursor);
-					if (abs(Dist) < Diagonal)
+					for (int y = Min.y; y < Max.y; ++y)
 					{
-						VerticesCS.lock();
-						Vertices.push_back(Cursor);
-						VerticesCS.unlock();
+						for (int x = Min.x; x < Max.x; ++x)
+						{
+							vec3 Cursor = vec3(x, y, z) * Step + Start + Half;
+
+							float Dist = Octree->Eval(Cursor);
+							if (abs(Dist) < Diagonal)
+							{
+								Chunk->push_back(Cursor);
+							}
+						}
 					}
 				}
+			};
+
+			while (ExportState.load() == 1 && ExportActive.load())
+			{
+				int i = GenerationProgress.fetch_add(1);
+				if (i < Tasks.size())
+				{
+					Chunk = &Chunks[i];
+					FindSurfaceBlocks(Field, Start, Step, Tasks[i].Min, Tasks[i].Size, BrickSize, ExtractBrick);
+				}
 				else
 				{
 					break;
 				}
 			}
 		});
+
+		for (std::vector<vec3>& Chunk : Chunks)
+		{
+			Vertices.insert(Vertices.end(), Chunk.begin(), Chunk.end());
+			Chunk = {};
+		}
 	}
 
 	ExportState.store(2);
@@ -505,17 +816,20 @@ void PointCloudExportThread(SDFNode* Evaluator, vec3 ModelMin, vec3 ModelMax, ve
 					vec3 Cursor = Vertex;
 					for (int r = 0; r < RefineIterations; ++r)
 					{
-						vec3 RayDir = Octree->Gradient(Cursor);
-						float Dist = Octree->Eval(Cursor) * -1.0;
-						Cursor += RayDir * Dist;
+						vec3 Gradient;
+						float Dist = Octree->Eval(Cursor, Gradient);
+						float LengthSquared = dot(Gradient, Gradient);
+						if (LengthSquared == 0.0 || !std::isfinite(Dist * LengthSquared))
+						{
+							// Stepping along a degenerate gradient would throw the cursor off into NaN land.
+							break;
+						}
+						Cursor -= Gradient * (Dist / sqrt(LengthSquared));
 					}
 					Cursor = clamp(Cursor, Low, High);
 
 					if (distance(Cursor, Vertex) <= Diagonal)
 					{
-						// TODO: despite the above clamp, some times the Cursor will end up on 0,0,0 when it would be
-						// well outside a half voxel distance.  This branch should at least prevent that, but there is
-						// probably a problem with the Gradient function that is causing this.
 						Vertex = Cursor;
 					}
 				}
@@ -540,69 +854,836 @@ void PointCloudExportThread(SDFNode* Evaluator, vec3 ModelMin, vec3 ModelMax, ve
 }
 
 
-ExportProgress GetExportProgress()
+// Dual contouring places one vertex in each cell that the surface passes through, where it best
+// fits the planes tangent to the surface at the cell's edge crossings.  This keeps sharp edges and
+// corners that the uniform mesher would round off.  Cells are built into an octree, and groups of
+// eight that the same vertex can represent are merged into one, so flat areas need few triangles.
+// The contouring tables and traversal follow "Dual Contouring of Hermite Data" by Ju et al.
+// Children and corners are both numbered so that bit 2 is the X axis, bit 1 is Y, and bit 0 is Z.
+
+inline ivec3 OctantOffset(int Octant)
 {
-	ExportProgress Progress;
-	Progress.Stage = ExportState.load();
-	Progress.Generation = float(GenerationProgress.load() - 1) / float(VoxelCount.load());
-	Progress.Refinement = float(RefinementProgress.load() - 1) / float(VertexCount.load());
-	Progress.Secondary = float(SecondaryProgress.load() - 1) / float(SecondaryCount.load());
-	Progress.Write = float(WriteProgress.load() - 1) / float(WriteCount.load());
-	return Progress;
+	return ivec3((Octant >> 2) & 1, (Octant >> 1) & 1, Octant & 1);
 }
 
 
-void MeshExport(SDFNode* Evaluator, std::string Path, vec3 ModelMin, vec3 ModelMax, vec3 Step, int RefineIterations, ExportFormat Format, bool ExportPointCloud, float Scale)
-{
-	ExportActive.store(true);
-	ExportState.store(0);
-	GenerationProgress.store(0);
-	RefinementProgress.store(0);
-	SecondaryProgress.store(0);
-	WriteProgress.store(0);
-	ExportState.store(1);
+// The two corners joined by each cell edge.  Edges 0-3 run along X, 4-7 along Y, and 8-11 along Z.
+static const int DualEdgeCorners[12][2] = {
+	{ 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 },
+	{ 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },
+	{ 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 },
+};
 
-	auto Thunk = ExportPointCloud ? PointCloudExportThread : MeshExportThread;
-	std::thread ExportThread(Thunk, Evaluator, ModelMin, ModelMax, Step, RefineIterations, Path, Format, Scale);
-	ExportThread.detach();
-}
+// Pairs of children sharing a face within a cell, and the axis the face is perpendicular to.
+static const int CellProcFaceMask[12][3] = {
+	{ 0, 4, 0 }, { 1, 5, 0 }, { 2, 6, 0 }, { 3, 7, 0 },
+	{ 0, 2, 1 }, { 4, 6, 1 }, { 1, 3, 1 }, { 5, 7, 1 },
+	{ 0, 1, 2 }, { 2, 3, 2 }, { 4, 5, 2 }, { 6, 7, 2 },
+};
 
+// Groups of four children sharing an edge within a cell, and the axis the edge runs along.
+static const int CellProcEdgeMask[6][5] = {
+	{ 0, 1, 2, 3, 0 }, { 4, 5, 6, 7, 0 },
+	{ 0, 4, 1, 5, 1 }, { 2, 6, 3, 7, 1 },
+	{ 0, 2, 4, 6, 2 }, { 1, 3, 5, 7, 2 },
+};
 
-void CancelExport(bool Halt)
+// Pairs of children sharing a face between two neighboring cells.
+static const int FaceProcFaceMask[3][4][3] = {
+	{ { 4, 0, 0 }, { 5, 1, 0 }, { 6, 2, 0 }, { 7, 3, 0 } },
+	{ { 2, 0, 1 }, { 6, 4, 1 }, { 3, 1, 1 }, { 7, 5, 1 } },
+	{ { 1, 0, 2 }, { 3, 2, 2 }, { 5, 4, 2 }, { 7, 6, 2 } },
+};
+
+// Groups of four children sharing an edge between two neighboring cells.  The first entry selects
+// which of the two cells each child comes from.
+static const int FaceProcEdgeMask[3][4][6] = {
+	{ { 1, 4, 0, 5, 1, 1 }, { 1, 6, 2, 7, 3, 1 }, { 0, 4, 6, 0, 2, 2 }, { 0, 5, 7, 1, 3, 2 } },
+	{ { 0, 2, 3, 0, 1, 0 }, { 0, 6, 7, 4, 5, 0 }, { 1, 2, 0, 6, 4, 2 }, { 1, 3, 1, 7, 5, 2 } },
+	{ { 1, 1, 0, 3, 2, 0 }, { 1, 5, 4, 7, 6, 0 }, { 0, 1, 5, 0, 4, 1 }, { 0, 3, 7, 2, 6, 1 } },
+};
+
+// Pairs of children sharing an edge between four neighboring cells.
+static const int EdgeProcEdgeMask[3][2][5] = {
+	{ { 3, 2, 1, 0, 0 }, { 7, 6, 5, 4, 0 } },
+	{ { 5, 1, 4, 0, 1 }, { 7, 3, 6, 2, 1 } },
+	{ { 6, 4, 2, 0, 2 }, { 7, 5, 3, 1, 2 } },
+};
+
+// The edge of each of the four cells around a shared edge that is the shared edge.
+static const int ProcessEdgeMask[3][4] = {
+	{ 3, 2, 1, 0 }, { 7, 5, 6, 4 }, { 11, 10, 9, 8 },
+};
+
+
+// Finds the eigenvalues and eigenvectors of a symmetric matrix with Jacobi rotations.  The
+// eigenvectors are the columns of Vectors.
+void SymmetricEigen(dmat3 Matrix, dmat3& Vectors, dvec3& Values)
 {
-	if (Halt)
-	{
-		ExportActive.store(false);
-	}
-	else
+	Vectors = dmat3(1.0);
+	for (int Sweep = 0; Sweep < 8; ++Sweep)
 	{
-		ExportState.fetch_add(1);
+		for (int Pair = 0; Pair < 3; ++Pair)
+		{
+			const int P = Pair == 2 ? 1 : 0;
+			const int Q = Pair == 0 ? 1 : 2;
+			const double Off = Matrix[Q][P];
+			if (abs(Off) < 1e-12)
+			{
+				continue;
+			}
+			const double Theta = (Matrix[Q][Q] - Matrix[P][P]) / (2.0 * Off);
+			const double Tangent = (Theta >= 0.0 ? 1.0 : -1.0) / (abs(Theta) + sqrt(Theta * Theta + 1.0));
+			const double Cosine = 1.0 / sqrt(Tangent * Tangent + 1.0);
+			const double Sine = Tangent * Cosine;
+
+			dmat3 Rotation(1.0);
+			Rotation[P][P] = Cosine;
+			Rotation[Q][Q] = Cosine;
+			Rotation[Q][P] = Sine;
+			Rotation[P][Q] = -Sine;
+			Matrix = transpose(Rotation) * Matrix * Rotation;
+			Vectors = Vectors * Rotation;
+		}
 	}
+	Values = dvec3(Matrix[0][0], Matrix[1][1], Matrix[2][2]);
 }
 
 
-void ExportCommon(SDFNode* Evaluator, float GridSize, int RefineIterations, const char* Path, ExportFormat Format, float Scale = 1.0)
+// Accumulates the planes tangent to the surface at a cell's edge crossings, for finding the point
+// nearest to all of them.  Merged cells simply add their children's planes together.
+struct DualQEF
 {
-	AABB Bounds = Evaluator->Bounds();
-	float Step = 1.0 / GridSize;
+	dmat3 ATA = dmat3(0.0);
+	dvec3 ATB = dvec3(0.0);
+	double BTB = 0.0;
+	dvec3 MassSum = dvec3(0.0);
+	int Count = 0;
 
-	ExportActive.store(true);
-	ExportState.store(0);
-	GenerationProgress.store(0);
-	RefinementProgress.store(0);
-	WriteProgress.store(0);
-	ExportState.store(1);
-	MeshExportThread(Evaluator, Bounds.Min, Bounds.Max, vec3(Step), RefineIterations, std::string(Path), Format, Scale);
-}
+	void Add(vec3 Point, vec3 Normal)
+	{
+		const dvec3 N = dvec3(Normal);
+		const double B = dot(N, dvec3(Point));
+		ATA += outerProduct(N, N);
+		ATB += N * B;
+		BTB += B * B;
+		MassSum += dvec3(Point);
+		++Count;
+	}
+
+	void Add(const DualQEF& Other)
+	{
+		ATA += Other.ATA;
+		ATB += Other.ATB;
+		BTB += Other.BTB;
+		MassSum += Other.MassSum;
+		Count += Other.Count;
+	}
+
+	// Returns the point with the least squared distance to the planes, along with that distance.
+	// Directions that the planes don't constrain well are solved for relative to the average of
+	// the crossings instead, so flat areas and edges don't send the vertex off into the distance.
+	vec3 Solve(double& Error) const
+	{
+		const dvec3 Mass = MassSum / double(Count);
+		const dvec3 Residual = ATB - ATA * Mass;
+
+		dmat3 Vectors;
+		dvec3 Values;
+		SymmetricEigen(ATA, Vectors, Values);
+		const double Cutoff = max(max(abs(Values.x), abs(Values.y)), abs(Values.z)) * 0.05;
+
+		dvec3 Point = Mass;
+		for (int i = 0; i < 3; ++i)
+		{
+			if (abs(Values[i]) > Cutoff && Values[i] != 0.0)
+			{
+				Point += Vectors[i] * (dot(Vectors[i], Residual) / Values[i]);
+			}
+		}
+		Error = max(dot(Point, ATA * Point) - 2.0 * dot(Point, ATB) + BTB, 0.0);
+		return vec3(Point);
+	}
+};
+
+
+struct DualNode
+{
+	ivec3 Min;
+	int Size;
+	bool Leaf;
+
+	// Bit N is set when corner N is inside of the model.  This is only valid for leaves.
+	uint8_t Signs;
+
+	DualNode* Children[8];
+	DualQEF QEF;
+	vec3 Vertex;
+	int Index;
+
+	DualNode(ivec3 InMin, int InSize, bool InLeaf)
+		: Min(InMin)
+		, Size(InSize)
+		, Leaf(InLeaf)
+		, Signs(0)
+		, Children{}
+		, Vertex(0.0)
+		, Index(-1)
+	{
+	}
+
+	~DualNode()
+	{
+		for (DualNode* Child : Children)
+		{
+			delete Child;
+		}
+	}
+};
+
+
+struct DualContour
+{
+	SDFOctree* Octree;
+	const SDFInterpreter& Field;
+	vec3 Start;
+	vec3 Step;
+	int RefineIterations;
+	double MaxError;
+
+	// The sampled corners and edge crossings of a block of cells, which are shared by its leaves.
+	struct Brick
+	{
+		static constexpr int Span = BrickSize + 1;
+		ivec3 Min;
+		float Dist[Span * Span * Span];
+		vec3 Points[3][Span * Span * Span];
+		vec3 Normals[3][Span * Span * Span];
+
+		static int Offset(ivec3 Corner)
+		{
+			return (Corner.z * Span + Corner.y) * Span + Corner.x;
+		}
+	};
+
+	vec3 CornerPosition(ivec3 Corner) const
+	{
+		return vec3(Corner) * Step + Start;
+	}
+
+	bool Contains(const DualNode* Node, vec3 Point) const
+	{
+		const vec3 Slop = Step * vec3(0.001);
+		const vec3 Low = CornerPosition(Node->Min) - Slop;
+		const vec3 High = CornerPosition(Node->Min + ivec3(Node->Size)) + Slop;
+		return all(greaterThanEqual(Point, Low)) && all(lessThanEqual(Point, High));
+	}
+
+	// Finds where the surface crosses the edge between two corners that have different signs.
+	void FindCrossing(vec3 Low, vec3 High, float LowDist, float HighDist, const int Axis, vec3& Point, vec3& Normal) const
+	{
+		const bool LowInside = LowDist < 0.0;
+		Point = mix(Low, High, LowDist / (LowDist - HighDist));
+		for (int r = 0; r < RefineIterations; ++r)
+		{
+			const float Dist = Octree->Eval(Point);
+			if (Dist == 0.0)
+			{
+				break;
+			}
+			else if ((Dist < 0.0) == LowInside)
+			{
+				Low = Point;
+				LowDist = Dist;
+			}
+			else
+			{
+				High = Point;
+				HighDist = Dist;
+			}
+			Point = mix(Low, High, LowDist / (LowDist - HighDist));
+		}
+
+		vec3 Gradient;
+		Octree->Eval(Point, Gradient);
+		const float Length = length(Gradient);
+		if (Length > 0.0 && std::isfinite(Length))
+		{
+			Normal = Gradient / Length;
+		}
+		else
+		{
+			// Assume the surface is perpendicular to the edge if the gradient is degenerate.
+			Normal = vec3(0.0);
+			Normal[Axis] = LowInside ? 1.0 : -1.0;
+		}
+	}
+
+	void SampleBrick(Brick& Samples, const int Size) const
+	{
+		const int Span = Size + 1;
+		std::vector<vec3> Corners;
+		std::vector<float> Dists;
+		Corners.reserve(Span * Span * Span);
+		for (int z = 0; z < Span; ++z)
+		{
+			for (int y = 0; y < Span; ++y)
+			{
+				for (int x = 0; x < Span; ++x)
+				{
+					Corners.push_back(CornerPosition(Samples.Min + ivec3(x, y, z)));
+				}
+			}
+		}
+		Dists.resize(Corners.size());
+		Octree->EvalBatch(Corners.data(), Dists.data(), Corners.size());
+
+		int Sample = 0;
+		for (int z = 0; z < Span; ++z)
+		{
+			for (int y = 0; y < Span; ++y)
+			{
+				for (int x = 0; x < Span; ++x)
+				{
+					Samples.Dist[Brick::Offset(ivec3(x, y, z))] = Dists[Sample++];
+				}
+			}
+		}
+
+		for (int z = 0; z < Span; ++z)
+		{
+			for (int y = 0; y < Span; ++y)
+			{
+				for (int x = 0; x < Span; ++x)
+				{
+					const ivec3 Corner(x, y, z);
+					const float Dist = Samples.Dist[Brick::Offset(Corner)];
+					for (int Axis = 0; Axis < 3; ++Axis)
+					{
+						ivec3 Next = Corner;
+						Next[Axis] += 1;
+						if (Next[Axis] < Span)
+						{
+							const float NextDist = Samples.Dist[Brick::Offset(Next)];
+							if ((Dist < 0.0) != (NextDist < 0.0))
+							{
+								FindCrossing(
+									CornerPosition(Samples.Min + Corner), CornerPosition(Samples.Min + Next), Dist, NextDist, Axis,
+									Samples.Points[Axis][Brick::Offset(Corner)], Samples.Normals[Axis][Brick::Offset(Corner)]);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	DualNode* BuildLeaf(const Brick& Samples, const ivec3 Cell) const
+	{
+		const ivec3 Local = Cell - Samples.Min;
+		uint8_t Signs = 0;
+		for (int Corner = 0; Corner < 8; ++Corner)
+		{
+			if (Samples.Dist[Brick::Offset(Local + OctantOffset(Corner))] < 0.0)
+			{
+				Signs |= 1 << Corner;
+			}
+		}
+		if (Signs == 0 || Signs == 0xFF)
+		{
+			return nullptr;
+		}
+
+		DualNode* Leaf = new DualNode(Cell, 1, true);
+		Leaf->Signs = Signs;
+		for (int Edge = 0; Edge < 12; ++Edge)
+		{
+			const int CornerA = DualEdgeCorners[Edge][0];
+			const int CornerB = DualEdgeCorners[Edge][1];
+			if (((Signs >> CornerA) & 1) != ((Signs >> CornerB) & 1))
+			{
+				const int Axis = Edge / 4;
+				const int Offset = Brick::Offset(Local + OctantOffset(CornerA));
+				Leaf->QEF.Add(Samples.Points[Axis][Offset], Samples.Normals[Axis][Offset]);
+			}
+		}
+
+		double Error;
+		Leaf->Vertex = Leaf->QEF.Solve(Error);
+		if (!Contains(Leaf, Leaf->Vertex))
+		{
+			Leaf->Vertex = vec3(Leaf->QEF.MassSum / double(Leaf->QEF.Count));
+		}
+		return Leaf;
+	}
+
+	// Replaces the children of an interior node with a single vertex when they are all leaves, the
+	// merged vertex fits their planes well enough, and merging won't change the surface's topology.
+	void Simplify(DualNode* Node) const
+	{
+		int CenterSign = -1;
+		for (int Octant = 0; Octant < 8; ++Octant)
+		{
+			const DualNode* Child = Node->Children[Octant];
+			if (Child)
+			{
+				if (!Child->Leaf)
+				{
+					return;
+				}
+				CenterSign = (Child->Signs >> (7 - Octant)) & 1;
+			}
+		}
+
+		// Children that were skipped are entirely on the same side of the surface as the center.
+		uint8_t ChildSigns[8];
+		uint8_t Signs = 0;
+		for (int Octant = 0; Octant < 8; ++Octant)
+		{
+			const DualNode* Child = Node->Children[Octant];
+			ChildSigns[Octant] = Child ? Child->Signs : (CenterSign ? 0xFF : 0);
+			Signs |= ChildSigns[Octant] & (1 << Octant);
+		}
+
+		// Every corner of a child is the midpoint of an edge, face, or the whole of the merged cell.
+		// Its sign must match at least one of the corners of that edge, face, or cell, otherwise the
+		// surface crosses it more than once and the merged cell would be missing part of it.
+		for (int Octant = 0; Octant < 8; ++Octant)
+		{
+			for (int Corner = 0; Corner < 8; ++Corner)
+			{
+				const int Free = Corner ^ Octant;
+				if (Free == 0)
+				{
+					continue;
+				}
+				const int Sign = (ChildSigns[Octant] >> Corner) & 1;
+				bool Matched = false;
+				for (int Other = 0; Other < 8 && !Matched; ++Other)
+				{
+					Matched = (Other & ~Free) == (Octant & ~Free) && ((Signs >> Other) & 1) == Sign;
+				}
+				if (!Matched)
+				{
+					return;
+				}
+			}
+		}
+
+		DualQEF Merged;
+		for (const DualNode* Child : Node->Children)
+		{
+			if (Child)
+			{
+				Merged.Add(Child->QEF);
+			}
+		}
+		double Error;
+		const vec3 Vertex = Merged.Solve(Error);
+		if (Error > MaxError || !Contains(Node, Vertex))
+		{
+			return;
+		}
+
+		for (DualNode*& Child : Node->Children)
+		{
+			delete Child;
+			Child = nullptr;
+		}
+		Node->Leaf = true;
+		Node->Signs = Signs;
+		Node->QEF = Merged;
+		Node->Vertex = Vertex;
+	}
+
+	// Builds the octree for a cubic block of cells.  Blocks that can't contain the surface are
+	// skipped, and blocks small enough to be a brick are sampled all at once.
+	DualNode* Build(const ivec3 Min, const int Size, const Brick* Samples = nullptr) const
+	{
+		if (!Samples)
+		{
+			if (!MayContainSurface(Field, Start, Step, Min, ivec3(Size)))
+			{
+				return nullptr;
+			}
+			if (Size <= BrickSize)
+			{
+				std::unique_ptr<Brick> NewSamples = std::make_unique<Brick>();
+				NewSamples->Min = Min;
+				SampleBrick(*NewSamples, Size);
+				return Build(Min, Size, NewSamples.get());
+			}
+		}
+		else if (Size == 1)
+		{
+			return BuildLeaf(*Samples, Min);
+		}
+
+		const int Half = Size / 2;
+		DualNode* Children[8];
+		bool Empty = true;
+		for (int Octant = 0; Octant < 8; ++Octant)
+		{
+			Children[Octant] = Build(Min + OctantOffset(Octant) * Half, Half, Samples);
+			Empty &= Children[Octant] == nullptr;
+		}
+		if (Empty)
+		{
+			return nullptr;
+		}
+
+		DualNode* Node = new DualNode(Min, Size, false);
+		std::copy(Children, Children + 8, Node->Children);
+		Simplify(Node);
+		return Node;
+	}
+
+	static void NumberVertices(DualNode* Node, std::vector<vec3>& Vertices)
+	{
+		if (Node)
+		{
+			if (Node->Leaf)
+			{
+				Node->Index = int(Vertices.size());
+				Vertices.push_back(Node->Vertex);
+			}
+			else
+			{
+				for (DualNode* Child : Node->Children)
+				{
+					NumberVertices(Child, Vertices);
+				}
+			}
+		}
+	}
+
+	static void ProcessEdge(DualNode* Nodes[4], const int Axis, std::vector<ivec4>& Quads)
+	{
+		// The smallest cell around the edge is the one that actually contains it.
+		int Smallest = 0;
+		for (int i = 1; i < 4; ++i)
+		{
+			if (Nodes[i]->Size < Nodes[Smallest]->Size)
+			{
+				Smallest = i;
+			}
+		}
+		const int Edge = ProcessEdgeMask[Axis][Smallest];
+		const int SignA = (Nodes[Smallest]->Signs >> DualEdgeCorners[Edge][0]) & 1;
+		const int SignB = (Nodes[Smallest]->Signs >> DualEdgeCorners[Edge][1]) & 1;
+		if (SignA == SignB)
+		{
+			return;
+		}
+
+		ivec4 Quad = SignA
+			? ivec4(Nodes[0]->Index, Nodes[2]->Index, Nodes[3]->Index, Nodes[1]->Index)
+			: ivec4(Nodes[0]->Index, Nodes[1]->Index, Nodes[3]->Index, Nodes[2]->Index);
+
+		// Merged cells can share a vertex between neighboring corners of the quad.
+		int Distinct = 4;
+		int Shared = -1;
+		for (int i = 0; i < 4; ++i)
+		{
+			if (Quad[i] == Quad[(i + 1) % 4])
+			{
+				--Distinct;
+				Shared = i;
+			}
+		}
+		if (Distinct < 3)
+		{
+			return;
+		}
+		else if (Shared != -1)
+		{
+			Quad = ivec4(Quad[(Shared + 2) % 4], Quad[(Shared + 3) % 4], Quad[Shared], Quad[(Shared + 1) % 4]);
+		}
+		Quads.push_back(Quad);
+	}
+
+	static void EdgeProc(DualNode* Nodes[4], const int Axis, std::vector<ivec4>& Quads)
+	{
+		if (!Nodes[0] || !Nodes[1] || !Nodes[2] || !Nodes[3])
+		{
+			return;
+		}
+		if (Nodes[0]->Leaf && Nodes[1]->Leaf && Nodes[2]->Leaf && Nodes[3]->Leaf)
+		{
+			ProcessEdge(Nodes, Axis, Quads);
+			return;
+		}
+		for (int i = 0; i < 2; ++i)
+		{
+			DualNode* EdgeNodes[4];
+			for (int j = 0; j < 4; ++j)
+			{
+				EdgeNodes[j] = Nodes[j]->Leaf ? Nodes[j] : Nodes[j]->Children[EdgeProcEdgeMask[Axis][i][j]];
+			}
+			EdgeProc(EdgeNodes, EdgeProcEdgeMask[Axis][i][4], Quads);
+		}
+	}
+
+	static void FaceProc(DualNode* Nodes[2], const int Axis, std::vector<ivec4>& Quads)
+	{
+		if (!Nodes[0] || !Nodes[1] || (Nodes[0]->Leaf && Nodes[1]->Leaf))
+		{
+			return;
+		}
+		for (int i = 0; i < 4; ++i)
+		{
+			DualNode* FaceNodes[2];
+			for (int j = 0; j < 2; ++j)
+			{
+				FaceNodes[j] = Nodes[j]->Leaf ? Nodes[j] : Nodes[j]->Children[FaceProcFaceMask[Axis][i][j]];
+			}
+			FaceProc(FaceNodes, FaceProcFaceMask[Axis][i][2], Quads);
+		}
+
+		static const int Orders[2][4] = { { 0, 0, 1, 1 }, { 0, 1, 0, 1 } };
+		for (int i = 0; i < 4; ++i)
+		{
+			const int* Order = Orders[FaceProcEdgeMask[Axis][i][0]];
+			DualNode* EdgeNodes[4];
+			for (int j = 0; j < 4; ++j)
+			{
+				DualNode* Node = Nodes[Order[j]];
+				EdgeNodes[j] = Node->Leaf ? Node : Node->Children[FaceProcEdgeMask[Axis][i][j + 1]];
+			}
+			EdgeProc(EdgeNodes, FaceProcEdgeMask[Axis][i][5], Quads);
+		}
+	}
+
+	static void CellProc(DualNode* Node, std::vector<ivec4>& Quads)
+	{
+		if (!Node || Node->Leaf)
+		{
+			return;
+		}
+		for (DualNode* Child : Node->Children)
+		{
+			CellProc(Child, Quads);
+		}
+		for (int i = 0; i < 12; ++i)
+		{
+			DualNode* FaceNodes[2] = {
+				Node->Children[CellProcFaceMask[i][0]],
+				Node->Children[CellProcFaceMask[i][1]]
+			};
+			FaceProc(FaceNodes, CellProcFaceMask[i][2], Quads);
+		}
+		for (int i = 0; i < 6; ++i)
+		{
+			DualNode* EdgeNodes[4];
+			for (int j = 0; j < 4; ++j)
+			{
+				EdgeNodes[j] = Node->Children[CellProcEdgeMask[i][j]];
+			}
+			EdgeProc(EdgeNodes, CellProcEdgeMask[i][4], Quads);
+		}
+	}
+};
+
+
+// Merged cells may not move their vertex further than this fraction of the voxel size from the
+// planes of the cells they replace.
+static constexpr float DualContourTolerance = 0.1;
+
+
+void DualContourExportThread(SDFNode* Evaluator, vec3 ModelMin, vec3 ModelMax, vec3 Step, int RefineIterations, std::string Path, ExportFormat Format, float Scale)
+{
+	SDFOctree* Octree = SDFOctree::Create(Evaluator, 0.25);
+
+	std::vector<vec3> Vertices;
+	std::vector<ivec4> Quads;
+
+	{
+		// The grid is padded by a cell on every side so the surface never lies on its boundary, and
+		// then rounded up to a power of two so that every octree node is a cube.
+		const vec3 Start = ModelMin - Step;
+		const ivec3 Iterations = ivec3(ceil((ModelMax + Step - Start) / Step));
+		int RootSize = 1;
+		while (RootSize < max(max(Iterations.x, Iterations.y), Iterations.z))
+		{
+			RootSize *= 2;
+		}
+
+		const SDFInterpreter Field(Evaluator);
+		const float Tolerance = min(min(Step.x, Step.y), Step.z) * DualContourTolerance;
+		const DualContour Contour = { Octree, Field, Start, Step, RefineIterations, double(Tolerance * Tolerance) };
+
+		std::vector<CellBlock> Tasks;
+		{
+			auto AddTask = [&](ivec3 Min, ivec3 Size)
+			{
+				Tasks.push_back({ Min, Size });
+			};
+			FindSurfaceBlocks(Field, Start, Step, ivec3(0), ivec3(RootSize), TaskSize, AddTask);
+		}
+		VoxelCount.store(int(Tasks.size()));
+
+		std::vector<DualNode*> TaskNodes(Tasks.size(), nullptr);
+		Pool([&]() \
+		{
+			while (ExportState.load() == 1 && ExportActive.load())
+			{
+				int i = GenerationProgress.fetch_add(1);
+				if (i < Tasks.size())
+				{
+					TaskNodes[i] = Contour.Build(Tasks[i].Min, Tasks[i].Size.x);
+				}
+				else
+				{
+					break;
+				}
+			}
+		});
+
+		// The top of the octree joins the blocks built by each thread.  These are not simplified,
+		// so that merged cells never span more than one block.
+		std::unordered_map<uint64_t, DualNode*> TaskMap;
+		for (int i = 0; i < Tasks.size(); ++i)
+		{
+			TaskMap[CornerKey(Tasks[i].Min)] = TaskNodes[i];
+		}
+		std::function<DualNode*(ivec3, int)> Join = [&](ivec3 Min, int Size) -> DualNode*
+		{
+			if (Size <= TaskSize)
+			{
+				auto Found = TaskMap.find(CornerKey(Min));
+				return Found != TaskMap.end() ? Found->second : nullptr;
+			}
+			const int Half = Size / 2;
+			DualNode* Node = new DualNode(Min, Size, false);
+			bool Empty = true;
+			for (int Octant = 0; Octant < 8; ++Octant)
+			{
+				Node->Children[Octant] = Join(Min + OctantOffset(Octant) * Half, Half);
+				Empty &= Node->Children[Octant] == nullptr;
+			}
+			if (Empty)
+			{
+				delete Node;
+				return nullptr;
+			}
+			return Node;
+		};
+		DualNode* Root = Join(ivec3(0), RootSize);
+
+		DualContour::NumberVertices(Root, Vertices);
+		DualContour::CellProc(Root, Quads);
+		delete Root;
+	}
+
+	// Vertices are already placed on the surface, so there is nothing to refine.
+	ExportState.store(3);
+	VertexCount.store(Vertices.size());
+
+	if (Format == ExportFormat::STL)
+	{
+		WriteSTL(Octree, Path, Vertices, Quads, Scale);
+	}
+	else if (Format == ExportFormat::PLY)
+	{
+		WritePLY(Octree, Path, Vertices, Quads, Scale);
+	}
+
+	ExportState.store(0);
+	delete Octree;
+}
+
+
+ExportProgress GetExportProgress()
+{
+	ExportProgress Progress;
+	Progress.Stage = ExportState.load();
+	Progress.Generation = float(GenerationProgress.load() - 1) / float(VoxelCount.load());
+	Progress.Refinement = float(RefinementProgress.load() - 1) / float(VertexCount.load());
+	Progress.Secondary = float(SecondaryProgress.load() - 1) / float(SecondaryCount.load());
+	Progress.Write = float(WriteProgress.load() - 1) / float(WriteCount.load());
+	return Progress;
+}
+
+
+using ExportThunk = void(*)(SDFNode*, vec3, vec3, vec3, int, std::string, ExportFormat, float);
+
+
+ExportThunk GetExportThunk(ExportMode Mode)
+{
+	switch (Mode)
+	{
+	case ExportMode::DualContouring:
+		return DualContourExportThread;
+	case ExportMode::PointCloud:
+		return PointCloudExportThread;
+	default:
+		return MeshExportThread;
+	}
+}
+
+
+void MeshExport(SDFNode* Evaluator, std::string Path, vec3 ModelMin, vec3 ModelMax, vec3 Step, int RefineIterations, ExportFormat Format, ExportMode Mode, float Scale)
+{
+	ExportActive.store(true);
+	ExportState.store(0);
+	GenerationProgress.store(0);
+	RefinementProgress.store(0);
+	SecondaryProgress.store(0);
+	WriteProgress.store(0);
+	ExportState.store(1);
+
+	std::thread ExportThread(GetExportThunk(Mode), Evaluator, ModelMin, ModelMax, Step, RefineIterations, Path, Format, Scale);
+	ExportThread.detach();
+}
+
+
+void CancelExport(bool Halt)
+{
+	if (Halt)
+	{
+		ExportActive.store(false);
+	}
+	else
+	{
+		ExportState.fetch_add(1);
+	}
+}
+
+
+void ExportCommon(SDFNode* Evaluator, float GridSize, int RefineIterations, const char* Path, ExportFormat Format, ExportMode Mode, float Scale = 1.0)
+{
+	AABB Bounds = Evaluator->Bounds();
+	float Step = 1.0 / GridSize;
+
+	ExportActive.store(true);
+	ExportState.store(0);
+	GenerationProgress.store(0);
+	RefinementProgress.store(0);
+	WriteProgress.store(0);
+	ExportState.store(1);
+	GetExportThunk(Mode)(Evaluator, Bounds.Min, Bounds.Max, vec3(Step), RefineIterations, std::string(Path), Format, Scale);
+}
 
 
 extern "C" TANGERINE_API void ExportSTL(SDFNode* Evaluator, float GridSize, int RefineIterations, const char* Path)
 {
-	ExportCommon(Evaluator, GridSize, RefineIterations, Path, ExportFormat::STL);
+	ExportCommon(Evaluator, GridSize, RefineIterations, Path, ExportFormat::STL, ExportMode::Grid);
 }
 
 
 extern "C" TANGERINE_API void ExportPLY(SDFNode * Evaluator, float GridSize, int RefineIterations, const char* Path)
 {
-	ExportCommon(Evaluator, GridSize, RefineIterations, Path, ExportFormat::PLY);
+	ExportCommon(Evaluator, GridSize, RefineIterations, Path, ExportFormat::PLY, ExportMode::Grid);
+}
+
+
+extern "C" TANGERINE_API void ExportAdaptiveSTL(SDFNode* Evaluator, float GridSize, int RefineIterations, const char* Path)
+{
+	ExportCommon(Evaluator, GridSize, RefineIterations, Path, ExportFormat::STL, ExportMode::DualContouring);
+}
+
+
+extern "C" TANGERINE_API void ExportAdaptivePLY(SDFNode* Evaluator, float GridSize, int RefineIterations, const char* Path)
+{
+	ExportCommon(Evaluator, GridSize, RefineIterations, Path, ExportFormat::PLY, ExportMode::DualContouring);
 }
@@ -24,6 +24,13 @@ enum class ExportFormat
 	Unknown,
 };
 
+enum class ExportMode
+{
+	Grid,
+	DualContouring,
+	PointCloud,
+};
+
 struct ExportProgress
 {
 	int Stage;
@@ -33,6 +40,6 @@ struct ExportProgress
 	float Write;
 };
 
-void MeshExport(SDFNode* Evaluator, std::string Path, glm::vec3 ModelMin, glm::vec3 ModelMax, glm::vec3 Step, int RefineIterations, ExportFormat Format, bool ExportPointCloud, float Scale = 1.0);
+void MeshExport(SDFNode* Evaluator, std::string Path, glm::vec3 ModelMin, glm::vec3 ModelMax, glm::vec3 Step, int RefineIterations, ExportFormat Format, ExportMode Mode, float Scale = 1.0);
 void CancelExport(bool Halt);
 ExportProgress GetExportProgress();
@@ -16,6 +16,7 @@
 #include "installation.h"
 #include "whereami.h"
 #include <iostream>
+#include <cstdlib>
 
 
 StatusCode TangerinePaths::PopulateInstallationPaths()
@@ -59,5 +60,26 @@ StatusCode TangerinePaths::PopulateInstallationPaths()
 	ShadersDir = PkgDataDir / std::filesystem::path("shaders");
 	ModelsDir = PkgDataDir / std::filesystem::path("models");
 
+	{
+#if _WIN64
+		const char* UserCacheDir = getenv("LOCALAPPDATA");
+		if (UserCacheDir)
+		{
+			CacheDir = std::filesystem::path(UserCacheDir) / "tangerine" / "cache";
+		}
+#else
+		const char* UserCacheDir = getenv("XDG_CACHE_HOME");
+		const char* HomeDir = getenv("HOME");
+		if (UserCacheDir && UserCacheDir[0] != '\0')
+		{
+			CacheDir = std::filesystem::path(UserCacheDir) / "tangerine";
+		}
+		else if (HomeDir)
+		{
+			CacheDir = std::filesystem::path(HomeDir) / ".cache" / "tangerine";
+		}
+#endif
+	}
+
 	return StatusCode::PASS;
 }
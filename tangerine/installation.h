@@ -28,4 +28,7 @@ struct TangerinePaths
 	std::filesystem::path PkgDataDir;
 	std::filesystem::path ShadersDir;
 	std::filesystem::path ModelsDir;
+
+	// Per-user directory for caching compiled models.  This is empty if none could be found.
+	std::filesystem::path CacheDir;
 };
@@ -43,13 +43,20 @@ LuaModel* GetSDFModel(lua_State* L, int Arg)
 }
 
 
+// NewNode is either a copy that was modified, or a held node returned by one of the SDF
+// constructors.  The wrapper takes over the reference either way.
 int WrapSDFNode(lua_State* L, SDFNode* NewNode)
 {
+	// Nodes that were copied and modified are interned here, so that equivalent trees built
+	// from Lua share their nodes.  SDF::Intern returns a held node.
+	if (!NewNode->IsInterned())
+	{
+		NewNode = SDF::Intern(NewNode);
+	}
 	SDFNode** Wrapper = (SDFNode**)lua_newuserdata(L, sizeof(SDFNode*));
 	luaL_getmetatable(L, "tangerine.sdf");
 	lua_setmetatable(L, -2);
 	*Wrapper = NewNode;
-	NewNode->Hold();
 	return 1;
 }
 
@@ -180,6 +187,53 @@ int LuaFlate(lua_State* L)
 }
 
 
+int LuaRepeatGrid(lua_State* L)
+{
+	int NextArg = 2;
+	glm::vec3 Period = GetVec3(L, NextArg);
+
+	// Repeat without limit when no counts are given.
+	glm::vec3 Count(0.0);
+	if (lua_gettop(L) >= NextArg)
+	{
+		Count = GetVec3(L, NextArg);
+	}
+
+	SDFNode* Node = GetSDFNode(L, 1);
+	SDFNode* NewNode = SDF::RepeatGrid(Node, Period, Count);
+	return WrapSDFNode(L, NewNode);
+}
+
+
+int LuaRepeatPolar(lua_State* L)
+{
+	int Count = (int)luaL_checkinteger(L, 2);
+	SDFNode* Node = GetSDFNode(L, 1);
+	SDFNode* NewNode = SDF::RepeatPolar(Node, Count);
+	return WrapSDFNode(L, NewNode);
+}
+
+
+template<bool X, bool Y, bool Z>
+int LuaMirrorAxis(lua_State* L)
+{
+	SDFNode* Node = GetSDFNode(L, 1);
+	SDFNode* NewNode = SDF::Mirror(Node, glm::bvec3(X, Y, Z));
+	return WrapSDFNode(L, NewNode);
+}
+
+
+int LuaMirror(lua_State* L)
+{
+	int NextArg = 2;
+	glm::vec3 Normal = GetVec3(L, NextArg);
+	float Offset = (float)luaL_optnumber(L, NextArg, 0.0);
+	SDFNode* Node = GetSDFNode(L, 1);
+	SDFNode* NewNode = SDF::Mirror(Node, Normal, Offset);
+	return WrapSDFNode(L, NewNode);
+}
+
+
 template <bool Force>
 int LuaPaint(lua_State* L)
 {
@@ -337,7 +391,9 @@ int LuaOperator(lua_State* L)
 	for (int i = 3; i <= Args; ++i)
 	{
 		SDFNode** Next = (SDFNode**)luaL_checkudata(L, i, "tangerine.sdf");
-		NewNode = Operator<Family>(NewNode, *Next);
+		SDFNode* Combined = Operator<Family>(NewNode, *Next);
+		NewNode->Release();
+		NewNode = Combined;
 	}
 
 	return WrapSDFNode(L, NewNode);
@@ -358,7 +414,9 @@ int LuaBlendOperator(lua_State* L)
 	for (int i = 3; i <= Args; ++i)
 	{
 		SDFNode** Next = (SDFNode**)luaL_checkudata(L, i, "tangerine.sdf");
-		NewNode = Operator<Family>(Threshold, NewNode, *Next);
+		SDFNode* Combined = Operator<Family>(Threshold, NewNode, *Next);
+		NewNode->Release();
+		NewNode = Combined;
 	}
 
 	return WrapSDFNode(L, NewNode);
@@ -393,7 +451,7 @@ int LuaPickColor(lua_State* L)
 	SDFNode* Node = GetSDFNode(L, 1);
 	int NextArg = 2;
 	glm::vec3 Point = GetVec3(L, NextArg);
-	glm::vec4 Color = Node->Sample(Point);
+	glm::vec4 Color = Node->EvalMaterial(Point).Color;
 	CreateVec(L, Color);
 	return 1;
 }
@@ -695,6 +753,13 @@ const luaL_Reg LuaSDFType[] = \
 
 	{ "scale", LuaScale },
 	{ "flate", LuaFlate },
+	{ "repeat_grid", LuaRepeatGrid },
+	{ "repeat_polar", LuaRepeatPolar },
+
+	{ "mirror", LuaMirror },
+	{ "mirror_x", LuaMirrorAxis<true, false, false> },
+	{ "mirror_y", LuaMirrorAxis<false, true, false> },
+	{ "mirror_z", LuaMirrorAxis<false, false, true> },
 
 	{ "paint", LuaPaint<false> },
 	{ "paint_over", LuaPaint<true> },
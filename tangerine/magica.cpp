@@ -35,35 +35,46 @@ void VoxExport(SDFNode* Evaluator, std::string& Path, float GridSize, int ColorI
 		Radius = glm::distance(Bounds.Min, glm::mix(Bounds.Min, Bounds.Max, Alpha));
 	}
 
-	const int Slice = Size.x * Size.y;
-	const int TotalCells = Size.x * Size.y * Size.z;
-	std::atomic_int Progress;
+	const int Rows = Size.y * Size.z;
+	std::atomic_int Progress(0);
 
 	vox::VoxWriter Writer(Size.x, Size.y, Size.z);
 
 	std::mutex MagicCS;
 
+	SDFInterpreter Interpreter(Evaluator);
+
 	Pool([&]()
 	{
+		std::vector<glm::vec3> Points(Size.x);
+		std::vector<float> Dists(Size.x);
+
 		while(true)
 		{
+			// Each task is a row of voxels along the X axis, which are evaluated as a batch.
 			const int i = Progress.fetch_add(1);
-			if (i >= TotalCells)
+			if (i >= Rows)
 			{
 				break;
 			}
-			int z = i / Slice;
-			int y = (i % Slice) / Size.x;
-			int x = i % Size.x;
-
-			glm::vec3 Alpha = glm::vec3(x + .5, y + .5, z + .5) / glm::vec3(Size);
-			glm::vec3 Point = glm::mix(Bounds.Min, Bounds.Max, Alpha);
-			float Dist = Evaluator->Eval(Point);
-			if (abs(Dist) <= Radius)
+			int z = i / Size.y;
+			int y = i % Size.y;
+
+			for (int x = 0; x < Size.x; ++x)
+			{
+				glm::vec3 Alpha = glm::vec3(x + .5, y + .5, z + .5) / glm::vec3(Size);
+				Points[x] = glm::mix(Bounds.Min, Bounds.Max, Alpha);
+			}
+			Interpreter.EvalBatch(Points.data(), Dists.data(), Size.x);
+
+			for (int x = 0; x < Size.x; ++x)
 			{
-				MagicCS.lock();
-				Writer.AddVoxel(x, y, z, abs(ColorIndex) % 255 + 1);
-				MagicCS.unlock();
+				if (abs(Dists[x]) <= Radius)
+				{
+					MagicCS.lock();
+					Writer.AddVoxel(x, y, z, abs(ColorIndex) % 255 + 1);
+					MagicCS.unlock();
+				}
 			}
 		}
 	});
@@ -0,0 +1,135 @@
+
+// Copyright 2022 Aeva Palecek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include "sdf_arena.h"
+
+
+static const size_t ArenaBlockSize = 64 * 1024;
+
+
+// Arena generations are never reused, so a thread's cached shard can't be mistaken for a shard of
+// a newer arena that happens to have the same address.
+static std::atomic<uint64_t> NextArenaGeneration = 1;
+
+
+struct ShardCache
+{
+	uint64_t Generation = 0;
+	void* Shard = nullptr;
+};
+
+
+static thread_local ShardCache LocalShard;
+
+
+SDFArena::SDFArena()
+	: Generation(NextArenaGeneration.fetch_add(1))
+{
+}
+
+
+SDFArena::~SDFArena()
+{
+	// Arena nodes may hold each other across shards, so all operand references are dropped before
+	// any node is destroyed.
+	for (Shard* Local : Shards)
+	{
+		for (SDFNode* Node : Local->Nodes)
+		{
+			Node->ReleaseOperands();
+		}
+	}
+	for (Shard* Local : Shards)
+	{
+		Local->Destroy(0);
+		for (Block& Allocation : Local->Blocks)
+		{
+			delete[] Allocation.Memory;
+		}
+		delete Local;
+	}
+	Shards.clear();
+}
+
+
+SDFArena::Mark SDFArena::GetMark()
+{
+	Shard& Local = GetShard();
+	return { &Local, Local.Current, Local.Cursor, Local.Nodes.size() };
+}
+
+
+void SDFArena::Rewind(const Mark& Position)
+{
+	Shard& Local = GetShard();
+	if (Position.Shard == &Local)
+	{
+		Local.Destroy(Position.Nodes);
+		Local.Current = Position.Block;
+		Local.Cursor = Position.Cursor;
+	}
+}
+
+
+void* SDFArena::Shard::Allocate(size_t Bytes, size_t Alignment)
+{
+	size_t Start = (Cursor + Alignment - 1) & ~(Alignment - 1);
+	if (Blocks.size() == 0 || Start + Bytes > Blocks[Current].Capacity)
+	{
+		const size_t Next = Blocks.size() == 0 ? 0 : Current + 1;
+		if (Next == Blocks.size() || Blocks[Next].Capacity < Bytes)
+		{
+			const size_t Capacity = std::max(Bytes, ArenaBlockSize);
+			Blocks.insert(Blocks.begin() + Next, { new char[Capacity], Capacity });
+		}
+		Current = Next;
+		Start = 0;
+	}
+	Cursor = Start + Bytes;
+	return Blocks[Current].Memory + Start;
+}
+
+
+void SDFArena::Shard::Destroy(size_t FirstNode)
+{
+	for (size_t i = FirstNode; i < Nodes.size(); ++i)
+	{
+		Nodes[i]->ReleaseOperands();
+	}
+	for (size_t i = Nodes.size(); i > FirstNode; --i)
+	{
+		Nodes[i - 1]->~SDFNode();
+	}
+	Nodes.resize(FirstNode);
+}
+
+
+SDFArena::Shard& SDFArena::GetShard()
+{
+	if (LocalShard.Generation != Generation)
+	{
+		Shard* NewShard = new Shard();
+		{
+			std::scoped_lock Lock(ShardsCS);
+			Shards.push_back(NewShard);
+		}
+		LocalShard.Generation = Generation;
+		LocalShard.Shard = NewShard;
+	}
+	return *((Shard*)LocalShard.Shard);
+}
@@ -0,0 +1,100 @@
+
+// Copyright 2022 Aeva Palecek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <new>
+#include <utility>
+#include "sdf_evaluator.h"
+
+
+// Bump allocator for the short lived nodes created while building an SDFOctree.  Nodes allocated
+// from an arena are not freed when released, and are instead all destroyed at once when the arena
+// is deleted, or when the calling thread rewinds the arena to an earlier mark.  Each thread
+// allocates from its own blocks, so allocation never contends.
+struct SDFArena
+{
+	struct Mark
+	{
+		void* Shard;
+		size_t Block;
+		size_t Cursor;
+		size_t Nodes;
+	};
+
+	SDFArena();
+	SDFArena(const SDFArena&) = delete;
+	~SDFArena();
+
+	// Returns the current position of the calling thread's allocations.
+	Mark GetMark();
+
+	// Destroy every node the calling thread allocated since the given mark.  None of these nodes
+	// may still be held by anything that was allocated before the mark or outside of the arena.
+	void Rewind(const Mark& Position);
+
+	template<typename NodeT, typename... ArgsT>
+	NodeT* New(ArgsT&&... Args)
+	{
+		Shard& Local = GetShard();
+		void* Memory = Local.Allocate(sizeof(NodeT), alignof(NodeT));
+		NodeT* Node = new (Memory) NodeT(std::forward<ArgsT>(Args)...);
+		Node->InArena = true;
+		Local.Nodes.push_back(Node);
+		return Node;
+	}
+
+private:
+	struct Block
+	{
+		char* Memory;
+		size_t Capacity;
+	};
+
+	struct Shard
+	{
+		// Blocks are kept after a rewind for later allocations to reuse.
+		std::vector<Block> Blocks;
+		size_t Current = 0;
+		size_t Cursor = 0;
+		std::vector<SDFNode*> Nodes;
+
+		void* Allocate(size_t Bytes, size_t Alignment);
+		void Destroy(size_t FirstNode);
+	};
+
+	Shard& GetShard();
+
+	const uint64_t Generation;
+	std::mutex ShardsCS;
+	std::vector<Shard*> Shards;
+};
+
+
+// Allocate a node from the given arena, or from the heap if Arena is nullptr.
+template<typename NodeT, typename... ArgsT>
+NodeT* ArenaNew(SDFArena* Arena, ArgsT&&... Args)
+{
+	if (Arena)
+	{
+		return Arena->New<NodeT>(std::forward<ArgsT>(Args)...);
+	}
+	else
+	{
+		return new NodeT(std::forward<ArgsT>(Args)...);
+	}
+}
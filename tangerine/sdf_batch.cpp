@@ -0,0 +1,433 @@
+// Copyright 2022 Aeva Palecek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include "simd.h"
+#include "sdf_evaluator.h"
+#include "../shaders/defines.h"
+
+
+using namespace glm;
+
+
+// These mirror the functions of the same names in math.glsl, but operate on a packet of points.
+namespace SDFMathN
+{
+	FloatN SphereBrush(const Vec3N& Point, float Radius)
+	{
+		return length(Point) - Radius;
+	}
+
+	FloatN EllipsoidBrush(const Vec3N& Point, float RadipodeX, float RadipodeY, float RadipodeZ)
+	{
+		const Vec3N A = { Point.x / RadipodeX, Point.y / RadipodeY, Point.z / RadipodeZ };
+		const Vec3N B = { A.x / RadipodeX, A.y / RadipodeY, A.z / RadipodeZ };
+		const FloatN K0 = length(A);
+		const FloatN K1 = length(B);
+		return K0 * (K0 - 1.0f) / K1;
+	}
+
+	FloatN BoxBrush(const Vec3N& Point, float ExtentX, float ExtentY, float ExtentZ)
+	{
+		const FloatN Zero(0.0f);
+		const Vec3N A = { abs(Point.x) - ExtentX, abs(Point.y) - ExtentY, abs(Point.z) - ExtentZ };
+		const Vec3N Outside = { max(A.x, Zero), max(A.y, Zero), max(A.z, Zero) };
+		return length(Outside) + min(max(max(A.x, A.y), A.z), Zero);
+	}
+
+	FloatN TorusBrush(const Vec3N& Point, float MajorRadius, float MinorRadius)
+	{
+		const Vec2N Ring = { length(Vec2N{ Point.x, Point.y }) - MajorRadius, Point.z };
+		return length(Ring) - MinorRadius;
+	}
+
+	FloatN CylinderBrush(const Vec3N& Point, float Radius, float Extent)
+	{
+		const FloatN Zero(0.0f);
+		const Vec2N D = { abs(length(Vec2N{ Point.x, Point.y })) - Radius, abs(Point.z) - Extent };
+		const Vec2N Outside = { max(D.x, Zero), max(D.y, Zero) };
+		return min(max(D.x, D.y), Zero) + length(Outside);
+	}
+
+	FloatN Plane(const Vec3N& Point, float NormalX, float NormalY, float NormalZ)
+	{
+		return Point.x * NormalX + Point.y * NormalY + Point.z * NormalZ;
+	}
+
+	FloatN ConeBrush(const Vec3N& Point, float Tangent, float Height)
+	{
+		const FloatN Zero(0.0f);
+		const FloatN One(1.0f);
+		const vec2 Q = Height * vec2(Tangent, -1.0);
+		const float QQ = dot(Q, Q);
+		const Vec2N W = { length(Vec2N{ Point.x, Point.y }), Point.z + Height * -.5f };
+		const FloatN WQ = W.x * Q.x + W.y * Q.y;
+		const FloatN AlphaA = clamp(WQ / QQ, Zero, One);
+		const Vec2N A = { W.x - AlphaA * Q.x, W.y - AlphaA * Q.y };
+		const FloatN AlphaB = clamp(W.x / Q.x, Zero, One);
+		const Vec2N B = { W.x - AlphaB * Q.x, W.y - Q.y };
+		const float K = Q.y > 0.0 ? 1.0f : (Q.y < 0.0 ? -1.0f : 0.0f);
+		const FloatN D = min(dot(A, A), dot(B, B));
+		const FloatN S = max((W.x * Q.y - W.y * Q.x) * K, (W.y - Q.y) * K);
+		return sqrt(D) * sign(S);
+	}
+
+	FloatN ConinderBrush(const Vec3N& Point, float RadiusL, float RadiusH, float Height)
+	{
+		const FloatN Zero(0.0f);
+		const FloatN One(1.0f);
+		const Vec2N Q = { length(Vec2N{ Point.x, Point.y }), Point.z };
+		const vec2 K1 = vec2(RadiusH, Height);
+		const vec2 K2 = vec2(RadiusH - RadiusL, 2.0 * Height);
+		const FloatN Radius = Select(Q.y < Zero, FloatN(RadiusL), FloatN(RadiusH));
+		const Vec2N CA = { Q.x - min(Q.x, Radius), abs(Q.y) - Height };
+		const FloatN Alpha = clamp(((K1.x - Q.x) * K2.x + (K1.y - Q.y) * K2.y) / dot(K2, K2), Zero, One);
+		const Vec2N CB = { Q.x - K1.x + Alpha * K2.x, Q.y - K1.y + Alpha * K2.y };
+		const FloatN S = Select((CB.x < Zero) & (CA.y < Zero), FloatN(-1.0f), One);
+		return S * sqrt(min(dot(CA, CA), dot(CB, CB)));
+	}
+
+	FloatN UnionOp(FloatN LHS, FloatN RHS)
+	{
+		return min(LHS, RHS);
+	}
+
+	FloatN InterOp(FloatN LHS, FloatN RHS)
+	{
+		return max(LHS, RHS);
+	}
+
+	FloatN DiffOp(FloatN LHS, FloatN RHS)
+	{
+		return max(LHS, -RHS);
+	}
+
+	FloatN SmoothUnionOp(FloatN LHS, FloatN RHS, float Threshold)
+	{
+		const FloatN H = max(FloatN(Threshold) - abs(LHS - RHS), FloatN(0.0f));
+		return min(LHS, RHS) - H * H * (0.25f / Threshold);
+	}
+
+	FloatN SmoothInterOp(FloatN LHS, FloatN RHS, float Threshold)
+	{
+		const FloatN H = max(FloatN(Threshold) - abs(LHS - RHS), FloatN(0.0f));
+		return max(LHS, RHS) + H * H * (0.25f / Threshold);
+	}
+
+	FloatN SmoothDiffOp(FloatN LHS, FloatN RHS, float Threshold)
+	{
+		const FloatN H = max(FloatN(Threshold) - abs(LHS + RHS), FloatN(0.0f));
+		return max(LHS, -RHS) + H * H * (0.25f / Threshold);
+	}
+}
+
+
+// Folds only happen once per folded subtree, so each lane is folded with the scalar version rather
+// than vectorizing the trigonometry needed for polar repetition.
+Vec3N FoldPacket(const Vec3N& Point, uint32_t Opcode, const float* Params)
+{
+	alignas(32) float X[SIMD_LANES];
+	alignas(32) float Y[SIMD_LANES];
+	alignas(32) float Z[SIMD_LANES];
+	Point.x.Store(X);
+	Point.y.Store(Y);
+	Point.z.Store(Z);
+	for (int Lane = 0; Lane < SIMD_LANES; ++Lane)
+	{
+		const vec3 Lanes = vec3(X[Lane], Y[Lane], Z[Lane]);
+		const vec3 Folded = FoldPoint(Opcode, Lanes, Params);
+		X[Lane] = Folded.x;
+		Y[Lane] = Folded.y;
+		Z[Lane] = Folded.z;
+	}
+	return { FloatN::Load(X), FloatN::Load(Y), FloatN::Load(Z) };
+}
+
+
+// Evaluate one packet of points, which have already been converted to the structure-of-arrays layout.
+FloatN EvalPacket(const std::vector<float>& Params, uint32_t StackSize, Vec3N EvalPoint)
+{
+	FloatN LocalStack[32];
+	std::unique_ptr<FloatN[]> SpillStack;
+	FloatN* Stack = LocalStack;
+	if (StackSize > 32)
+	{
+		SpillStack.reset(new FloatN[StackSize]);
+		Stack = SpillStack.get();
+	}
+
+	uint32_t StackPointer = 0;
+	const float* ProgramCounter = Params.data();
+	Vec3N Point = EvalPoint;
+
+	while (true)
+	{
+		const uint32_t Opcode = AsUint(*ProgramCounter++);
+		switch (Opcode)
+		{
+		// Set operators
+		case OPCODE_UNION:
+			--StackPointer;
+			Stack[StackPointer] = SDFMathN::UnionOp(Stack[StackPointer], Stack[StackPointer + 1]);
+			break;
+
+		case OPCODE_INTER:
+			--StackPointer;
+			Stack[StackPointer] = SDFMathN::InterOp(Stack[StackPointer], Stack[StackPointer + 1]);
+			break;
+
+		case OPCODE_DIFF:
+			--StackPointer;
+			Stack[StackPointer] = SDFMathN::DiffOp(Stack[StackPointer], Stack[StackPointer + 1]);
+			break;
+
+		case OPCODE_SMOOTH_UNION:
+			--StackPointer;
+			Stack[StackPointer] = SDFMathN::SmoothUnionOp(Stack[StackPointer], Stack[StackPointer + 1], *ProgramCounter++);
+			break;
+
+		case OPCODE_SMOOTH_INTER:
+			--StackPointer;
+			Stack[StackPointer] = SDFMathN::SmoothInterOp(Stack[StackPointer], Stack[StackPointer + 1], *ProgramCounter++);
+			break;
+
+		case OPCODE_SMOOTH_DIFF:
+			--StackPointer;
+			Stack[StackPointer] = SDFMathN::SmoothDiffOp(Stack[StackPointer], Stack[StackPointer + 1], *ProgramCounter++);
+			break;
+
+		// Brush operands
+		case OPCODE_SPHERE:
+			Stack[StackPointer] = SDFMathN::SphereBrush(Point, ProgramCounter[0]);
+			ProgramCounter += 1;
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_ELLIPSOID:
+			Stack[StackPointer] = SDFMathN::EllipsoidBrush(Point, ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]);
+			ProgramCounter += 3;
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_BOX:
+			Stack[StackPointer] = SDFMathN::BoxBrush(Point, ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]);
+			ProgramCounter += 3;
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_TORUS:
+			Stack[StackPointer] = SDFMathN::TorusBrush(Point, ProgramCounter[0], ProgramCounter[1]);
+			ProgramCounter += 2;
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_CYLINDER:
+			Stack[StackPointer] = SDFMathN::CylinderBrush(Point, ProgramCounter[0], ProgramCounter[1]);
+			ProgramCounter += 2;
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_PLANE:
+			Stack[StackPointer] = SDFMathN::Plane(Point, ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]);
+			ProgramCounter += 3;
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_CONE:
+			Stack[StackPointer] = SDFMathN::ConeBrush(Point, ProgramCounter[0], ProgramCounter[1]);
+			ProgramCounter += 2;
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_CONINDER:
+			Stack[StackPointer] = SDFMathN::ConinderBrush(Point, ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]);
+			ProgramCounter += 3;
+			Point = EvalPoint;
+			break;
+
+		// Brushes with a built in offset
+		case OPCODE_MOVED_SPHERE:
+		{
+			const Vec3N Local = { Point.x - ProgramCounter[0], Point.y - ProgramCounter[1], Point.z - ProgramCounter[2] };
+			Stack[StackPointer] = SDFMathN::SphereBrush(Local, ProgramCounter[3]);
+			ProgramCounter += 4;
+			break;
+		}
+
+		case OPCODE_MOVED_ELLIPSOID:
+		{
+			const Vec3N Local = { Point.x - ProgramCounter[0], Point.y - ProgramCounter[1], Point.z - ProgramCounter[2] };
+			Stack[StackPointer] = SDFMathN::EllipsoidBrush(Local, ProgramCounter[3], ProgramCounter[4], ProgramCounter[5]);
+			ProgramCounter += 6;
+			break;
+		}
+
+		case OPCODE_MOVED_BOX:
+		{
+			const Vec3N Local = { Point.x - ProgramCounter[0], Point.y - ProgramCounter[1], Point.z - ProgramCounter[2] };
+			Stack[StackPointer] = SDFMathN::BoxBrush(Local, ProgramCounter[3], ProgramCounter[4], ProgramCounter[5]);
+			ProgramCounter += 6;
+			break;
+		}
+
+		// Misc
+		case OPCODE_OFFSET:
+			Point.x = Point.x - ProgramCounter[0];
+			Point.y = Point.y - ProgramCounter[1];
+			Point.z = Point.z - ProgramCounter[2];
+			ProgramCounter += 3;
+			break;
+
+		case OPCODE_MATRIX:
+		{
+			const float* M = ProgramCounter;
+			Point = {
+				Point.x * M[0] + Point.y * M[4] + Point.z * M[8] + M[12],
+				Point.x * M[1] + Point.y * M[5] + Point.z * M[9] + M[13],
+				Point.x * M[2] + Point.y * M[6] + Point.z * M[10] + M[14]
+			};
+			ProgramCounter += 16;
+			break;
+		}
+
+		case OPCODE_ROTATE:
+		{
+			quat Rotation;
+			Rotation.x = ProgramCounter[3];
+			Rotation.y = ProgramCounter[4];
+			Rotation.z = ProgramCounter[5];
+			Rotation.w = ProgramCounter[6];
+			const mat3 M = mat3_cast(Rotation);
+			const Vec3N Local = { Point.x - ProgramCounter[0], Point.y - ProgramCounter[1], Point.z - ProgramCounter[2] };
+			Point = {
+				Local.x * M[0][0] + Local.y * M[1][0] + Local.z * M[2][0],
+				Local.x * M[0][1] + Local.y * M[1][1] + Local.z * M[2][1],
+				Local.x * M[0][2] + Local.y * M[1][2] + Local.z * M[2][2]
+			};
+			ProgramCounter += 7;
+			break;
+		}
+
+		case OPCODE_SCALE:
+			Stack[StackPointer] = Stack[StackPointer] * *ProgramCounter++;
+			break;
+
+		case OPCODE_FLATE:
+			Stack[StackPointer] = Stack[StackPointer] - *ProgramCounter++;
+			break;
+
+		case OPCODE_PAINT:
+			ProgramCounter += 3;
+			break;
+
+		case OPCODE_REPEAT_GRID:
+		case OPCODE_REPEAT_POLAR:
+		case OPCODE_MIRROR_AXES:
+		case OPCODE_MIRROR_PLANE:
+			Stack[StackPointer++] = EvalPoint.x;
+			Stack[StackPointer++] = EvalPoint.y;
+			Stack[StackPointer++] = EvalPoint.z;
+			EvalPoint = FoldPacket(Point, Opcode, ProgramCounter);
+			ProgramCounter += FoldParamCount(Opcode);
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_FOLD_END:
+			StackPointer -= 3;
+			EvalPoint = { Stack[StackPointer], Stack[StackPointer + 1], Stack[StackPointer + 2] };
+			Stack[StackPointer] = Stack[StackPointer + 3];
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_PUSH:
+			++StackPointer;
+			break;
+
+		case OPCODE_RETURN:
+			return Stack[0];
+
+		default:
+			Assert(false);
+			return FloatN(INFINITY);
+		}
+	}
+}
+
+
+void SDFInterpreter::EvalBatch(const vec3* Points, float* Out, size_t Count) const
+{
+	alignas(32) float X[SIMD_LANES];
+	alignas(32) float Y[SIMD_LANES];
+	alignas(32) float Z[SIMD_LANES];
+	alignas(32) float Dist[SIMD_LANES];
+
+	for (size_t Base = 0; Base < Count; Base += SIMD_LANES)
+	{
+		// Partial packets repeat the last point to fill the unused lanes.
+		const size_t Valid = std::min(Count - Base, size_t(SIMD_LANES));
+		for (size_t Lane = 0; Lane < SIMD_LANES; ++Lane)
+		{
+			const vec3& Point = Points[Base + std::min(Lane, Valid - 1)];
+			X[Lane] = Point.x;
+			Y[Lane] = Point.y;
+			Z[Lane] = Point.z;
+		}
+
+		const Vec3N Packet = { FloatN::Load(X), FloatN::Load(Y), FloatN::Load(Z) };
+		EvalPacket(Params, StackSize, Packet).Store(Dist);
+
+		for (size_t Lane = 0; Lane < Valid; ++Lane)
+		{
+			Out[Base + Lane] = Dist[Lane];
+		}
+	}
+}
+
+
+void SDFNode::EvalBatch(const vec3* Points, float* Out, size_t Count)
+{
+	SDFInterpreter Interpreter(this);
+	Interpreter.EvalBatch(Points, Out, Count);
+}
+
+
+void SDFOctree::EvalBatch(const vec3* Points, float* Out, size_t Count, const bool Exact)
+{
+	// Consecutive points that land in the same octree cell are evaluated together.
+	size_t Start = 0;
+	while (Start < Count)
+	{
+		SDFOctree* Cell = DescendCell(Points[Start], Exact);
+		size_t Stop = Start + 1;
+		while (Stop < Count && DescendCell(Points[Stop], Exact) == Cell)
+		{
+			++Stop;
+		}
+
+		if (Cell)
+		{
+			Cell->GetInterpreter()->EvalBatch(Points + Start, Out + Start, Stop - Start);
+		}
+		else
+		{
+			for (size_t i = Start; i < Stop; ++i)
+			{
+				Out[i] = INFINITY;
+			}
+		}
+		Start = Stop;
+	}
+}
@@ -0,0 +1,497 @@
+// Copyright 2022 Aeva Palecek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cmath>
+#include <memory>
+#include "sdf_evaluator.h"
+#include "../shaders/defines.h"
+
+
+using namespace glm;
+
+
+// Dual numbers for forward mode automatic differentiation.  Each value carries its partial
+// derivatives with respect to the x, y, and z components of the point being evaluated.
+struct Dual
+{
+	float Value;
+	vec3 Grad;
+
+	Dual() = default;
+	Dual(float InValue) : Value(InValue), Grad(0.0) {}
+	Dual(float InValue, vec3 InGrad) : Value(InValue), Grad(InGrad) {}
+};
+
+inline Dual operator+(const Dual& LHS, const Dual& RHS) { return Dual(LHS.Value + RHS.Value, LHS.Grad + RHS.Grad); }
+inline Dual operator-(const Dual& LHS, const Dual& RHS) { return Dual(LHS.Value - RHS.Value, LHS.Grad - RHS.Grad); }
+inline Dual operator-(const Dual& Value) { return Dual(-Value.Value, -Value.Grad); }
+
+inline Dual operator*(const Dual& LHS, const Dual& RHS)
+{
+	return Dual(LHS.Value * RHS.Value, LHS.Grad * RHS.Value + RHS.Grad * LHS.Value);
+}
+
+inline Dual operator/(const Dual& LHS, const Dual& RHS)
+{
+	return Dual(LHS.Value / RHS.Value, (LHS.Grad * RHS.Value - RHS.Grad * LHS.Value) / (RHS.Value * RHS.Value));
+}
+
+inline Dual sqrt(const Dual& Value)
+{
+	const float Root = std::sqrt(Value.Value);
+	// The derivative is undefined at zero, so treat it as a critical point instead.
+	return Dual(Root, Root > 0.0 ? Value.Grad * (0.5f / Root) : vec3(0.0));
+}
+
+inline Dual abs(const Dual& Value)
+{
+	return Value.Value < 0.0 ? -Value : Value;
+}
+
+inline Dual min(const Dual& LHS, const Dual& RHS)
+{
+	return LHS.Value <= RHS.Value ? LHS : RHS;
+}
+
+inline Dual max(const Dual& LHS, const Dual& RHS)
+{
+	return LHS.Value >= RHS.Value ? LHS : RHS;
+}
+
+inline Dual clamp(const Dual& Value, float Low, float High)
+{
+	return min(max(Value, Dual(Low)), Dual(High));
+}
+
+inline float sign(const Dual& Value)
+{
+	return Value.Value > 0.0 ? 1.0f : (Value.Value < 0.0 ? -1.0f : 0.0f);
+}
+
+
+struct Dual2
+{
+	Dual x;
+	Dual y;
+};
+
+
+struct Dual3
+{
+	Dual x;
+	Dual y;
+	Dual z;
+};
+
+
+inline Dual dot(const Dual2& LHS, const Dual2& RHS)
+{
+	return LHS.x * RHS.x + LHS.y * RHS.y;
+}
+
+
+inline Dual dot(const Dual3& LHS, const Dual3& RHS)
+{
+	return LHS.x * RHS.x + LHS.y * RHS.y + LHS.z * RHS.z;
+}
+
+
+inline Dual length(const Dual2& Vector)
+{
+	return sqrt(dot(Vector, Vector));
+}
+
+
+inline Dual length(const Dual3& Vector)
+{
+	return sqrt(dot(Vector, Vector));
+}
+
+
+// These mirror the functions of the same names in math.glsl, but also find the gradient.
+namespace SDFMathD
+{
+	Dual SphereBrush(const Dual3& Point, float Radius)
+	{
+		return length(Point) - Radius;
+	}
+
+	Dual EllipsoidBrush(const Dual3& Point, float RadipodeX, float RadipodeY, float RadipodeZ)
+	{
+		const Dual3 A = { Point.x / RadipodeX, Point.y / RadipodeY, Point.z / RadipodeZ };
+		const Dual3 B = { A.x / RadipodeX, A.y / RadipodeY, A.z / RadipodeZ };
+		const Dual K0 = length(A);
+		const Dual K1 = length(B);
+		return K0 * (K0 - 1.0f) / K1;
+	}
+
+	Dual BoxBrush(const Dual3& Point, float ExtentX, float ExtentY, float ExtentZ)
+	{
+		const Dual Zero(0.0f);
+		const Dual3 A = { abs(Point.x) - ExtentX, abs(Point.y) - ExtentY, abs(Point.z) - ExtentZ };
+		const Dual3 Outside = { max(A.x, Zero), max(A.y, Zero), max(A.z, Zero) };
+		return length(Outside) + min(max(max(A.x, A.y), A.z), Zero);
+	}
+
+	Dual TorusBrush(const Dual3& Point, float MajorRadius, float MinorRadius)
+	{
+		const Dual2 Ring = { length(Dual2{ Point.x, Point.y }) - MajorRadius, Point.z };
+		return length(Ring) - MinorRadius;
+	}
+
+	Dual CylinderBrush(const Dual3& Point, float Radius, float Extent)
+	{
+		const Dual Zero(0.0f);
+		const Dual2 D = { length(Dual2{ Point.x, Point.y }) - Radius, abs(Point.z) - Extent };
+		const Dual2 Outside = { max(D.x, Zero), max(D.y, Zero) };
+		return min(max(D.x, D.y), Zero) + length(Outside);
+	}
+
+	Dual Plane(const Dual3& Point, float NormalX, float NormalY, float NormalZ)
+	{
+		return Point.x * NormalX + Point.y * NormalY + Point.z * NormalZ;
+	}
+
+	Dual ConeBrush(const Dual3& Point, float Tangent, float Height)
+	{
+		const vec2 Q = Height * vec2(Tangent, -1.0);
+		const float QQ = dot(Q, Q);
+		const Dual2 W = { length(Dual2{ Point.x, Point.y }), Point.z + Height * -.5f };
+		const Dual WQ = W.x * Q.x + W.y * Q.y;
+		const Dual AlphaA = clamp(WQ / QQ, 0.0f, 1.0f);
+		const Dual2 A = { W.x - AlphaA * Q.x, W.y - AlphaA * Q.y };
+		const Dual AlphaB = clamp(W.x / Q.x, 0.0f, 1.0f);
+		const Dual2 B = { W.x - AlphaB * Q.x, W.y - Q.y };
+		const float K = Q.y > 0.0 ? 1.0f : (Q.y < 0.0 ? -1.0f : 0.0f);
+		const Dual D = min(dot(A, A), dot(B, B));
+		const Dual S = max((W.x * Q.y - W.y * Q.x) * K, (W.y - Q.y) * K);
+		return sqrt(D) * sign(S);
+	}
+
+	Dual ConinderBrush(const Dual3& Point, float RadiusL, float RadiusH, float Height)
+	{
+		const Dual2 Q = { length(Dual2{ Point.x, Point.y }), Point.z };
+		const vec2 K1 = vec2(RadiusH, Height);
+		const vec2 K2 = vec2(RadiusH - RadiusL, 2.0 * Height);
+		const Dual Radius = Q.y.Value < 0.0 ? RadiusL : RadiusH;
+		const Dual2 CA = { Q.x - min(Q.x, Radius), abs(Q.y) - Height };
+		const Dual Alpha = clamp(((Q.x * -1.0f + K1.x) * K2.x + (Q.y * -1.0f + K1.y) * K2.y) / dot(K2, K2), 0.0f, 1.0f);
+		const Dual2 CB = { Q.x - K1.x + Alpha * K2.x, Q.y - K1.y + Alpha * K2.y };
+		const float S = (CB.x.Value < 0.0 && CA.y.Value < 0.0) ? -1.0f : 1.0f;
+		return sqrt(min(dot(CA, CA), dot(CB, CB))) * S;
+	}
+
+	Dual UnionOp(const Dual& LHS, const Dual& RHS)
+	{
+		return min(LHS, RHS);
+	}
+
+	Dual InterOp(const Dual& LHS, const Dual& RHS)
+	{
+		return max(LHS, RHS);
+	}
+
+	Dual DiffOp(const Dual& LHS, const Dual& RHS)
+	{
+		return max(LHS, -RHS);
+	}
+
+	Dual SmoothUnionOp(const Dual& LHS, const Dual& RHS, float Threshold)
+	{
+		const Dual H = max(Threshold - abs(LHS - RHS), 0.0f);
+		return min(LHS, RHS) - H * H * (0.25f / Threshold);
+	}
+
+	Dual SmoothInterOp(const Dual& LHS, const Dual& RHS, float Threshold)
+	{
+		const Dual H = max(Threshold - abs(LHS - RHS), 0.0f);
+		return max(LHS, RHS) + H * H * (0.25f / Threshold);
+	}
+
+	Dual SmoothDiffOp(const Dual& LHS, const Dual& RHS, float Threshold)
+	{
+		const Dual H = max(Threshold - abs(LHS + RHS), 0.0f);
+		return max(LHS, -RHS) + H * H * (0.25f / Threshold);
+	}
+}
+
+
+float SDFInterpreter::Eval(vec3 EvalPoint, vec3& Gradient) const
+{
+	Dual LocalStack[32];
+	std::unique_ptr<Dual[]> SpillStack;
+	Dual* Stack = LocalStack;
+	if (StackSize > 32)
+	{
+		SpillStack.reset(new Dual[StackSize]);
+		Stack = SpillStack.get();
+	}
+
+	// The point is seeded with the identity Jacobian, so the brush transforms are differentiated
+	// along with everything else.
+	Dual3 Seed = {
+		Dual(EvalPoint.x, vec3(1.0, 0.0, 0.0)),
+		Dual(EvalPoint.y, vec3(0.0, 1.0, 0.0)),
+		Dual(EvalPoint.z, vec3(0.0, 0.0, 1.0))
+	};
+
+	uint32_t StackPointer = 0;
+	const float* ProgramCounter = Params.data();
+	Dual3 Point = Seed;
+
+	while (true)
+	{
+		const uint32_t Opcode = AsUint(*ProgramCounter++);
+		switch (Opcode)
+		{
+		// Set operators
+		case OPCODE_UNION:
+			--StackPointer;
+			Stack[StackPointer] = SDFMathD::UnionOp(Stack[StackPointer], Stack[StackPointer + 1]);
+			break;
+
+		case OPCODE_INTER:
+			--StackPointer;
+			Stack[StackPointer] = SDFMathD::InterOp(Stack[StackPointer], Stack[StackPointer + 1]);
+			break;
+
+		case OPCODE_DIFF:
+			--StackPointer;
+			Stack[StackPointer] = SDFMathD::DiffOp(Stack[StackPointer], Stack[StackPointer + 1]);
+			break;
+
+		case OPCODE_SMOOTH_UNION:
+			--StackPointer;
+			Stack[StackPointer] = SDFMathD::SmoothUnionOp(Stack[StackPointer], Stack[StackPointer + 1], *ProgramCounter++);
+			break;
+
+		case OPCODE_SMOOTH_INTER:
+			--StackPointer;
+			Stack[StackPointer] = SDFMathD::SmoothInterOp(Stack[StackPointer], Stack[StackPointer + 1], *ProgramCounter++);
+			break;
+
+		case OPCODE_SMOOTH_DIFF:
+			--StackPointer;
+			Stack[StackPointer] = SDFMathD::SmoothDiffOp(Stack[StackPointer], Stack[StackPointer + 1], *ProgramCounter++);
+			break;
+
+		// Brush operands
+		case OPCODE_SPHERE:
+			Stack[StackPointer] = SDFMathD::SphereBrush(Point, ProgramCounter[0]);
+			ProgramCounter += 1;
+			Point = Seed;
+			break;
+
+		case OPCODE_ELLIPSOID:
+			Stack[StackPointer] = SDFMathD::EllipsoidBrush(Point, ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]);
+			ProgramCounter += 3;
+			Point = Seed;
+			break;
+
+		case OPCODE_BOX:
+			Stack[StackPointer] = SDFMathD::BoxBrush(Point, ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]);
+			ProgramCounter += 3;
+			Point = Seed;
+			break;
+
+		case OPCODE_TORUS:
+			Stack[StackPointer] = SDFMathD::TorusBrush(Point, ProgramCounter[0], ProgramCounter[1]);
+			ProgramCounter += 2;
+			Point = Seed;
+			break;
+
+		case OPCODE_CYLINDER:
+			Stack[StackPointer] = SDFMathD::CylinderBrush(Point, ProgramCounter[0], ProgramCounter[1]);
+			ProgramCounter += 2;
+			Point = Seed;
+			break;
+
+		case OPCODE_PLANE:
+			Stack[StackPointer] = SDFMathD::Plane(Point, ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]);
+			ProgramCounter += 3;
+			Point = Seed;
+			break;
+
+		case OPCODE_CONE:
+			Stack[StackPointer] = SDFMathD::ConeBrush(Point, ProgramCounter[0], ProgramCounter[1]);
+			ProgramCounter += 2;
+			Point = Seed;
+			break;
+
+		case OPCODE_CONINDER:
+			Stack[StackPointer] = SDFMathD::ConinderBrush(Point, ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]);
+			ProgramCounter += 3;
+			Point = Seed;
+			break;
+
+		// Brushes with a built in offset
+		case OPCODE_MOVED_SPHERE:
+		{
+			const Dual3 Local = { Point.x - ProgramCounter[0], Point.y - ProgramCounter[1], Point.z - ProgramCounter[2] };
+			Stack[StackPointer] = SDFMathD::SphereBrush(Local, ProgramCounter[3]);
+			ProgramCounter += 4;
+			break;
+		}
+
+		case OPCODE_MOVED_ELLIPSOID:
+		{
+			const Dual3 Local = { Point.x - ProgramCounter[0], Point.y - ProgramCounter[1], Point.z - ProgramCounter[2] };
+			Stack[StackPointer] = SDFMathD::EllipsoidBrush(Local, ProgramCounter[3], ProgramCounter[4], ProgramCounter[5]);
+			ProgramCounter += 6;
+			break;
+		}
+
+		case OPCODE_MOVED_BOX:
+		{
+			const Dual3 Local = { Point.x - ProgramCounter[0], Point.y - ProgramCounter[1], Point.z - ProgramCounter[2] };
+			Stack[StackPointer] = SDFMathD::BoxBrush(Local, ProgramCounter[3], ProgramCounter[4], ProgramCounter[5]);
+			ProgramCounter += 6;
+			break;
+		}
+
+		// Misc
+		case OPCODE_OFFSET:
+			Point.x = Point.x - ProgramCounter[0];
+			Point.y = Point.y - ProgramCounter[1];
+			Point.z = Point.z - ProgramCounter[2];
+			ProgramCounter += 3;
+			break;
+
+		case OPCODE_MATRIX:
+		{
+			const float* M = ProgramCounter;
+			Point = {
+				Point.x * M[0] + Point.y * M[4] + Point.z * M[8] + M[12],
+				Point.x * M[1] + Point.y * M[5] + Point.z * M[9] + M[13],
+				Point.x * M[2] + Point.y * M[6] + Point.z * M[10] + M[14]
+			};
+			ProgramCounter += 16;
+			break;
+		}
+
+		case OPCODE_ROTATE:
+		{
+			quat Rotation;
+			Rotation.x = ProgramCounter[3];
+			Rotation.y = ProgramCounter[4];
+			Rotation.z = ProgramCounter[5];
+			Rotation.w = ProgramCounter[6];
+			const mat3 M = mat3_cast(Rotation);
+			const Dual3 Local = { Point.x - ProgramCounter[0], Point.y - ProgramCounter[1], Point.z - ProgramCounter[2] };
+			Point = {
+				Local.x * M[0][0] + Local.y * M[1][0] + Local.z * M[2][0],
+				Local.x * M[0][1] + Local.y * M[1][1] + Local.z * M[2][1],
+				Local.x * M[0][2] + Local.y * M[1][2] + Local.z * M[2][2]
+			};
+			ProgramCounter += 7;
+			break;
+		}
+
+		case OPCODE_SCALE:
+			Stack[StackPointer] = Stack[StackPointer] * *ProgramCounter++;
+			break;
+
+		case OPCODE_FLATE:
+			Stack[StackPointer] = Stack[StackPointer] - *ProgramCounter++;
+			break;
+
+		case OPCODE_PAINT:
+			ProgramCounter += 3;
+			break;
+
+		case OPCODE_REPEAT_GRID:
+		{
+			// Grid repetition only translates the point, so the Jacobian passes through unchanged.
+			Stack[StackPointer++] = Seed.x;
+			Stack[StackPointer++] = Seed.y;
+			Stack[StackPointer++] = Seed.z;
+			const vec3 Value = vec3(Point.x.Value, Point.y.Value, Point.z.Value);
+			const vec3 Cell = Value - FoldPoint(Opcode, Value, ProgramCounter);
+			Seed = { Point.x - Cell.x, Point.y - Cell.y, Point.z - Cell.z };
+			Point = Seed;
+			ProgramCounter += 9;
+			break;
+		}
+
+		case OPCODE_REPEAT_POLAR:
+		{
+			// Polar repetition rotates the point into the first sector.
+			Stack[StackPointer++] = Seed.x;
+			Stack[StackPointer++] = Seed.y;
+			Stack[StackPointer++] = Seed.z;
+			const vec3 Value = vec3(Point.x.Value, Point.y.Value, Point.z.Value);
+			const float Angle = FoldPolarAngle(Value, ProgramCounter);
+			const float C = cos(Angle);
+			const float S = sin(Angle);
+			Seed = { Point.x * C + Point.y * S, Point.y * C - Point.x * S, Point.z };
+			Point = Seed;
+			ProgramCounter += 1;
+			break;
+		}
+
+		case OPCODE_MIRROR_AXES:
+			Stack[StackPointer++] = Seed.x;
+			Stack[StackPointer++] = Seed.y;
+			Stack[StackPointer++] = Seed.z;
+			Seed = {
+				ProgramCounter[0] != 0.0 ? abs(Point.x) : Point.x,
+				ProgramCounter[1] != 0.0 ? abs(Point.y) : Point.y,
+				ProgramCounter[2] != 0.0 ? abs(Point.z) : Point.z };
+			Point = Seed;
+			ProgramCounter += 3;
+			break;
+
+		case OPCODE_MIRROR_PLANE:
+		{
+			Stack[StackPointer++] = Seed.x;
+			Stack[StackPointer++] = Seed.y;
+			Stack[StackPointer++] = Seed.z;
+			const vec3 Normal = vec3(ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]);
+			const Dual Side = dot(Point, Dual3{ Normal.x, Normal.y, Normal.z }) - ProgramCounter[3];
+			if (Side.Value < 0.0)
+			{
+				const Dual Twice = Side * 2.0f;
+				Seed = { Point.x - Twice * Normal.x, Point.y - Twice * Normal.y, Point.z - Twice * Normal.z };
+			}
+			else
+			{
+				Seed = Point;
+			}
+			Point = Seed;
+			ProgramCounter += 4;
+			break;
+		}
+
+		case OPCODE_FOLD_END:
+			StackPointer -= 3;
+			Seed = { Stack[StackPointer], Stack[StackPointer + 1], Stack[StackPointer + 2] };
+			Stack[StackPointer] = Stack[StackPointer + 3];
+			Point = Seed;
+			break;
+
+		case OPCODE_PUSH:
+			++StackPointer;
+			break;
+
+		case OPCODE_RETURN:
+			Gradient = Stack[0].Grad;
+			return Stack[0].Value;
+
+		default:
+			Assert(false);
+			Gradient = vec3(0.0);
+			return INFINITY;
+		}
+	}
+}
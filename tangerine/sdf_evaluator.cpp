@@ -13,14 +13,24 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <functional>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
 #include <cmath>
 #include <fmt/format.h>
 #include "extern.h"
 #include "profiling.h"
 
 #include "sdf_evaluator.h"
+#include "sdf_jit.h"
+#include "sdf_arena.h"
+#include "threadpool.h"
+#include "../shaders/defines.h"
 #include <glm/gtc/type_ptr.hpp>
 
 
@@ -54,7 +64,176 @@ namespace SDFMath
 }
 
 
-vec3 SDFNode::Gradient(vec3 Point)
+// Interval versions of the brush functions in math.glsl.  These return a range containing every
+// value the corresponding brush function can produce for points within the given box.  The ranges
+// are conservative rather than tight, as the dependencies between terms are not tracked.
+namespace IntervalMath
+{
+	Interval Abs(float Low, float High)
+	{
+		if (Low >= 0.0)
+		{
+			return { Low, High };
+		}
+		else if (High <= 0.0)
+		{
+			return { -High, -Low };
+		}
+		else
+		{
+			return { 0.0, max(-Low, High) };
+		}
+	}
+
+	template<typename VecT>
+	Interval Length(VecT Low, VecT High)
+	{
+		VecT Near;
+		VecT Far;
+		for (int i = 0; i < VecT::length(); ++i)
+		{
+			Interval Axis = Abs(Low[i], High[i]);
+			Near[i] = Axis.Min;
+			Far[i] = Axis.Max;
+		}
+		return { length(Near), length(Far) };
+	}
+
+	Interval SphereBrush(const AABB& Box, float Radius)
+	{
+		Interval Dist = Length(Box.Min, Box.Max);
+		return { Dist.Min - Radius, Dist.Max - Radius };
+	}
+
+	Interval EllipsoidBrush(const AABB& Box, vec3 Radipodes)
+	{
+		const vec3 Squared = Radipodes * Radipodes;
+		Interval K0 = Length(Box.Min / Radipodes, Box.Max / Radipodes);
+		Interval K1 = Length(Box.Min / Squared, Box.Max / Squared);
+		K1.Min = max(K1.Min, K0.Min / max(max(Radipodes.x, Radipodes.y), Radipodes.z));
+
+		// K0 * (K0 - 1.0) is a parabola with its minimum at K0 = 0.5.
+		const float Low = K0.Min * (K0.Min - 1.0);
+		const float High = K0.Max * (K0.Max - 1.0);
+		Interval Numerator = { min(Low, High), max(Low, High) };
+		if (K0.Min <= 0.5 && K0.Max >= 0.5)
+		{
+			Numerator.Min = -0.25;
+		}
+
+		Interval Dist;
+		if (Numerator.Min < 0.0)
+		{
+			Dist.Min = K1.Min > 0.0 ? Numerator.Min / K1.Min : -INFINITY;
+		}
+		else
+		{
+			Dist.Min = Numerator.Min / K1.Max;
+		}
+		if (Numerator.Max < 0.0)
+		{
+			Dist.Max = Numerator.Max / K1.Max;
+		}
+		else
+		{
+			Dist.Max = K1.Min > 0.0 ? Numerator.Max / K1.Min : INFINITY;
+		}
+		return Dist;
+	}
+
+	template<typename VecT>
+	Interval RoundedBox(VecT Low, VecT High)
+	{
+		// The box and cylinder brushes are both "length(max(A, 0.0)) + min(max(A...), 0.0)",
+		// which only ever increases as the components of A increase.
+		float InnerLow = Low[0];
+		float InnerHigh = High[0];
+		for (int i = 1; i < VecT::length(); ++i)
+		{
+			InnerLow = max(InnerLow, Low[i]);
+			InnerHigh = max(InnerHigh, High[i]);
+		}
+		return {
+			length(max(Low, 0.0)) + min(InnerLow, 0.0),
+			length(max(High, 0.0)) + min(InnerHigh, 0.0)
+		};
+	}
+
+	Interval BoxBrush(const AABB& Box, vec3 Extent)
+	{
+		vec3 Low;
+		vec3 High;
+		for (int i = 0; i < 3; ++i)
+		{
+			Interval Axis = Abs(Box.Min[i], Box.Max[i]);
+			Low[i] = Axis.Min - Extent[i];
+			High[i] = Axis.Max - Extent[i];
+		}
+		return RoundedBox(Low, High);
+	}
+
+	Interval TorusBrush(const AABB& Box, float MajorRadius, float MinorRadius)
+	{
+		Interval Radial = Length(vec2(Box.Min.xy), vec2(Box.Max.xy));
+		Interval Ring = Length(vec2(Radial.Min - MajorRadius, Box.Min.z), vec2(Radial.Max - MajorRadius, Box.Max.z));
+		return { Ring.Min - MinorRadius, Ring.Max - MinorRadius };
+	}
+
+	Interval CylinderBrush(const AABB& Box, float Radius, float Extent)
+	{
+		Interval Radial = Length(vec2(Box.Min.xy), vec2(Box.Max.xy));
+		Interval Height = Abs(Box.Min.z, Box.Max.z);
+		return RoundedBox(
+			vec2(Radial.Min - Radius, Height.Min - Extent),
+			vec2(Radial.Max - Radius, Height.Max - Extent));
+	}
+
+	Interval Plane(const AABB& Box, vec3 Normal)
+	{
+		Interval Dist = { 0.0, 0.0 };
+		for (int i = 0; i < 3; ++i)
+		{
+			const float Low = Box.Min[i] * Normal[i];
+			const float High = Box.Max[i] * Normal[i];
+			Dist.Min += min(Low, High);
+			Dist.Max += max(Low, High);
+		}
+		return Dist;
+	}
+
+	Interval Brush(uint32_t Opcode, const float* Params, const AABB& Box)
+	{
+		switch (Opcode)
+		{
+		case OPCODE_SPHERE:
+			return SphereBrush(Box, Params[0]);
+
+		case OPCODE_ELLIPSOID:
+			return EllipsoidBrush(Box, vec3(Params[0], Params[1], Params[2]));
+
+		case OPCODE_BOX:
+			return BoxBrush(Box, vec3(Params[0], Params[1], Params[2]));
+
+		case OPCODE_TORUS:
+			return TorusBrush(Box, Params[0], Params[1]);
+
+		case OPCODE_CYLINDER:
+			return CylinderBrush(Box, Params[0], Params[1]);
+
+		case OPCODE_PLANE:
+			return Plane(Box, vec3(Params[0], Params[1], Params[2]));
+
+		default:
+			// The cone brushes are not worth the trouble, and instead rely on the Lipschitz bound
+			// applied by BrushNode::EvalInterval.
+			return { -INFINITY, INFINITY };
+		}
+	}
+}
+
+
+template<typename EvaluatorT>
+vec3 TetrahedralGradient(EvaluatorT& Evaluator, vec3 Point)
 {
 	float AlmostZero = 0.0001;
 	vec2 Offset = vec2(1.0, -1.0) * vec2(AlmostZero);
@@ -62,50 +241,106 @@ vec3 SDFNode::Gradient(vec3 Point)
 #if 1
 	// Tetrahedral method
 	vec3 Gradient =
-		Offset.xyy * Eval(Point + Offset.xyy) +
-		Offset.yyx * Eval(Point + Offset.yyx) +
-		Offset.yxy * Eval(Point + Offset.yxy) +
-		Offset.xxx * Eval(Point + Offset.xxx);
+		Offset.xyy * Evaluator.Eval(Point + Offset.xyy) +
+		Offset.yyx * Evaluator.Eval(Point + Offset.yyx) +
+		Offset.yxy * Evaluator.Eval(Point + Offset.yxy) +
+		Offset.xxx * Evaluator.Eval(Point + Offset.xxx);
 
 #else
 	// Central differences method
 	vec3 Gradient(
-		Eval(Point + Offset.xyy) - Eval(Point - Offset.xyy),
-		Eval(Point + Offset.yxy) - Eval(Point - Offset.yxy),
-		Eval(Point + Offset.yyx) - Eval(Point - Offset.yyx));
+		Evaluator.Eval(Point + Offset.xyy) - Evaluator.Eval(Point - Offset.xyy),
+		Evaluator.Eval(Point + Offset.yxy) - Evaluator.Eval(Point - Offset.yxy),
+		Evaluator.Eval(Point + Offset.yyx) - Evaluator.Eval(Point - Offset.yyx));
 #endif
 
 	float LengthSquared = dot(Gradient, Gradient);
 	if (LengthSquared == 0.0)
 	{
 		// Gradient is zero.  Let's try again with a worse method.
-		float Dist = Eval(Point);
-		return normalize(vec3(
-			Eval(Point + Offset.xyy) - Dist,
-			Eval(Point + Offset.yxy) - Dist,
-			Eval(Point + Offset.yyx) - Dist));
+		float Dist = Evaluator.Eval(Point);
+		Gradient = vec3(
+			Evaluator.Eval(Point + Offset.xyy) - Dist,
+			Evaluator.Eval(Point + Offset.yxy) - Dist,
+			Evaluator.Eval(Point + Offset.yyx) - Dist);
+		LengthSquared = dot(Gradient, Gradient);
+		if (LengthSquared == 0.0)
+		{
+			// There is no usable gradient here, and normalizing would produce NaNs.
+			return vec3(0.0);
+		}
+	}
+	return Gradient / sqrt(LengthSquared);
+}
+
+
+vec3 SDFNode::Gradient(vec3 Point)
+{
+	return TetrahedralGradient(*this, Point);
+}
+
+
+void SDFNode::AddTerminus(std::vector<float>& TreeParams)
+{
+	TreeParams.push_back(AsFloat(OPCODE_RETURN));
+}
+
+
+static void AddChangedRegion(SDFNode* Node, float Margin, std::vector<AABB>& Changed)
+{
+	if (Node->HasFiniteBounds())
+	{
+		AABB Region = Node->Bounds();
+		Region.Min -= vec3(Margin);
+		Region.Max += vec3(Margin);
+		Changed.push_back(Region);
 	}
 	else
 	{
-		return Gradient / sqrt(LengthSquared);
+		Changed.push_back({ vec3(-INFINITY), vec3(INFINITY) });
 	}
 }
 
 
-void SDFNode::AddTerminus(std::vector<float>& TreeParams)
+void SDFNode::Diff(SDFNode* Previous, float Margin, std::vector<AABB>& Changed)
 {
-	TreeParams.push_back(AsFloat(OPCODE_RETURN));
+	if (*this != *Previous)
+	{
+		AddChangedRegion(this, Margin, Changed);
+		AddChangedRegion(Previous, Margin, Changed);
+	}
 }
 
 
-RayHit SDFNode::RayMarch(glm::vec3 RayStart, glm::vec3 RayDir, int MaxIterations, float Epsilon)
+SDFNode* SDFNode::Simplify(bool)
+{
+	Hold();
+	return this;
+}
+
+
+// Returns true and the bounds of the node if they are finite.  The components of bounds that are
+// reported as finite are also checked, so that boxes with infinite or NaN extents are never trusted.
+static bool FiniteBounds(SDFNode* Node, AABB& Bounds)
+{
+	if (Node->HasFiniteBounds())
+	{
+		Bounds = Node->Bounds();
+		return all(lessThan(abs(Bounds.Min), vec3(INFINITY))) && all(lessThan(abs(Bounds.Max), vec3(INFINITY)));
+	}
+	return false;
+}
+
+
+template<typename EvaluatorT>
+RayHit RayMarchEvaluator(EvaluatorT& Evaluator, vec3 RayStart, vec3 RayDir, int MaxIterations, float Epsilon)
 {
 	RayDir = normalize(RayDir);
 	vec3 Position = RayStart;
 	float Travel = 0.0;
 	for (int i = 0; i < MaxIterations; ++i)
 	{
-		float Dist = Eval(Position);
+		float Dist = Evaluator.Eval(Position);
 		if (Dist <= Epsilon)
 		{
 			return { true, Travel, Position };
@@ -118,25 +353,112 @@ RayHit SDFNode::RayMarch(glm::vec3 RayStart, glm::vec3 RayDir, int MaxIterations
 }
 
 
-using BrushMixin = std::function<float(vec3)>;
+RayHit SDFNode::RayMarch(glm::vec3 RayStart, glm::vec3 RayDir, int MaxIterations, float Epsilon)
+{
+	return RayMarchEvaluator(*this, RayStart, RayDir, MaxIterations, Epsilon);
+}
+
+
+int FoldParamCount(uint32_t Opcode)
+{
+	switch (Opcode)
+	{
+	case OPCODE_REPEAT_GRID:
+		return 9;
+	case OPCODE_REPEAT_POLAR:
+		return 1;
+	case OPCODE_MIRROR_AXES:
+		return 3;
+	case OPCODE_MIRROR_PLANE:
+		return 4;
+	default:
+		UNREACHABLE();
+	}
+}
+
+
+vec3 FoldPoint(uint32_t Opcode, vec3 Point, const float* Params)
+{
+	switch (Opcode)
+	{
+	case OPCODE_REPEAT_GRID:
+		return SDFMath::RepeatGrid(Point,
+			vec3(Params[0], Params[1], Params[2]),
+			vec3(Params[3], Params[4], Params[5]),
+			vec3(Params[6], Params[7], Params[8]));
+	case OPCODE_REPEAT_POLAR:
+		return SDFMath::RepeatPolar(Point, Params[0]);
+	case OPCODE_MIRROR_AXES:
+		return SDFMath::MirrorAxes(Point, vec3(Params[0], Params[1], Params[2]));
+	case OPCODE_MIRROR_PLANE:
+		return SDFMath::MirrorPlane(Point, vec3(Params[0], Params[1], Params[2]), Params[3]);
+	default:
+		UNREACHABLE();
+	}
+}
+
+
+float FoldPolarAngle(vec3 Point, const float* Params)
+{
+	return SDFMath::RepeatPolarAngle(Point, Params[0]);
+}
+
+
 using SetMixin = std::function<float(float, float)>;
 
 
 const vec4 NullColor = vec4(1.0, 1.0, 1.0, 0.0);
 
 
-template<typename ParamsT>
-int StoreParams(std::vector<float>& TreeParams, const ParamsT& NodeParams)
+// Mirrors SelectColor in math.glsl.
+inline vec4 SelectColor(const vec4& LHS, const vec4& RHS, bool TakeLeft)
 {
-	const int Offset = (int)TreeParams.size();
-	for (const float& Param : NodeParams)
+	const bool LHSValid = LHS.a > 0.0;
+	const bool RHSValid = RHS.a > 0.0;
+	if (LHSValid && RHSValid)
+	{
+		return TakeLeft ? LHS : RHS;
+	}
+	else if (LHSValid)
+	{
+		return LHS;
+	}
+	else
 	{
-		TreeParams.push_back(Param);
+		return RHS;
 	}
+}
+
+
+// Free a node that was created but won't be used.  Arena nodes are left for their arena to free.
+void Discard(SDFNode* Node)
+{
+	Node->Hold();
+	Node->Release();
+}
+
+
+int StoreParams(std::vector<float>& TreeParams, const float* NodeParams, int Count)
+{
+	const int Offset = (int)TreeParams.size();
+	TreeParams.insert(TreeParams.end(), NodeParams, NodeParams + Count);
 	return Offset;
 }
 
 
+inline size_t HashCombine(size_t Seed, size_t Value)
+{
+	return Seed ^ (Value + 0x9e3779b97f4a7c15ull + (Seed << 6) + (Seed >> 2));
+}
+
+
+inline size_t HashFloat(size_t Seed, float Value)
+{
+	// Positive and negative zero compare equal, so they must also hash the same.
+	return HashCombine(Seed, Value == 0.0 ? 0 : AsUint(Value));
+}
+
+
 std::string MakeParamList(int Offset, int Count)
 {
 	std::string Params = fmt::format("PARAMS[{}]", Offset++);
@@ -158,111 +480,113 @@ TransformMachine::TransformMachine()
 
 void TransformMachine::Reset()
 {
-	FoldState = State::Identity;
-	LastFold = identity<mat4>();
-	LastFoldInverse = identity<mat4>();
-	OffsetPending = false;
-	OffsetRun = vec3(0.0);
-	RotatePending = false;
-	RotateRun = identity<quat>();
+	Rotation = identity<quat>();
+	Offset = vec3(0.0);
 	AccumulatedScale = 1.0;
+	Kind = State::Identity;
 }
 
-void TransformMachine::FoldOffset()
+void TransformMachine::Move(vec3 MoveBy)
 {
-	FoldState = (State)max((int)FoldState, (int)State::Offset);
-	LastFoldInverse = translate(LastFoldInverse, OffsetRun);
-	LastFold = inverse(LastFoldInverse);
-	OffsetRun = vec3(0.0);
-	OffsetPending = false;
-	FoldState = (State)max((int)FoldState, (int)State::Offset);
+	Offset += MoveBy;
+	Kind = (State)max((int)Kind, (int)State::Offset);
 }
 
-void TransformMachine::FoldRotation()
+void TransformMachine::Rotate(quat RotateBy)
 {
-	LastFoldInverse *= transpose(toMat4(RotateRun));
-	LastFold = inverse(LastFoldInverse);
-	RotateRun = identity<quat>();
-	RotatePending = false;
-	FoldState = (State)max((int)FoldState, (int)State::Matrix);
+	Rotation = normalize(RotateBy * Rotation);
+	Offset = RotateBy * Offset;
+	Kind = State::Matrix;
 }
 
-void TransformMachine::Fold()
+void TransformMachine::Scale(float ScaleBy)
 {
-	if (RotatePending)
-	{
-		FoldRotation();
-	}
-	else if (OffsetPending)
-	{
-		FoldOffset();
-	}
+	Offset *= ScaleBy;
+	AccumulatedScale *= ScaleBy;
+	Kind = State::Matrix;
 }
 
-void TransformMachine::Move(vec3 Offset)
+// Replaces the transform with a cheaper equivalent if there is one, such as when rotations cancel
+// out, and returns true if anything changed.
+bool TransformMachine::Simplify()
 {
-	if (RotatePending)
+	const float Epsilon = 0.000001;
+	if (Kind == State::Matrix && AccumulatedScale == 1.0)
 	{
-		FoldRotation();
+		const mat3 Basis = mat3_cast(Rotation);
+		for (int i = 0; i < 3; ++i)
+		{
+			vec3 Axis = vec3(0.0);
+			Axis[i] = 1.0;
+			if (any(greaterThan(abs(Basis[i] - Axis), vec3(Epsilon))))
+			{
+				return false;
+			}
+		}
+		const vec3 MoveBy = Offset;
+		Reset();
+		Move(MoveBy);
+		Simplify();
+		return true;
 	}
-	OffsetRun -= Offset;
-	OffsetPending = true;
-}
-
-void TransformMachine::Rotate(quat Rotation)
-{
-	if (OffsetPending)
+	else if (Kind == State::Offset && all(lessThanEqual(abs(Offset), vec3(Epsilon))))
 	{
-		FoldOffset();
+		Reset();
+		return true;
 	}
-	RotateRun = Rotation * RotateRun;
-	RotatePending = true;
+	return false;
 }
 
-void TransformMachine::Scale(float ScaleBy)
+mat4 TransformMachine::ToWorld() const
 {
-	Fold();
-	LastFoldInverse = scale_slow(LastFoldInverse, vec3(1.0 / ScaleBy));
-	LastFold = inverse(LastFoldInverse);
-	AccumulatedScale *= ScaleBy;
-	FoldState = State::Matrix;
+	mat4 Matrix = mat4(mat3_cast(Rotation) * AccumulatedScale);
+	Matrix[3] = vec4(Offset, 1.0);
+	return Matrix;
 }
 
-vec3 TransformMachine::ApplyInverse(vec3 Point)
+mat4 TransformMachine::ToLocal() const
 {
-	Fold();
-	vec4 Tmp = LastFoldInverse * vec4(Point, 1.0);
-	return Tmp.xyz / Tmp.www;
+	const mat3 Basis = transpose(mat3_cast(Rotation)) * (1.0f / AccumulatedScale);
+	mat4 Matrix = mat4(Basis);
+	Matrix[3] = vec4(Basis * -Offset, 1.0);
+	return Matrix;
 }
 
-vec3 TransformMachine::Apply(vec3 Point)
+AABB TransformMachine::Apply(const AABB InBounds) const
 {
-	Fold();
-	vec4 Tmp = LastFold * vec4(Point, 1.0);
-	return Tmp.xyz / Tmp.www;
+	switch (Kind)
+	{
+	case State::Identity:
+		return InBounds;
+
+	case State::Offset:
+		return InBounds + Offset;
+
+	case State::Matrix:
+		return ApplyMatrix(InBounds, ToWorld());
+	}
+	UNREACHABLE();
 }
 
-AABB TransformMachine::Apply(const AABB InBounds)
+AABB TransformMachine::ApplyInverse(const AABB InBounds) const
 {
-	Fold();
-	switch (FoldState)
+	switch (Kind)
 	{
 	case State::Identity:
 		return InBounds;
 
 	case State::Offset:
-		return ApplyOffset(InBounds);
+		return InBounds + -Offset;
 
 	case State::Matrix:
-		return ApplyMatrix(InBounds);
+		return ApplyMatrix(InBounds, ToLocal());
 	}
 	UNREACHABLE();
 }
 
-std::string TransformMachine::Compile(const bool WithOpcodes, std::vector<float>& TreeParams, std::string Point)
+std::string TransformMachine::Compile(const bool WithOpcodes, std::vector<float>& TreeParams, std::string Point) const
 {
-	Fold();
-	switch (FoldState)
+	switch (Kind)
 	{
 	case State::Identity:
 		return Point;
@@ -271,15 +595,21 @@ std::string TransformMachine::Compile(const bool WithOpcodes, std::vector<float>
 		return CompileOffset(WithOpcodes, TreeParams, Point);
 
 	case State::Matrix:
-		return CompileMatrix(WithOpcodes, TreeParams, Point);
+		if (AccumulatedScale == 1.0)
+		{
+			return CompileRotation(WithOpcodes, TreeParams, Point);
+		}
+		else
+		{
+			return CompileMatrix(WithOpcodes, TreeParams, Point);
+		}
 	}
 	UNREACHABLE();
 }
 
-std::string TransformMachine::Pretty(std::string Brush)
+std::string TransformMachine::Pretty(std::string Brush) const
 {
-	Fold();
-	switch (FoldState)
+	switch (Kind)
 	{
 	case State::Identity:
 		return Brush;
@@ -293,34 +623,41 @@ std::string TransformMachine::Pretty(std::string Brush)
 	UNREACHABLE();
 }
 
-bool TransformMachine::operator==(TransformMachine& Other)
+bool TransformMachine::operator==(const TransformMachine& Other) const
 {
-	Fold();
-	Other.Fold();
-	if (FoldState == Other.FoldState)
+	if (Kind == Other.Kind)
 	{
-		if (FoldState == State::Identity)
+		if (Kind == State::Identity)
 		{
 			return true;
 		}
 		else
 		{
-			return LastFold == Other.LastFold;
+			return Offset == Other.Offset && Rotation == Other.Rotation && AccumulatedScale == Other.AccumulatedScale;
 		}
 	}
 	return false;
 }
 
-AABB TransformMachine::ApplyOffset(const AABB InBounds)
+size_t TransformMachine::Hash() const
 {
-	vec3 Offset = LastFold[3].xyz;
-	return {
-		InBounds.Min + Offset,
-		InBounds.Max + Offset
-	};
+	size_t Hash = HashCombine(0, (size_t)Kind);
+	if (Kind != State::Identity)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			Hash = HashFloat(Hash, Offset[i]);
+		}
+		for (int i = 0; i < 4; ++i)
+		{
+			Hash = HashFloat(Hash, Rotation[i]);
+		}
+		Hash = HashFloat(Hash, AccumulatedScale);
+	}
+	return Hash;
 }
 
-AABB TransformMachine::ApplyMatrix(const AABB InBounds)
+AABB TransformMachine::ApplyMatrix(const AABB InBounds, const mat4& Matrix) const
 {
 	const vec3 A = InBounds.Min;
 	const vec3 B = InBounds.Max;
@@ -337,12 +674,12 @@ AABB TransformMachine::ApplyMatrix(const AABB InBounds)
 	};
 
 	AABB Bounds;
-	Bounds.Min = Apply(A);
+	Bounds.Min = (Matrix * vec4(A, 1.0)).xyz;
 	Bounds.Max = Bounds.Min;
 
 	for (const vec3& Point : Points)
 	{
-		const vec3 Tmp = Apply(Point);
+		const vec3 Tmp = (Matrix * vec4(Point, 1.0)).xyz;
 		Bounds.Min = min(Bounds.Min, Tmp);
 		Bounds.Max = max(Bounds.Max, Tmp);
 	}
@@ -350,107 +687,316 @@ AABB TransformMachine::ApplyMatrix(const AABB InBounds)
 	return Bounds;
 }
 
-std::string TransformMachine::CompileOffset(const bool WithOpcodes, std::vector<float>& TreeParams, std::string Point)
+std::string TransformMachine::CompileOffset(const bool WithOpcodes, std::vector<float>& TreeParams, std::string Point) const
 {
 	if (WithOpcodes)
 	{
 		TreeParams.push_back(AsFloat(OPCODE_OFFSET));
 	}
-	const int Offset = TreeParams.size();
-	TreeParams.push_back(LastFold[3].x);
-	TreeParams.push_back(LastFold[3].y);
-	TreeParams.push_back(LastFold[3].z);
-	std::string Params = MakeParamList(Offset, 3);
+	const int ParamsStart = TreeParams.size();
+	TreeParams.push_back(Offset.x);
+	TreeParams.push_back(Offset.y);
+	TreeParams.push_back(Offset.z);
+	std::string Params = MakeParamList(ParamsStart, 3);
 	return fmt::format("({} - vec3({}))", Point, Params);
 }
 
-std::string TransformMachine::CompileMatrix(const bool WithOpcodes, std::vector<float>& TreeParams, std::string Point)
+std::string TransformMachine::CompileRotation(const bool WithOpcodes, std::vector<float>& TreeParams, std::string Point) const
+{
+	// Rigid transforms are encoded as an offset and a quaternion, which is less than half the size of
+	// the full matrix.
+	if (WithOpcodes)
+	{
+		TreeParams.push_back(AsFloat(OPCODE_ROTATE));
+	}
+	const quat Inverse = conjugate(Rotation);
+	const int ParamsStart = TreeParams.size();
+	TreeParams.push_back(Offset.x);
+	TreeParams.push_back(Offset.y);
+	TreeParams.push_back(Offset.z);
+	TreeParams.push_back(Inverse.x);
+	TreeParams.push_back(Inverse.y);
+	TreeParams.push_back(Inverse.z);
+	TreeParams.push_back(Inverse.w);
+	std::string OffsetParams = MakeParamList(ParamsStart, 3);
+	std::string RotationParams = MakeParamList(ParamsStart + 3, 4);
+	return fmt::format("QuaternionTransform(({} - vec3({})), vec4({}))", Point, OffsetParams, RotationParams);
+}
+
+std::string TransformMachine::CompileMatrix(const bool WithOpcodes, std::vector<float>& TreeParams, std::string Point) const
 {
 	if (WithOpcodes)
 	{
 		TreeParams.push_back(AsFloat(OPCODE_MATRIX));
 	}
-	const int Offset = TreeParams.size();
+	const mat4 Matrix = ToLocal();
+	const int ParamsStart = TreeParams.size();
 	for (int i = 0; i < 16; ++i)
 	{
-		float Cell = value_ptr(LastFoldInverse)[i];
+		float Cell = value_ptr(Matrix)[i];
 		TreeParams.push_back(Cell);
 	}
-	std::string Params = MakeParamList(Offset, 16);
+	std::string Params = MakeParamList(ParamsStart, 16);
 	return fmt::format("MatrixTransform({}, mat4({}))", Point, Params);
 }
 
 
-template<typename ParamsT>
-struct BrushNode : public SDFNode
+// Brush nodes only store their opcode and parameters, and everything else about the brush is
+// looked up from the following tables.  This keeps brush nodes small, which matters because the
+// octree can hold millions of clipped copies of them.
+struct BrushInfo
 {
-	uint32_t Opcode;
-	std::string BrushFnName;
-	ParamsT NodeParams;
-	BrushMixin BrushFn;
-	AABB BrushAABB;
-	TransformMachine Transform;
+	const char* FnName;
+	int ParamCount;
+};
 
-	vec3 Color = vec3(-1.0);
 
-	BrushNode(uint32_t InOpcode, const std::string& InBrushFnName, const ParamsT& InNodeParams, BrushMixin& InBrushFn, AABB& InBrushAABB)
-		: Opcode(InOpcode)
-		, BrushFnName(InBrushFnName)
-		, NodeParams(InNodeParams)
-		, BrushFn(InBrushFn)
-		, BrushAABB(InBrushAABB)
-	{
-	}
+// Indexed by Opcode - OPCODE_SPHERE.
+static const BrushInfo BrushTable[] = \
+{
+	{ "SphereBrush", 1 },
+	{ "EllipsoidBrush", 3 },
+	{ "BoxBrush", 3 },
+	{ "TorusBrush", 2 },
+	{ "CylinderBrush", 2 },
+	{ "Plane", 3 },
+	{ "ConeBrush", 2 },
+	{ "ConinderBrush", 3 }
+};
 
-	BrushNode(uint32_t InOpcode, const std::string& InBrushFnName, const ParamsT& InNodeParams, BrushMixin& InBrushFn, AABB& InBrushAABB,
-		TransformMachine& InTransform, vec3& InColor)
-		: Opcode(InOpcode)
-		, BrushFnName(InBrushFnName)
-		, NodeParams(InNodeParams)
-		, BrushFn(InBrushFn)
-		, BrushAABB(InBrushAABB)
-		, Transform(InTransform)
-		, Color(InColor)
-	{
-	}
 
-	virtual float Eval(vec3 Point)
-	{
-		return BrushFn(Transform.ApplyInverse(Point)) * Transform.AccumulatedScale;
-	}
+static const BrushInfo& GetBrushInfo(uint32_t Opcode)
+{
+	Assert(Opcode >= OPCODE_SPHERE && Opcode <= OPCODE_CONINDER);
+	return BrushTable[Opcode - OPCODE_SPHERE];
+}
 
-	virtual SDFNode* Clip(vec3 Point, float Radius)
-	{
-		if (Eval(Point) <= Radius)
-		{
-			return Copy();
-		}
-		else
-		{
-			return nullptr;
-		}
-	}
 
-	virtual SDFNode* Copy()
+static float EvalBrush(uint32_t Opcode, const float* Params, const vec3& Point)
+{
+	switch (Opcode)
 	{
-		return new BrushNode(Opcode, BrushFnName, NodeParams, BrushFn, BrushAABB, Transform, Color);
+	case OPCODE_SPHERE:
+		return SDFMath::SphereBrush(Point, Params[0]);
+
+	case OPCODE_ELLIPSOID:
+		return SDFMath::EllipsoidBrush(Point, Params[0], Params[1], Params[2]);
+
+	case OPCODE_BOX:
+		return SDFMath::BoxBrush(Point, Params[0], Params[1], Params[2]);
+
+	case OPCODE_TORUS:
+		return SDFMath::TorusBrush(Point, Params[0], Params[1]);
+
+	case OPCODE_CYLINDER:
+		return SDFMath::CylinderBrush(Point, Params[0], Params[1]);
+
+	case OPCODE_PLANE:
+		return SDFMath::Plane(Point, Params[0], Params[1], Params[2]);
+
+	case OPCODE_CONE:
+		return SDFMath::ConeBrush(Point, Params[0], Params[1]);
+
+	case OPCODE_CONINDER:
+		return SDFMath::ConinderBrush(Point, Params[0], Params[1], Params[2]);
 	}
+	UNREACHABLE();
+}
+
 
-	virtual AABB Bounds()
+AABB SymmetricalBounds(vec3 High)
+{
+	return { High * vec3(-1), High };
+}
+
+
+// Bounds of the untransformed brush.
+static AABB BrushBounds(uint32_t Opcode, const float* Params)
+{
+	switch (Opcode)
 	{
-		return Transform.Apply(BrushAABB);
-	}
+	case OPCODE_SPHERE:
+		return SymmetricalBounds(vec3(Params[0]));
 
-	virtual AABB InnerBounds()
+	case OPCODE_ELLIPSOID:
+	case OPCODE_BOX:
+		return SymmetricalBounds(vec3(Params[0], Params[1], Params[2]));
+
+	case OPCODE_TORUS:
 	{
-		return Bounds();
+		const float Radius = Params[0] + Params[1];
+		return SymmetricalBounds(vec3(Radius, Radius, Params[1]));
 	}
 
-	std::string CompileScale(const bool WithOpcodes, std::vector<float>& TreeParams, std::string& NestedExpr)
+	case OPCODE_CYLINDER:
+		return SymmetricalBounds(vec3(Params[0], Params[0], Params[1]));
+
+	case OPCODE_PLANE:
 	{
-		if (WithOpcodes)
+		const vec3 Normal = vec3(Params[0], Params[1], Params[2]);
+		AABB Unbound = SymmetricalBounds(vec3(INFINITY, INFINITY, INFINITY));
+		if (Normal.x == -1.0)
 		{
-			TreeParams.push_back(AsFloat(OPCODE_SCALE));
+			Unbound.Min.x = 0.0;
+		}
+		else if (Normal.x == 1.0)
+		{
+			Unbound.Max.x = 0.0;
+		}
+		else if (Normal.y == -1.0)
+		{
+			Unbound.Min.y = 0.0;
+		}
+		else if (Normal.y == 1.0)
+		{
+			Unbound.Max.y = 0.0;
+		}
+		else if (Normal.z == -1.0)
+		{
+			Unbound.Min.z = 0.0;
+		}
+		else if (Normal.z == 1.0)
+		{
+			Unbound.Max.z = 0.0;
+		}
+		return Unbound;
+	}
+
+	case OPCODE_CONE:
+	{
+		// The cone's parameters are the tangent of its slope and its height.
+		const float Radius = Params[0] * Params[1];
+		return SymmetricalBounds(vec3(Radius, Radius, Params[1] * .5));
+	}
+
+	case OPCODE_CONINDER:
+	{
+		const float MaxRadius = max(Params[0], Params[1]);
+		return SymmetricalBounds(vec3(MaxRadius, MaxRadius, Params[2]));
+	}
+	}
+	UNREACHABLE();
+}
+
+
+// Brush colors are packed into 8 bits per channel.  The alpha channel is zero for brushes that
+// have not been painted.
+static const uint32_t Unpainted = 0;
+
+
+static uint32_t PackColor(vec3 Color)
+{
+	const uvec3 Bytes = uvec3(round(clamp(Color, vec3(0.0), vec3(1.0)) * vec3(255.0)));
+	return Bytes.r | (Bytes.g << 8) | (Bytes.b << 16) | (0xFFu << 24);
+}
+
+
+static vec3 UnpackColor(uint32_t Color)
+{
+	return vec3(Color & 0xFF, (Color >> 8) & 0xFF, (Color >> 16) & 0xFF) / vec3(255.0);
+}
+
+
+struct BrushNode : public SDFNode
+{
+	using ParamsT = std::array<float, 3>;
+
+	uint32_t Opcode;
+	uint32_t Color = Unpainted;
+	ParamsT NodeParams;
+	TransformMachine Transform;
+
+	// Unused parameters must be zero, so that they don't affect comparisons.
+	BrushNode(uint32_t InOpcode, const ParamsT& InNodeParams)
+		: Opcode(InOpcode)
+		, NodeParams(InNodeParams)
+	{
+		Rehash();
+	}
+
+	BrushNode(uint32_t InOpcode, const ParamsT& InNodeParams, const TransformMachine& InTransform, uint32_t InColor)
+		: Opcode(InOpcode)
+		, Color(InColor)
+		, NodeParams(InNodeParams)
+		, Transform(InTransform)
+	{
+		Rehash();
+	}
+
+	int ParamCount() const
+	{
+		return GetBrushInfo(Opcode).ParamCount;
+	}
+
+	virtual float Eval(vec3 Point)
+	{
+		return EvalBrush(Opcode, NodeParams.data(), Transform.ApplyInverse(Point)) * Transform.AccumulatedScale;
+	}
+
+	virtual SDFNode* Clip(vec3 Point, float Radius)
+	{
+		if (Eval(Point) <= Radius)
+		{
+			return this;
+		}
+		else
+		{
+			return nullptr;
+		}
+	}
+
+	virtual Interval EvalInterval(const AABB& Region)
+	{
+		const float Scale = Transform.AccumulatedScale;
+		Interval Range = IntervalMath::Brush(Opcode, NodeParams.data(), Transform.ApplyInverse(Region));
+		Range.Min *= Scale;
+		Range.Max *= Scale;
+
+		if (Opcode != OPCODE_ELLIPSOID)
+		{
+			// All of the other brushes are exact distance functions, so they can't change faster than the
+			// distance from the center of the region.  This is often tighter for rotated brushes.
+			const vec3 Center = (Region.Min + Region.Max) * vec3(0.5);
+			const float Radius = length(Region.Max - Center);
+			const float Dist = Eval(Center);
+			Range.Min = max(Range.Min, Dist - Radius);
+			Range.Max = min(Range.Max, Dist + Radius);
+		}
+		return Range;
+	}
+
+	virtual SDFNode* Clip(const AABB& Region, float Margin, SDFArena*)
+	{
+		if (EvalInterval(Region).Min <= Margin)
+		{
+			return this;
+		}
+		else
+		{
+			return nullptr;
+		}
+	}
+
+	virtual SDFNode* Copy()
+	{
+		return new BrushNode(Opcode, NodeParams, Transform, Color);
+	}
+
+	virtual AABB ComputeBounds()
+	{
+		return Transform.Apply(BrushBounds(Opcode, NodeParams.data()));
+	}
+
+	virtual AABB ComputeInnerBounds()
+	{
+		return Bounds();
+	}
+
+	std::string CompileScale(const bool WithOpcodes, std::vector<float>& TreeParams, std::string& NestedExpr)
+	{
+		if (WithOpcodes)
+		{
+			TreeParams.push_back(AsFloat(OPCODE_SCALE));
 		}
 		float Scale = Transform.AccumulatedScale;
 		TreeParams.push_back(Scale);
@@ -464,24 +1010,50 @@ struct BrushNode : public SDFNode
 			TreeParams.push_back(AsFloat(OPCODE_PAINT));
 		}
 		const int Offset = (int)TreeParams.size();
-		TreeParams.push_back(Color.r);
-		TreeParams.push_back(Color.g);
-		TreeParams.push_back(Color.b);
+		const vec3 Unpacked = UnpackColor(Color);
+		TreeParams.push_back(Unpacked.r);
+		TreeParams.push_back(Unpacked.g);
+		TreeParams.push_back(Unpacked.b);
 		std::string ColorParams = MakeParamList(Offset, 3);
 		return fmt::format("MaterialDist(vec3({}), {})", ColorParams, NestedExpr);
 	}
 
 	virtual std::string Compile(const bool WithOpcodes, std::vector<float>& TreeParams, std::string& Point)
 	{
-		std::string TransformedPoint = Transform.Compile(WithOpcodes, TreeParams, Point);
+		// Spheres, ellipsoids, and boxes that are only translated have opcodes with the offset built in,
+		// which saves the interpreters a dispatch and a stack round trip per brush.
+		uint32_t MovedOpcode = 0;
+		if (WithOpcodes && Transform.Kind == TransformMachine::State::Offset)
+		{
+			switch (Opcode)
+			{
+			case OPCODE_SPHERE:
+				MovedOpcode = OPCODE_MOVED_SPHERE;
+				break;
+			case OPCODE_ELLIPSOID:
+				MovedOpcode = OPCODE_MOVED_ELLIPSOID;
+				break;
+			case OPCODE_BOX:
+				MovedOpcode = OPCODE_MOVED_BOX;
+				break;
+			default:
+				break;
+			}
+		}
 
-		if (WithOpcodes)
+		if (MovedOpcode != 0)
+		{
+			TreeParams.push_back(AsFloat(MovedOpcode));
+		}
+		std::string TransformedPoint = Transform.Compile(WithOpcodes && MovedOpcode == 0, TreeParams, Point);
+
+		if (WithOpcodes && MovedOpcode == 0)
 		{
 			TreeParams.push_back(AsFloat(Opcode));
 		}
-		const int Offset = StoreParams(TreeParams, NodeParams);
-		std::string Params = MakeParamList(Offset, (int)NodeParams.size());
-		std::string CompiledShape = fmt::format("{}({}, {})", BrushFnName, TransformedPoint, Params);
+		const int Offset = StoreParams(TreeParams, NodeParams.data(), ParamCount());
+		std::string Params = MakeParamList(Offset, ParamCount());
+		std::string CompiledShape = fmt::format("{}({}, {})", GetBrushInfo(Opcode).FnName, TransformedPoint, Params);
 		if (Transform.AccumulatedScale != 1.0)
 		{
 			CompiledShape = CompileScale(WithOpcodes, TreeParams, CompiledShape);
@@ -496,81 +1068,108 @@ struct BrushNode : public SDFNode
 		}
 	}
 
-	virtual uint32_t StackSize(const uint32_t Depth)
+	virtual uint32_t ComputeStackSize(const uint32_t Depth)
 	{
 		return Depth;
 	}
 
 	virtual std::string Pretty()
 	{
-		return Transform.Pretty(BrushFnName);
+		return Transform.Pretty(GetBrushInfo(Opcode).FnName);
 	}
 
 	virtual void Move(vec3 Offset)
 	{
 		Transform.Move(Offset);
+		Rehash();
 	}
 
 	virtual void Rotate(quat Rotation)
 	{
 		Transform.Rotate(Rotation);
+		Rehash();
 	}
 
 	virtual void Scale(float Scale)
 	{
 		Transform.Scale(Scale);
+		Rehash();
 	}
 
 	virtual void ApplyMaterial(glm::vec3 InColor, bool Force)
 	{
 		if (!HasPaint() || Force)
 		{
-			Color = InColor;
+			Color = PackColor(InColor);
+			Rehash();
 		}
 	}
 
-	virtual bool HasPaint()
+	virtual bool ComputeHasPaint()
 	{
-		return Color != vec3(-1.0);
+		return Color != Unpainted;
 	}
 
-	virtual bool HasFiniteBounds()
+	virtual bool ComputeHasFiniteBounds()
 	{
-		return !(any(isinf(BrushAABB.Min)) || any(isinf(BrushAABB.Max)));
+		const AABB Local = BrushBounds(Opcode, NodeParams.data());
+		return !(any(isinf(Local.Min)) || any(isinf(Local.Max)));
 	}
 
-	virtual vec4 Sample(vec3 Point)
+	virtual MaterialDist EvalMaterial(vec3 Point)
 	{
 		if (HasPaint())
 		{
-			return vec4(Color, 1.0);
+			return { vec4(UnpackColor(Color), 1.0), Eval(Point) };
 		}
 		else
 		{
-			return NullColor;
+			return { NullColor, Eval(Point) };
 		}
 	}
 
-	virtual int LeafCount()
+	virtual int ComputeLeafCount()
 	{
 		return 1;
 	}
 
-	virtual bool operator==(SDFNode& Other)
+	virtual size_t ComputeHash()
+	{
+		size_t Hash = HashCombine(Opcode, Transform.Hash());
+		for (const float& Param : NodeParams)
+		{
+			Hash = HashFloat(Hash, Param);
+		}
+		return HashCombine(Hash, Color);
+	}
+
+	virtual void InternOperands()
+	{
+	}
+
+	virtual void ReleaseOperands()
+	{
+	}
+
+	virtual bool Equals(SDFNode& Other)
 	{
 		BrushNode* OtherBrush = dynamic_cast<BrushNode*>(&Other);
-		if (OtherBrush && OtherBrush->BrushFnName == BrushFnName && OtherBrush->Transform == Transform)
+		return OtherBrush &&
+			OtherBrush->Opcode == Opcode &&
+			OtherBrush->Color == Color &&
+			OtherBrush->NodeParams == NodeParams &&
+			OtherBrush->Transform == Transform;
+	}
+
+	virtual SDFNode* Simplify(bool)
+	{
+		TransformMachine NewTransform = Transform;
+		if (NewTransform.Simplify())
 		{
-			for (int i = 0; i < NodeParams.size(); ++i)
-			{
-				if (OtherBrush->NodeParams[i] != NodeParams[i])
-				{
-					return false;
-				}
-			}
-			return true;
+			return SDF::Intern(new BrushNode(Opcode, NodeParams, NewTransform, Color));
 		}
-		return false;
+		Hold();
+		return this;
 	}
 };
 
@@ -614,6 +1213,7 @@ struct SetNode : public SDFNode
 			// mode by ensuring equivalent trees have the same form more often.
 			std::swap(LHS, RHS);
 		}
+		Rehash();
 	}
 
 	virtual float Eval(vec3 Point)
@@ -623,6 +1223,24 @@ struct SetNode : public SDFNode
 			RHS->Eval(Point));
 	}
 
+	// Clipping only allocates a new set node when an operand changed, so untouched subtrees are
+	// shared with the original tree instead of being copied.
+	SDFNode* Rebuild(SDFNode* NewLHS, SDFNode* NewRHS, SDFArena* Arena)
+	{
+		if (NewLHS == LHS && NewRHS == RHS)
+		{
+			return this;
+		}
+		else if (Arena)
+		{
+			return ArenaNew<SetNode<Family, BlendMode>>(Arena, SetFn, NewLHS, NewRHS, Threshold);
+		}
+		else
+		{
+			return new SetNode<Family, BlendMode>(SetFn, NewLHS, NewRHS, Threshold);
+		}
+	}
+
 	virtual SDFNode* Clip(vec3 Point, float Radius)
 	{
 		if (Eval(Point) <= Radius)
@@ -631,22 +1249,22 @@ struct SetNode : public SDFNode
 			{
 				// If both of these clip tests pass, then the point should be in the blending region
 				// for all blending set operator types.  If one of these returns nullptr, the other
-				// should be deleted.  If we don't return a new blending set node here, fail through
+				// should be discarded.  If we don't return a new blending set node here, fail through
 				// to the regular set operator behavior to return an operand, when applicable.
 
 				SDFNode* NewLHS = LHS->Clip(Point, Radius + Threshold);
 				SDFNode* NewRHS = RHS->Clip(Point, Radius + Threshold);
 				if (NewLHS && NewRHS)
 				{
-					return new SetNode<Family, BlendMode>(SetFn, NewLHS, NewRHS, Threshold);
+					return Rebuild(NewLHS, NewRHS, nullptr);
 				}
 				else if (NewLHS)
 				{
-					delete NewLHS;
+					Discard(NewLHS);
 				}
 				else if (NewRHS)
 				{
-					delete NewRHS;
+					Discard(NewRHS);
 				}
 				if (Family == SetFamily::Inter)
 				{
@@ -660,7 +1278,7 @@ struct SetNode : public SDFNode
 			if (NewLHS && NewRHS)
 			{
 				// Note, this shouldn't be possible to hit when BlendMode == true.
-				return new SetNode<Family, BlendMode>(SetFn, NewLHS, NewRHS, Threshold);
+				return Rebuild(NewLHS, NewRHS, nullptr);
 			}
 			else if (Family == SetFamily::Union)
 			{
@@ -672,7 +1290,7 @@ struct SetNode : public SDFNode
 				// We can only return the LHS side, which may be nullptr.
 				if (NewRHS)
 				{
-					delete NewRHS;
+					Discard(NewRHS);
 				}
 				return NewLHS;
 			}
@@ -681,11 +1299,11 @@ struct SetNode : public SDFNode
 				// Neither operand is valid.
 				if (NewLHS)
 				{
-					delete NewLHS;
+					Discard(NewLHS);
 				}
 				else if (NewRHS)
 				{
-					delete NewRHS;
+					Discard(NewRHS);
 				}
 				return nullptr;
 			}
@@ -693,12 +1311,136 @@ struct SetNode : public SDFNode
 		return nullptr;
 	}
 
+	Interval SetInterval(const Interval& RangeLHS, const Interval& RangeRHS)
+	{
+		Interval Range;
+		if (Family == SetFamily::Union)
+		{
+			Range = { min(RangeLHS.Min, RangeRHS.Min), min(RangeLHS.Max, RangeRHS.Max) };
+		}
+		else if (Family == SetFamily::Diff)
+		{
+			Range = { max(RangeLHS.Min, -RangeRHS.Max), max(RangeLHS.Max, -RangeRHS.Min) };
+		}
+		else if (Family == SetFamily::Inter)
+		{
+			Range = { max(RangeLHS.Min, RangeRHS.Min), max(RangeLHS.Max, RangeRHS.Max) };
+		}
+
+		if (BlendMode)
+		{
+			Interval Mix;
+			if (Family == SetFamily::Diff)
+			{
+				Mix = IntervalMath::Abs(RangeLHS.Min + RangeRHS.Min, RangeLHS.Max + RangeRHS.Max);
+			}
+			else
+			{
+				Mix = IntervalMath::Abs(RangeLHS.Min - RangeRHS.Max, RangeLHS.Max - RangeRHS.Min);
+			}
+			const float LowH = max(Threshold - Mix.Max, 0.0);
+			const float HighH = max(Threshold - Mix.Min, 0.0);
+			const float LowBlend = LowH * LowH * 0.25 / Threshold;
+			const float HighBlend = HighH * HighH * 0.25 / Threshold;
+			if (Family == SetFamily::Union)
+			{
+				Range.Min -= HighBlend;
+				Range.Max -= LowBlend;
+			}
+			else
+			{
+				Range.Min += LowBlend;
+				Range.Max += HighBlend;
+			}
+		}
+		return Range;
+	}
+
+	virtual Interval EvalInterval(const AABB& Region)
+	{
+		return SetInterval(LHS->EvalInterval(Region), RHS->EvalInterval(Region));
+	}
+
+	virtual SDFNode* Clip(const AABB& Region, float Margin, SDFArena* Arena)
+	{
+		const Interval RangeLHS = LHS->EvalInterval(Region);
+		const Interval RangeRHS = RHS->EvalInterval(Region);
+		if (SetInterval(RangeLHS, RangeRHS).Min > Margin)
+		{
+			return nullptr;
+		}
+
+		// An operand is dead if it never decides the result anywhere within the region, in which
+		// case the set operator can be replaced with the other operand outright.
+		const float Slack = BlendMode ? Threshold : 0.0;
+		bool KeepLHS = true;
+		bool KeepRHS = true;
+		if (Family == SetFamily::Union)
+		{
+			KeepLHS = RangeLHS.Min < RangeRHS.Max + Slack;
+			KeepRHS = RangeRHS.Min < RangeLHS.Max + Slack || !KeepLHS;
+		}
+		else if (Family == SetFamily::Diff)
+		{
+			KeepRHS = RangeLHS.Min + RangeRHS.Min < Slack;
+		}
+		else if (Family == SetFamily::Inter)
+		{
+			KeepLHS = RangeLHS.Max > RangeRHS.Min - Slack;
+			KeepRHS = RangeRHS.Max > RangeLHS.Min - Slack || !KeepLHS;
+		}
+
+		if (!KeepLHS)
+		{
+			return RHS->Clip(Region, Margin, Arena);
+		}
+		else if (!KeepRHS)
+		{
+			return LHS->Clip(Region, Margin, Arena);
+		}
+
+		// The blending term is at most a quarter of the threshold, so an operand that is further
+		// than this from the margin cannot participate in a blend that lands within the margin.
+		const float Reach = Margin + Slack * 1.25;
+
+		SDFNode* NewLHS = LHS->Clip(Region, Family == SetFamily::Union ? Reach : Margin, Arena);
+		SDFNode* NewRHS = RHS->Clip(Region, Family == SetFamily::Inter ? Margin : Reach, Arena);
+
+		if (NewLHS && NewRHS)
+		{
+			return Rebuild(NewLHS, NewRHS, Arena);
+		}
+		else if (Family == SetFamily::Union)
+		{
+			// Return whichever operand matched or nullptr.
+			return NewLHS != nullptr ? NewLHS : NewRHS;
+		}
+		else if (Family == SetFamily::Diff && NewLHS)
+		{
+			// The RHS is too far away to carve into the surface of the LHS.
+			return NewLHS;
+		}
+		else
+		{
+			// Neither operand is valid.
+			if (NewLHS)
+			{
+				Discard(NewLHS);
+			}
+			else if (NewRHS)
+			{
+				Discard(NewRHS);
+			}
+			return nullptr;
+		}
+	}
+
 	virtual SDFNode* Copy()
 	{
 		return new SetNode<Family, BlendMode>(SetFn, LHS->Copy(), RHS->Copy(), Threshold);
 	}
 
-	virtual AABB Bounds()
+	virtual AABB ComputeBounds()
 	{
 		AABB BoundsLHS = LHS->Bounds();
 		AABB BoundsRHS = RHS->Bounds();
@@ -732,7 +1474,7 @@ struct SetNode : public SDFNode
 		return Combined;
 	}
 
-	virtual AABB InnerBounds()
+	virtual AABB ComputeInnerBounds()
 	{
 		AABB BoundsLHS = LHS->InnerBounds();
 		AABB BoundsRHS = RHS->InnerBounds();
@@ -803,7 +1545,7 @@ struct SetNode : public SDFNode
 		}
 	}
 
-	virtual uint32_t StackSize(const uint32_t Depth)
+	virtual uint32_t ComputeStackSize(const uint32_t Depth)
 	{
 		return max(max(Depth + 1, LHS->StackSize(Depth)), RHS->StackSize(Depth + 1));
 	}
@@ -838,6 +1580,7 @@ struct SetNode : public SDFNode
 		{
 			Child->Move(Offset);
 		}
+		Rehash();
 	}
 
 	virtual void Rotate(quat Rotation)
@@ -846,6 +1589,7 @@ struct SetNode : public SDFNode
 		{
 			Child->Rotate(Rotation);
 		}
+		Rehash();
 	}
 
 	virtual void Scale(float Scale)
@@ -855,6 +1599,7 @@ struct SetNode : public SDFNode
 		{
 			Child->Scale(Scale);
 		}
+		Rehash();
 	}
 
 	virtual void ApplyMaterial(glm::vec3 Color, bool Force)
@@ -863,88 +1608,1537 @@ struct SetNode : public SDFNode
 		{
 			Child->ApplyMaterial(Color, Force);
 		}
+		Rehash();
 	}
 
-	virtual bool HasPaint()
+	virtual bool ComputeHasPaint()
 	{
 		return LHS->HasPaint() || RHS->HasPaint();
 	}
 
-	virtual bool HasFiniteBounds()
+	virtual bool ComputeHasFiniteBounds()
 	{
-		return LHS->HasFiniteBounds() || RHS->HasFiniteBounds();
+		// Unions need both operands to be bounded, and differences are bounded by the LHS.
+		if (Family == SetFamily::Union)
+		{
+			return LHS->HasFiniteBounds() && RHS->HasFiniteBounds();
+		}
+		else if (Family == SetFamily::Diff)
+		{
+			return LHS->HasFiniteBounds();
+		}
+		else
+		{
+			return LHS->HasFiniteBounds() || RHS->HasFiniteBounds();
+		}
 	}
 
-	virtual vec4 Sample(vec3 Point)
+	virtual MaterialDist EvalMaterial(vec3 Point)
 	{
+		const MaterialDist MaterialLHS = LHS->EvalMaterial(Point);
+		const MaterialDist MaterialRHS = RHS->EvalMaterial(Point);
+		const float Dist = SetFn(MaterialLHS.Dist, MaterialRHS.Dist);
+
 		if (Family == SetFamily::Diff)
 		{
-			return LHS->Sample(Point);
+			return { MaterialLHS.Color, Dist };
+		}
+
+		bool TakeLeft;
+		if (BlendMode)
+		{
+			TakeLeft = abs(MaterialLHS.Dist - Dist) <= abs(MaterialRHS.Dist - Dist);
 		}
 		else
 		{
-			float EvalLHS = LHS->Eval(Point);
-			float EvalRHS = RHS->Eval(Point);
+			TakeLeft = Dist == MaterialLHS.Dist;
+		}
 
-			if (EvalLHS <= EvalRHS)
-			{
-				return LHS->Sample(Point);
-			}
-			else
-			{
-				return RHS->Sample(Point);
-			}
+		if (Family == SetFamily::Inter)
+		{
+			return { SelectColor(MaterialLHS.Color, MaterialRHS.Color, TakeLeft), Dist };
+		}
+		else
+		{
+			return { TakeLeft ? MaterialLHS.Color : MaterialRHS.Color, Dist };
 		}
 	}
 
-	virtual int LeafCount()
+	virtual int ComputeLeafCount()
 	{
 		return LHS->LeafCount() + RHS->LeafCount();
 	}
 
-	virtual bool operator==(SDFNode& Other)
+	virtual size_t ComputeHash()
 	{
-		SetNode<Family, BlendMode>* OtherSet = dynamic_cast<SetNode<Family, BlendMode>*>(&Other);
-		if (OtherSet && Threshold == OtherSet->Threshold)
+		size_t Hash = HashFloat(Opcode, Threshold);
+		Hash = HashCombine(Hash, LHS->Hash());
+		return HashCombine(Hash, RHS->Hash());
+	}
+
+	virtual void InternOperands()
+	{
+		for (SDFNode** Operand : { &LHS, &RHS })
 		{
-			return *LHS == *(OtherSet->LHS) && *RHS == *(OtherSet->RHS);
+			SDFNode* Canonical = SDF::Intern(*Operand);
+			(*Operand)->Release();
+			*Operand = Canonical;
 		}
-		return false;
 	}
 
-	virtual ~SetNode()
+	virtual void ReleaseOperands()
 	{
-		Assert(RefCount == 0);
-		LHS->Release();
-		RHS->Release();
-	}
+		if (LHS)
+		{
+			LHS->Release();
+			RHS->Release();
+			LHS = nullptr;
+			RHS = nullptr;
+		}
+	}
+
+	virtual bool Equals(SDFNode& Other)
+	{
+		SetNode<Family, BlendMode>* OtherSet = dynamic_cast<SetNode<Family, BlendMode>*>(&Other);
+		if (OtherSet && Threshold == OtherSet->Threshold)
+		{
+			return *LHS == *(OtherSet->LHS) && *RHS == *(OtherSet->RHS);
+		}
+		return false;
+	}
+
+	virtual void Diff(SDFNode* Previous, float Margin, std::vector<AABB>& Changed)
+	{
+		SetNode<Family, BlendMode>* OtherSet = dynamic_cast<SetNode<Family, BlendMode>*>(Previous);
+		if (OtherSet && Threshold == OtherSet->Threshold)
+		{
+			// This matches the widest margin Clip passes to the operands.
+			const float Reach = Margin + (BlendMode ? Threshold * 1.25 : 0.0);
+			LHS->Diff(OtherSet->LHS, Reach, Changed);
+			RHS->Diff(OtherSet->RHS, Reach, Changed);
+		}
+		else
+		{
+			SDFNode::Diff(Previous, Margin, Changed);
+		}
+	}
+
+	virtual SDFNode* Simplify(bool Exact)
+	{
+		// Blends depend on the distances of their operands, and not just their surfaces.
+		SDFNode* NewLHS = LHS->Simplify(Exact || BlendMode);
+		SDFNode* NewRHS = RHS->Simplify(Exact || BlendMode);
+		SDFNode* Simplified = nullptr;
+
+		AABB BoundsLHS;
+		AABB BoundsRHS;
+		const bool FiniteLHS = !Exact && NewLHS && FiniteBounds(NewLHS, BoundsLHS);
+		const bool FiniteRHS = !Exact && NewRHS && FiniteBounds(NewRHS, BoundsRHS);
+
+		// Where one operand is further than this inside of the other, the blend can't reach the
+		// surface of the other.
+		const float Reach = BlendMode ? Threshold * 2.0 : 0.0;
+
+		if (NewLHS && NewLHS == NewRHS && !BlendMode && Family != SetFamily::Diff)
+		{
+			// Hard unions and intersections are idempotent.
+			Simplified = NewLHS;
+		}
+		else if (Exact)
+		{
+			Simplified = this;
+		}
+		else if (!NewLHS || !NewRHS)
+		{
+			// Empty operands either empty the whole set, or leave the other operand as is.
+			if (Family == SetFamily::Union)
+			{
+				Simplified = NewLHS ? NewLHS : NewRHS;
+			}
+			else if (Family == SetFamily::Diff)
+			{
+				Simplified = NewLHS;
+			}
+		}
+		else if (Family == SetFamily::Inter)
+		{
+			if (FiniteLHS && FiniteRHS && !BoundsLHS.Overlaps(BoundsRHS))
+			{
+				Simplified = nullptr;
+			}
+			else if (FiniteLHS && NewRHS->EvalInterval(BoundsLHS).Max < -Reach)
+			{
+				Simplified = NewLHS;
+			}
+			else if (FiniteRHS && NewLHS->EvalInterval(BoundsRHS).Max < -Reach)
+			{
+				Simplified = NewRHS;
+			}
+			else if ((FiniteLHS && NewRHS->EvalInterval(BoundsLHS).Min > 0.0) || (FiniteRHS && NewLHS->EvalInterval(BoundsRHS).Min > 0.0))
+			{
+				Simplified = nullptr;
+			}
+			else
+			{
+				Simplified = this;
+			}
+		}
+		else if (Family == SetFamily::Diff)
+		{
+			if (!BlendMode && FiniteLHS && FiniteRHS && !BoundsLHS.Overlaps(BoundsRHS))
+			{
+				Simplified = NewLHS;
+			}
+			else if (FiniteLHS && NewRHS->EvalInterval(BoundsLHS).Min > Reach)
+			{
+				Simplified = NewLHS;
+			}
+			else if (FiniteLHS && NewRHS->EvalInterval(BoundsLHS).Max < 0.0)
+			{
+				Simplified = nullptr;
+			}
+			else
+			{
+				Simplified = this;
+			}
+		}
+		else
+		{
+			Simplified = this;
+		}
+
+		if (Simplified == this && (NewLHS != LHS || NewRHS != RHS))
+		{
+			if (Family == SetFamily::Union && !BlendMode)
+			{
+				Simplified = SDF::Union(NewLHS, NewRHS);
+			}
+			else
+			{
+				Simplified = SDF::Intern(new SetNode<Family, BlendMode>(SetFn, NewLHS, NewRHS, Threshold));
+			}
+		}
+		else if (Simplified)
+		{
+			Simplified->Hold();
+		}
+		for (SDFNode* Operand : { NewLHS, NewRHS })
+		{
+			if (Operand)
+			{
+				Operand->Release();
+			}
+		}
+		return Simplified;
+	}
+
+	virtual ~SetNode()
+	{
+		Assert(RefCount == 0);
+		ReleaseOperands();
+	}
+};
+
+
+// Unions with at least this many operands are represented with a UnionNode.
+static const size_t MinUnionNodeSize = 4;
+
+
+// Hard union of any number of operands.  SDF::Union flattens chains of unions into these, which
+// keeps large scenes built by folding many props together from turning into long chains of
+// SetNodes.  The operands are indexed by a bounding volume hierarchy, so that EvalInterval and Clip
+// only need to visit the operands near the query region.  The bounds of an operand are treated as a
+// lower bound on its distance, so operands that are further from the region than the nearest upper
+// bound found so far are skipped.  Eval visits every operand, so that it matches the compiled
+// program exactly.  Compile lowers this to a sequence of binary unions, so the shaders and the
+// interpreter don't need to know about it.
+struct UnionNode : public SDFNode
+{
+	std::vector<SDFNode*> Children;
+
+	struct BVHNode
+	{
+		AABB Bounds;
+		// Leaves refer to Count entries in BVHOrder starting at Offset.  Interior nodes have a
+		// Count of zero, and their children are the next node and the node at Offset.
+		uint32_t Offset;
+		uint32_t Count;
+	};
+
+	// The BVH is built the first time it is needed, because unions are often discarded right after
+	// they are created while a scene is being assembled.
+	std::vector<BVHNode> BVH;
+	std::vector<uint32_t> BVHOrder;
+	std::vector<AABB> BVHBounds;
+	std::vector<uint32_t> Unbounded;
+	std::atomic_bool BVHReady;
+	std::mutex BVHCS;
+
+	UnionNode(std::vector<SDFNode*>&& InChildren)
+		: Children(std::move(InChildren))
+		, BVHReady(false)
+	{
+		for (SDFNode* Child : Children)
+		{
+			Child->Hold();
+		}
+		Rehash();
+	}
+
+	static float BoxDistance(const AABB& Box, const AABB& Region)
+	{
+		const vec3 Gap = max(max(Box.Min - Region.Max, Region.Min - Box.Max), vec3(0.0));
+		return length(Gap);
+	}
+
+	void BuildBVH(uint32_t First, uint32_t Last)
+	{
+		const uint32_t NodeIndex = (uint32_t)BVH.size();
+		BVH.push_back({ BVHBounds[First], First, Last - First });
+		AABB Centers = { vec3(INFINITY), vec3(-INFINITY) };
+		for (uint32_t i = First; i < Last; ++i)
+		{
+			BVH[NodeIndex].Bounds.Min = min(BVH[NodeIndex].Bounds.Min, BVHBounds[i].Min);
+			BVH[NodeIndex].Bounds.Max = max(BVH[NodeIndex].Bounds.Max, BVHBounds[i].Max);
+			const vec3 Center = (BVHBounds[i].Min + BVHBounds[i].Max) * vec3(0.5);
+			Centers.Min = min(Centers.Min, Center);
+			Centers.Max = max(Centers.Max, Center);
+		}
+
+		const uint32_t LeafSize = 4;
+		if (Last - First > LeafSize)
+		{
+			// Split at the median along the axis where the operands are the most spread out.
+			const vec3 Spread = Centers.Extent();
+			const int Axis = Spread.x >= Spread.y && Spread.x >= Spread.z ? 0 : (Spread.y >= Spread.z ? 1 : 2);
+			const uint32_t Middle = First + (Last - First) / 2;
+			std::vector<std::pair<uint32_t, AABB>> Entries;
+			for (uint32_t i = First; i < Last; ++i)
+			{
+				Entries.push_back({ BVHOrder[i], BVHBounds[i] });
+			}
+			std::nth_element(Entries.begin(), Entries.begin() + (Middle - First), Entries.end(), [Axis](auto& LHS, auto& RHS)
+			{
+				return LHS.second.Min[Axis] + LHS.second.Max[Axis] < RHS.second.Min[Axis] + RHS.second.Max[Axis];
+			});
+			for (uint32_t i = First; i < Last; ++i)
+			{
+				BVHOrder[i] = Entries[i - First].first;
+				BVHBounds[i] = Entries[i - First].second;
+			}
+
+			BVH[NodeIndex].Count = 0;
+			BuildBVH(First, Middle);
+			BVH[NodeIndex].Offset = (uint32_t)BVH.size();
+			BuildBVH(Middle, Last);
+		}
+	}
+
+	void EnsureBVH()
+	{
+		if (!BVHReady.load(std::memory_order_acquire))
+		{
+			std::scoped_lock Lock(BVHCS);
+			if (!BVHReady.load(std::memory_order_relaxed))
+			{
+				BVH.clear();
+				BVHOrder.clear();
+				BVHBounds.clear();
+				Unbounded.clear();
+				for (uint32_t i = 0; i < Children.size(); ++i)
+				{
+					// Bounds with infinite or NaN components can't be searched, so those operands are
+					// always visited instead.
+					AABB ChildBounds;
+					if (FiniteBounds(Children[i], ChildBounds))
+					{
+						BVHOrder.push_back(i);
+						BVHBounds.push_back(ChildBounds);
+					}
+					else
+					{
+						Unbounded.push_back(i);
+					}
+				}
+				if (BVHOrder.size() > 0)
+				{
+					BuildBVH(0, (uint32_t)BVHOrder.size());
+				}
+				BVHReady.store(true, std::memory_order_release);
+			}
+		}
+	}
+
+	// Calls Visit on every bounded operand that may be nearer than the value returned by Nearest.
+	// Distance finds the distance from the query to a box.  Nodes are visited nearest first.  Boxes
+	// that contain the query are always visited, because the operands may be negative within them.
+	template<typename DistanceT, typename NearestT, typename VisitT>
+	void Search(DistanceT& Distance, NearestT& Nearest, VisitT& Visit)
+	{
+		if (BVH.size() == 0)
+		{
+			return;
+		}
+		struct Pending
+		{
+			uint32_t Node;
+			float Distance;
+		};
+		Pending Stack[64];
+		int Top = 0;
+		Stack[Top++] = { 0, Distance(BVH[0].Bounds) };
+		while (Top > 0)
+		{
+			const Pending Next = Stack[--Top];
+			if (Next.Distance > max(Nearest(), 0.0f))
+			{
+				continue;
+			}
+			const BVHNode& Node = BVH[Next.Node];
+			if (Node.Count > 0)
+			{
+				for (uint32_t i = Node.Offset; i < Node.Offset + Node.Count; ++i)
+				{
+					if (Distance(BVHBounds[i]) <= max(Nearest(), 0.0f))
+					{
+						Visit(BVHOrder[i]);
+					}
+				}
+			}
+			else
+			{
+				Pending Near = { Next.Node + 1, Distance(BVH[Next.Node + 1].Bounds) };
+				Pending Far = { Node.Offset, Distance(BVH[Node.Offset].Bounds) };
+				if (Far.Distance < Near.Distance)
+				{
+					std::swap(Near, Far);
+				}
+				Assert(Top + 2 <= 64);
+				Stack[Top++] = Far;
+				Stack[Top++] = Near;
+			}
+		}
+	}
+
+	// Returns the distance to the nearest operand, and which operand that is.
+	float EvalNearest(vec3 Point, SDFNode*& NearestChild)
+	{
+		float Dist = INFINITY;
+		NearestChild = nullptr;
+		for (SDFNode* Child : Children)
+		{
+			const float ChildDist = Child->Eval(Point);
+			if (!NearestChild || ChildDist < Dist)
+			{
+				Dist = ChildDist;
+				NearestChild = Child;
+			}
+		}
+		return Dist;
+	}
+
+	virtual float Eval(vec3 Point)
+	{
+		SDFNode* NearestChild;
+		return EvalNearest(Point, NearestChild);
+	}
+
+	// Construct the union of the given operands, which are already held by the caller.
+	static SDFNode* Combine(std::vector<SDFNode*>& Operands, SDFArena* Arena)
+	{
+		SDFNode* Combined = nullptr;
+		if (Operands.size() == 1)
+		{
+			Combined = Operands[0];
+		}
+		else if (Operands.size() == 2)
+		{
+			SetMixin UnionFn = std::bind(SDFMath::UnionOp, _1, _2);
+			Combined = ArenaNew<SetNode<SetFamily::Union, false>>(Arena, UnionFn, Operands[0], Operands[1], 0.0);
+		}
+		else if (Operands.size() > 2)
+		{
+			Combined = ArenaNew<UnionNode>(Arena, std::vector<SDFNode*>(Operands));
+		}
+		return Combined;
+	}
+
+	virtual SDFNode* Clip(vec3 Point, float Radius)
+	{
+		if (Eval(Point) <= Radius)
+		{
+			std::vector<SDFNode*> Operands;
+			bool Unchanged = true;
+			for (SDFNode* Child : Children)
+			{
+				SDFNode* NewChild = Child->Clip(Point, Radius);
+				if (NewChild)
+				{
+					Operands.push_back(NewChild);
+				}
+				Unchanged &= NewChild == Child;
+			}
+			return Unchanged ? this : Combine(Operands, nullptr);
+		}
+		return nullptr;
+	}
+
+	// Find the intervals of every operand that may be within Margin of the region, excluding ones
+	// that are too far away to participate.
+	void GatherIntervals(const AABB& Region, float Margin, std::vector<uint32_t>& Near, std::vector<Interval>& Ranges)
+	{
+		EnsureBVH();
+		// Operands that are further away than the nearest upper bound found so far are dead.
+		float Nearest = Margin;
+		auto Consider = [&](uint32_t Index)
+		{
+			const Interval Range = Children[Index]->EvalInterval(Region);
+			if (Range.Min <= Margin)
+			{
+				Near.push_back(Index);
+				Ranges.push_back(Range);
+				Nearest = min(Nearest, Range.Max);
+			}
+		};
+		for (uint32_t Index : Unbounded)
+		{
+			Consider(Index);
+		}
+		auto Distance = [&](const AABB& Box)
+		{
+			return BoxDistance(Box, Region);
+		};
+		auto Limit = [&]()
+		{
+			return Nearest;
+		};
+		Search(Distance, Limit, Consider);
+	}
+
+	virtual Interval EvalInterval(const AABB& Region)
+	{
+		EnsureBVH();
+		Interval Range = { INFINITY, INFINITY };
+		auto Consider = [&](uint32_t Index)
+		{
+			const Interval ChildRange = Children[Index]->EvalInterval(Region);
+			Range.Min = min(Range.Min, ChildRange.Min);
+			Range.Max = min(Range.Max, ChildRange.Max);
+		};
+		for (uint32_t Index : Unbounded)
+		{
+			Consider(Index);
+		}
+		auto Distance = [&](const AABB& Box)
+		{
+			return BoxDistance(Box, Region);
+		};
+		auto Limit = [&]()
+		{
+			return Range.Max;
+		};
+		Search(Distance, Limit, Consider);
+		return Range;
+	}
+
+	virtual SDFNode* Clip(const AABB& Region, float Margin, SDFArena* Arena)
+	{
+		std::vector<uint32_t> Near;
+		std::vector<Interval> Ranges;
+		GatherIntervals(Region, Margin, Near, Ranges);
+		if (Near.size() == 0)
+		{
+			return nullptr;
+		}
+
+		// An operand is dead if some other operand is always nearer within the region.
+		size_t Best = 0;
+		float NearestMax = INFINITY;
+		float SecondMax = INFINITY;
+		for (size_t i = 0; i < Ranges.size(); ++i)
+		{
+			if (Ranges[i].Max < NearestMax)
+			{
+				SecondMax = NearestMax;
+				NearestMax = Ranges[i].Max;
+				Best = i;
+			}
+			else
+			{
+				SecondMax = min(SecondMax, Ranges[i].Max);
+			}
+		}
+
+		std::vector<SDFNode*> Operands;
+		bool Unchanged = Near.size() == Children.size();
+		for (size_t i = 0; i < Near.size(); ++i)
+		{
+			const float OtherMax = i == Best ? SecondMax : NearestMax;
+			if (i == Best || Ranges[i].Min < OtherMax)
+			{
+				SDFNode* NewChild = Children[Near[i]]->Clip(Region, Margin, Arena);
+				if (NewChild)
+				{
+					Operands.push_back(NewChild);
+				}
+				Unchanged &= NewChild == Children[Near[i]];
+			}
+			else
+			{
+				Unchanged = false;
+			}
+		}
+		// Every operand survived as-is, so this node can be shared rather than rebuilt.
+		return Unchanged ? this : Combine(Operands, Arena);
+	}
+
+	virtual SDFNode* Copy()
+	{
+		std::vector<SDFNode*> NewChildren;
+		NewChildren.reserve(Children.size());
+		for (SDFNode* Child : Children)
+		{
+			NewChildren.push_back(Child->Copy());
+		}
+		return new UnionNode(std::move(NewChildren));
+	}
+
+	virtual AABB ComputeBounds()
+	{
+		AABB Combined = Children[0]->Bounds();
+		for (size_t i = 1; i < Children.size(); ++i)
+		{
+			const AABB ChildBounds = Children[i]->Bounds();
+			Combined.Min = min(Combined.Min, ChildBounds.Min);
+			Combined.Max = max(Combined.Max, ChildBounds.Max);
+		}
+		return Combined;
+	}
+
+	virtual AABB ComputeInnerBounds()
+	{
+		AABB Combined = Children[0]->InnerBounds();
+		for (size_t i = 1; i < Children.size(); ++i)
+		{
+			const AABB ChildBounds = Children[i]->InnerBounds();
+			Combined.Min = min(Combined.Min, ChildBounds.Min);
+			Combined.Max = max(Combined.Max, ChildBounds.Max);
+		}
+		return Combined;
+	}
+
+	// Operands with the deepest stacks are compiled first, for the same reason SetNode keeps its
+	// trees left leaning.
+	std::vector<SDFNode*> CompileOrder()
+	{
+		std::vector<SDFNode*> Order = Children;
+		std::stable_sort(Order.begin(), Order.end(), [](SDFNode* LHS, SDFNode* RHS)
+		{
+			return LHS->StackSize() > RHS->StackSize();
+		});
+		return Order;
+	}
+
+	virtual std::string Compile(const bool WithOpcodes, std::vector<float>& TreeParams, std::string& Point)
+	{
+		std::vector<SDFNode*> Order = CompileOrder();
+		std::string Compiled = Order[0]->Compile(WithOpcodes, TreeParams, Point);
+		for (size_t i = 1; i < Order.size(); ++i)
+		{
+			if (WithOpcodes)
+			{
+				TreeParams.push_back(AsFloat(OPCODE_PUSH));
+			}
+			const std::string CompiledRHS = Order[i]->Compile(WithOpcodes, TreeParams, Point);
+			if (WithOpcodes)
+			{
+				TreeParams.push_back(AsFloat(OPCODE_UNION));
+			}
+			Compiled = fmt::format("UnionOp({}, {})", Compiled, CompiledRHS);
+		}
+		return Compiled;
+	}
+
+	virtual uint32_t ComputeStackSize(const uint32_t Depth)
+	{
+		std::vector<SDFNode*> Order = CompileOrder();
+		uint32_t Size = max(Depth + 1, Order[0]->StackSize(Depth));
+		for (size_t i = 1; i < Order.size(); ++i)
+		{
+			Size = max(Size, Order[i]->StackSize(Depth + 1));
+		}
+		return Size;
+	}
+
+	virtual std::string Pretty()
+	{
+		std::string Operands = Children[0]->Pretty();
+		for (size_t i = 1; i < Children.size(); ++i)
+		{
+			Operands = fmt::format("{},\n\t{}", Operands, Children[i]->Pretty());
+		}
+		return fmt::format("Union(\n\t{})", Operands);
+	}
+
+	virtual void Move(vec3 Offset)
+	{
+		for (SDFNode* Child : Children)
+		{
+			Child->Move(Offset);
+		}
+		BVHReady = false;
+		Rehash();
+	}
+
+	virtual void Rotate(quat Rotation)
+	{
+		for (SDFNode* Child : Children)
+		{
+			Child->Rotate(Rotation);
+		}
+		BVHReady = false;
+		Rehash();
+	}
+
+	virtual void Scale(float Scale)
+	{
+		for (SDFNode* Child : Children)
+		{
+			Child->Scale(Scale);
+		}
+		BVHReady = false;
+		Rehash();
+	}
+
+	virtual void ApplyMaterial(glm::vec3 Color, bool Force)
+	{
+		for (SDFNode* Child : Children)
+		{
+			Child->ApplyMaterial(Color, Force);
+		}
+		Rehash();
+	}
+
+	virtual bool ComputeHasPaint()
+	{
+		for (SDFNode* Child : Children)
+		{
+			if (Child->HasPaint())
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	virtual bool ComputeHasFiniteBounds()
+	{
+		for (SDFNode* Child : Children)
+		{
+			if (!Child->HasFiniteBounds())
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	virtual MaterialDist EvalMaterial(vec3 Point)
+	{
+		SDFNode* NearestChild;
+		EvalNearest(Point, NearestChild);
+		return NearestChild->EvalMaterial(Point);
+	}
+
+	virtual int ComputeLeafCount()
+	{
+		int Count = 0;
+		for (SDFNode* Child : Children)
+		{
+			Count += Child->LeafCount();
+		}
+		return Count;
+	}
+
+	virtual size_t ComputeHash()
+	{
+		size_t Hash = HashCombine(OPCODE_UNION, Children.size());
+		for (SDFNode* Child : Children)
+		{
+			Hash = HashCombine(Hash, Child->Hash());
+		}
+		return Hash;
+	}
+
+	virtual void InternOperands()
+	{
+		for (SDFNode*& Operand : Children)
+		{
+			SDFNode* Canonical = SDF::Intern(Operand);
+			Operand->Release();
+			Operand = Canonical;
+		}
+	}
+
+	virtual void ReleaseOperands()
+	{
+		for (SDFNode* Child : Children)
+		{
+			Child->Release();
+		}
+		Children.clear();
+	}
+
+	virtual bool Equals(SDFNode& Other)
+	{
+		UnionNode* OtherUnion = dynamic_cast<UnionNode*>(&Other);
+		if (OtherUnion && OtherUnion->Children.size() == Children.size())
+		{
+			for (size_t i = 0; i < Children.size(); ++i)
+			{
+				if (*Children[i] != *(OtherUnion->Children[i]))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+		return false;
+	}
+
+	virtual void Diff(SDFNode* Previous, float Margin, std::vector<AABB>& Changed)
+	{
+		UnionNode* OtherUnion = dynamic_cast<UnionNode*>(Previous);
+		if (OtherUnion)
+		{
+			// Operands are matched by identity, so adding or removing a few props from a large
+			// union only reports those props as changed.
+			std::unordered_multiset<SDFNode*> Unmatched(OtherUnion->Children.begin(), OtherUnion->Children.end());
+			for (SDFNode* Child : Children)
+			{
+				auto Found = Unmatched.find(Child);
+				if (Found != Unmatched.end())
+				{
+					Unmatched.erase(Found);
+				}
+				else
+				{
+					AddChangedRegion(Child, Margin, Changed);
+				}
+			}
+			for (SDFNode* Child : Unmatched)
+			{
+				AddChangedRegion(Child, Margin, Changed);
+			}
+		}
+		else
+		{
+			SDFNode::Diff(Previous, Margin, Changed);
+		}
+	}
+
+	virtual SDFNode* Simplify(bool Exact)
+	{
+		std::vector<SDFNode*> Operands;
+		std::unordered_set<SDFNode*> Unique;
+		bool Changed = false;
+		for (SDFNode* Child : Children)
+		{
+			SDFNode* NewChild = Child->Simplify(Exact);
+			if (!NewChild)
+			{
+				Changed = true;
+			}
+			else if (!Unique.insert(NewChild).second)
+			{
+				// Hard unions are idempotent, so repeated operands can be dropped.
+				NewChild->Release();
+				Changed = true;
+			}
+			else
+			{
+				Operands.push_back(NewChild);
+				Changed |= NewChild != Child;
+			}
+		}
+
+		SDFNode* Simplified = nullptr;
+		if (!Changed)
+		{
+			Simplified = this;
+			Simplified->Hold();
+		}
+		else if (Operands.size() >= MinUnionNodeSize)
+		{
+			Simplified = SDF::Intern(new UnionNode(std::vector<SDFNode*>(Operands)));
+		}
+		else if (Operands.size() > 0)
+		{
+			Simplified = Operands[0];
+			Simplified->Hold();
+			for (size_t i = 1; i < Operands.size(); ++i)
+			{
+				SDFNode* Combined = SDF::Union(Simplified, Operands[i]);
+				Simplified->Release();
+				Simplified = Combined;
+			}
+		}
+		for (SDFNode* Operand : Operands)
+		{
+			Operand->Release();
+		}
+		return Simplified;
+	}
+
+	virtual ~UnionNode()
+	{
+		Assert(RefCount == 0);
+		ReleaseOperands();
+	}
+};
+
+
+
+// Collect the operands of a tree of hard unions.
+static void GatherUnionOperands(SDFNode* Node, std::vector<SDFNode*>& Operands)
+{
+	if (UnionNode* Union = dynamic_cast<UnionNode*>(Node))
+	{
+		Operands.insert(Operands.end(), Union->Children.begin(), Union->Children.end());
+	}
+	else if (SetNode<SetFamily::Union, false>* Set = dynamic_cast<SetNode<SetFamily::Union, false>*>(Node))
+	{
+		GatherUnionOperands(Set->LHS, Operands);
+		GatherUnionOperands(Set->RHS, Operands);
+	}
+	else
+	{
+		Operands.push_back(Node);
+	}
+}
+
+
+#if 0
+struct PaintNode : public SDFNode
+{
+	vec3 Color;
+	SDFNode* Child;
+
+	PaintNode(vec3 InColor, SDFNode* InChild)
+		: Color(InColor)
+		, Child(InChild)
+	{
+		Child->Hold();
+	}
+
+	virtual float Eval(vec3 Point)
+	{
+		return Child->Eval(Point);
+	}
+
+	virtual SDFNode* Clip(vec3 Point, float Radius)
+	{
+		SDFNode* NewChild = Child->Clip(Point, Radius);
+		if (NewChild == Child)
+		{
+			return this;
+		}
+		else if (NewChild)
+		{
+			return new PaintNode(Color, NewChild);
+		}
+		else
+		{
+			return nullptr;
+		}
+	}
+
+	virtual SDFNode* Copy()
+	{
+		return new PaintNode(Color, Child->Copy());
+	}
+
+	virtual AABB ComputeBounds()
+	{
+		return Child->Bounds();
+	}
+
+	virtual AABB ComputeInnerBounds()
+	{
+		return Child->InnerBounds();
+	}
+
+	virtual std::string Compile(const bool WithOpcodes, std::vector<float>& TreeParams, std::string& Point)
+	{
+		if (WithOpcodes)
+		{
+			TreeParams.push_back(AsFloat(OPCODE_PAINT));
+		}
+		const int Offset = (int)TreeParams.size();
+		TreeParams.push_back(Color.r);
+		TreeParams.push_back(Color.g);
+		TreeParams.push_back(Color.b);
+		std::string ColorParams = MakeParamList(Offset, 3);
+		return fmt::format("MaterialDist(vec3({}), {})", ColorParams, Child->Compile(WithOpcodes, TreeParams, Point));
+	}
+
+	virtual uint32_t ComputeStackSize(const uint32_t Depth)
+	{
+		return Child->StackSize(Depth);
+	}
+
+	virtual std::string Pretty()
+	{
+		return Child->Pretty();
+	}
+
+	virtual void Move(vec3 Offset)
+	{
+		Child->Move(Offset);
+	}
+
+	virtual void Rotate(quat Rotation)
+	{
+		Child->Rotate(Rotation);
+	}
+
+	virtual void Scale(float Scale)
+	{
+		Child->Rotate(Rotation);
+	}
+
+	virtual bool ComputeHasPaint()
+	{
+		return true;
+	}
+
+	virtual bool ComputeHasFiniteBounds()
+	{
+		return Child->HasFiniteBounds();
+	}
+
+	virtual MaterialDist EvalMaterial(vec3 Point)
+	{
+		return { vec4(Color, 1.0), Child->Eval(Point) };
+	}
+
+	virtual int ComputeLeafCount()
+	{
+		return Child->LeafCount();
+	}
+
+	virtual bool Equals(SDFNode& Other)
+	{
+		PaintNode* OtherPaint = dynamic_cast<PaintNode*>(&Other);
+		if (OtherPaint)
+		{
+			return Color == OtherPaint->Color && *Child == *(OtherPaint->Child);
+		}
+		return false;
+	}
+
+	virtual ~PaintNode()
+	{
+		Assert(RefCount == 0);
+		Child->Release();
+	}
+};
+#endif
+
+
+struct FlateNode : public SDFNode
+{
+	SDFNode* Child;
+	float Radius;
+
+	FlateNode(SDFNode* InChild, float InRadius)
+		: Child(InChild)
+		, Radius(InRadius)
+	{
+		Child->Hold();
+		Rehash();
+	}
+
+	virtual float Eval(vec3 Point)
+	{
+		return Child->Eval(Point) - Radius;
+	}
+
+	virtual SDFNode* Clip(vec3 Point, float ClipRadius)
+	{
+		if (Eval(Point) <= ClipRadius)
+		{
+			SDFNode* NewChild = Child->Clip(Point, ClipRadius + Radius);
+			if (NewChild == Child)
+			{
+				return this;
+			}
+			else if (NewChild)
+			{
+				return new FlateNode(NewChild, Radius);
+			}
+		}
+		return nullptr;
+	}
+
+	virtual Interval EvalInterval(const AABB& Region)
+	{
+		Interval Range = Child->EvalInterval(Region);
+		return { Range.Min - Radius, Range.Max - Radius };
+	}
+
+	virtual SDFNode* Clip(const AABB& Region, float Margin, SDFArena* Arena)
+	{
+		SDFNode* NewChild = Child->Clip(Region, Margin + Radius, Arena);
+		if (NewChild == Child)
+		{
+			return this;
+		}
+		else if (NewChild)
+		{
+			return ArenaNew<FlateNode>(Arena, NewChild, Radius);
+		}
+		return nullptr;
+	}
+
+	virtual SDFNode* Copy()
+	{
+		return new FlateNode(Child->Copy(), Radius);
+	}
+
+	virtual AABB ComputeBounds()
+	{
+		AABB ChildBounds = Child->Bounds();
+		ChildBounds.Max += vec3(Radius * 2);
+		ChildBounds.Min -= vec3(Radius * 2);
+		return ChildBounds;
+	}
+
+	virtual AABB ComputeInnerBounds()
+	{
+		AABB ChildBounds = Child->InnerBounds();
+		ChildBounds.Max += vec3(Radius * 2);
+		ChildBounds.Min -= vec3(Radius * 2);
+		return ChildBounds;
+	}
+
+	virtual std::string Compile(const bool WithOpcodes, std::vector<float>& TreeParams, std::string& Point)
+	{
+		std::string CompiledChild = Child->Compile(WithOpcodes, TreeParams, Point);
+		if (WithOpcodes)
+		{
+			TreeParams.push_back(AsFloat(OPCODE_FLATE));
+		}
+		const int Offset = TreeParams.size();
+		TreeParams.push_back(Radius);
+		return fmt::format("FlateOp({}, PARAMS[{}])", CompiledChild, Offset);
+	}
+
+	virtual uint32_t ComputeStackSize(const uint32_t Depth)
+	{
+		return Child->StackSize(Depth);
+	}
+
+	virtual std::string Pretty()
+	{
+		return fmt::format("FlateOp({})", Child->Pretty());
+	}
+
+	virtual void Move(vec3 Offset)
+	{
+		Child->Move(Offset);
+		Rehash();
+	}
+
+	virtual void Rotate(quat Rotation)
+	{
+		Child->Rotate(Rotation);
+		Rehash();
+	}
+
+	virtual void Scale(float Scale)
+	{
+		Child->Scale(Scale);
+		Rehash();
+	}
+
+	virtual void ApplyMaterial(vec3 InColor, bool Force)
+	{
+		Child->ApplyMaterial(InColor, Force);
+		Rehash();
+	}
+
+	virtual bool ComputeHasPaint()
+	{
+		return Child->HasPaint();
+	}
+
+	virtual bool ComputeHasFiniteBounds()
+	{
+		return Child->HasFiniteBounds();
+	}
+
+	virtual MaterialDist EvalMaterial(vec3 Point)
+	{
+		const MaterialDist Material = Child->EvalMaterial(Point);
+		return { Material.Color, Material.Dist - Radius };
+	}
+
+	virtual int ComputeLeafCount()
+	{
+		return Child->LeafCount();
+	}
+
+	virtual size_t ComputeHash()
+	{
+		return HashFloat(HashCombine(OPCODE_FLATE, Child->Hash()), Radius);
+	}
+
+	virtual void InternOperands()
+	{
+		SDFNode* Canonical = SDF::Intern(Child);
+		Child->Release();
+		Child = Canonical;
+	}
+
+	virtual void ReleaseOperands()
+	{
+		if (Child)
+		{
+			Child->Release();
+			Child = nullptr;
+		}
+	}
+
+	virtual bool Equals(SDFNode& Other)
+	{
+		FlateNode* OtherFlate = dynamic_cast<FlateNode*>(&Other);
+		return (OtherFlate && OtherFlate->Radius == Radius && *Child == *(OtherFlate->Child));
+	}
+
+	virtual void Diff(SDFNode* Previous, float Margin, std::vector<AABB>& Changed)
+	{
+		FlateNode* OtherFlate = dynamic_cast<FlateNode*>(Previous);
+		if (OtherFlate && OtherFlate->Radius == Radius)
+		{
+			Child->Diff(OtherFlate->Child, Margin + abs(Radius) * 2.0f, Changed);
+		}
+		else
+		{
+			SDFNode::Diff(Previous, Margin, Changed);
+		}
+	}
+
+	virtual SDFNode* Simplify(bool Exact)
+	{
+		SDFNode* NewChild = Child->Simplify(Exact || Radius != 0.0);
+		if (!NewChild)
+		{
+			return nullptr;
+		}
+
+		SDFNode* Simplified = nullptr;
+		FlateNode* Nested = dynamic_cast<FlateNode*>(NewChild);
+		BrushNode* Sphere = dynamic_cast<BrushNode*>(NewChild);
+		const float Combined = Nested ? Nested->Radius + Radius : Radius;
+		if (Radius == 0.0)
+		{
+			Simplified = NewChild;
+			Simplified->Hold();
+		}
+		else if (Nested && Combined == 0.0)
+		{
+			Simplified = Nested->Child;
+			Simplified->Hold();
+		}
+		else if (Nested)
+		{
+			Simplified = SDF::Flate(Nested->Child, Combined);
+		}
+		else if (Sphere && Sphere->Opcode == OPCODE_SPHERE && Sphere->NodeParams[0] + Radius / Sphere->Transform.AccumulatedScale > 0.0)
+		{
+			// Spheres stay spheres when inflated or deflated, so the radius is adjusted instead.
+			const float NewRadius = Sphere->NodeParams[0] + Radius / Sphere->Transform.AccumulatedScale;
+			Simplified = SDF::Intern(new BrushNode(OPCODE_SPHERE, { NewRadius }, Sphere->Transform, Sphere->Color));
+		}
+		else if (NewChild != Child)
+		{
+			Simplified = SDF::Flate(NewChild, Radius);
+		}
+		else
+		{
+			Simplified = this;
+			Simplified->Hold();
+		}
+
+		NewChild->Release();
+		return Simplified;
+	}
+
+	virtual ~FlateNode()
+	{
+		Assert(RefCount == 0);
+		ReleaseOperands();
+	}
 };
 
 
-#if 0
-struct PaintNode : public SDFNode
+// Repeats or mirrors its child by folding the point into a single cell before evaluating the child,
+// so the cost doesn't depend on the number of copies.  Repetition is either in a grid or around the
+// Z axis, and mirroring is either across the local axes or an arbitrary plane.  The distances are
+// only exact while the child stays within its own cell.
+struct FoldNode : public SDFNode
 {
-	vec3 Color;
+	using ParamsT = std::array<float, 9>;
+
 	SDFNode* Child;
+	uint32_t Opcode;
 
-	PaintNode(vec3 InColor, SDFNode* InChild)
-		: Color(InColor)
-		, Child(InChild)
+	// The period, lowest cell, and highest cell for grids, the sector count for polar repetition,
+	// which axes to mirror across, or the mirror plane's normal and offset.  Unused parameters must
+	// be zero, so that they don't affect comparisons.
+	ParamsT NodeParams;
+	TransformMachine Transform;
+
+	FoldNode(SDFNode* InChild, uint32_t InOpcode, const ParamsT& InNodeParams, const TransformMachine& InTransform)
+		: Child(InChild)
+		, Opcode(InOpcode)
+		, NodeParams(InNodeParams)
+		, Transform(InTransform)
 	{
 		Child->Hold();
+		Rehash();
+	}
+
+	int ParamCount() const
+	{
+		return FoldParamCount(Opcode);
+	}
+
+	vec3 Period() const
+	{
+		return vec3(NodeParams[0], NodeParams[1], NodeParams[2]);
+	}
+
+	vec3 Low() const
+	{
+		return vec3(NodeParams[3], NodeParams[4], NodeParams[5]);
+	}
+
+	vec3 High() const
+	{
+		return vec3(NodeParams[6], NodeParams[7], NodeParams[8]);
+	}
+
+	vec3 Normal() const
+	{
+		return vec3(NodeParams[0], NodeParams[1], NodeParams[2]);
+	}
+
+	vec3 Fold(vec3 Point) const
+	{
+		return FoldPoint(Opcode, Point, NodeParams.data());
+	}
+
+	// Returns the box containing the given box's reflection across the mirror plane.
+	AABB Reflect(const AABB& Box) const
+	{
+		const vec3 Plane = Normal();
+		const float Offset = NodeParams[3];
+		AABB Reflected = { vec3(INFINITY), vec3(-INFINITY) };
+		for (int Corner = 0; Corner < 8; ++Corner)
+		{
+			const vec3 Point = vec3(
+				(Corner & 1) ? Box.Max.x : Box.Min.x,
+				(Corner & 2) ? Box.Max.y : Box.Min.y,
+				(Corner & 4) ? Box.Max.z : Box.Min.z);
+			const vec3 Mirrored = Point - (2.0f * (dot(Point, Plane) - Offset)) * Plane;
+			Reflected.Min = min(Reflected.Min, Mirrored);
+			Reflected.Max = max(Reflected.Max, Mirrored);
+		}
+		return Reflected;
+	}
+
+	// Returns a box containing the folded positions of every point in the given local space region.
+	AABB Fold(const AABB& Region) const
+	{
+		if (Opcode == OPCODE_REPEAT_GRID)
+		{
+			AABB Folded;
+			for (int Axis = 0; Axis < 3; ++Axis)
+			{
+				const float Step = NodeParams[Axis];
+				const float Lowest = NodeParams[Axis + 3];
+				const float Highest = NodeParams[Axis + 6];
+				const float Lower = round(Region.Min[Axis] / Step);
+				const float Upper = round(Region.Max[Axis] / Step);
+				const float CellMin = glm::clamp(Lower, Lowest, Highest);
+				const float CellMax = glm::clamp(Upper, Lowest, Highest);
+				if (CellMin == CellMax && std::isfinite(CellMin))
+				{
+					// The region is within a single cell, so it is only translated.
+					Folded.Min[Axis] = Region.Min[Axis] - Step * CellMin;
+					Folded.Max[Axis] = Region.Max[Axis] - Step * CellMax;
+				}
+				else
+				{
+					// Points in the outermost cells may be further from the cell's center than half a period.
+					Folded.Min[Axis] = Lower < Lowest ? Region.Min[Axis] - Step * Lowest : Step * -0.5f;
+					Folded.Max[Axis] = Upper > Highest ? Region.Max[Axis] - Step * Highest : Step * 0.5f;
+				}
+			}
+			return Folded;
+		}
+		else if (Opcode == OPCODE_REPEAT_POLAR)
+		{
+			const vec3 Corners[4] = \
+			{
+				Region.Min,
+				vec3(Region.Max.x, Region.Min.y, Region.Min.z),
+				vec3(Region.Min.x, Region.Max.y, Region.Min.z),
+				vec3(Region.Max.xy, Region.Min.z)
+			};
+
+			const float Count = NodeParams[0];
+			const float Angle = FoldPolarAngle(Corners[0], NodeParams.data());
+			bool SameSector = Count >= 2.0;
+			float OuterRadius = 0.0;
+			for (const vec3& Corner : Corners)
+			{
+				SameSector = SameSector && FoldPolarAngle(Corner, NodeParams.data()) == Angle;
+				OuterRadius = max(OuterRadius, length(Corner.xy()));
+			}
+
+			const bool HasOrigin = Region.Min.x <= 0.0 && Region.Max.x >= 0.0 && Region.Min.y <= 0.0 && Region.Max.y >= 0.0;
+			if (SameSector && !HasOrigin)
+			{
+				// Sectors are convex when there are at least two of them, so the region is only rotated.
+				AABB Folded = { vec3(INFINITY), vec3(-INFINITY) };
+				const float C = cos(Angle);
+				const float S = sin(Angle);
+				for (const vec3& Corner : Corners)
+				{
+					const vec2 Rotated = vec2(C * Corner.x + S * Corner.y, C * Corner.y - S * Corner.x);
+					Folded.Min = min(Folded.Min, vec3(Rotated, Region.Min.z));
+					Folded.Max = max(Folded.Max, vec3(Rotated, Region.Max.z));
+				}
+				return Folded;
+			}
+			else
+			{
+				// Otherwise the region is bounded by the part of the first sector within its distance
+				// from the Z axis.
+				const vec2 Nearest = glm::clamp(vec2(0.0), Region.Min.xy(), Region.Max.xy());
+				const float InnerRadius = length(Nearest);
+				const float HalfSector = 3.14159265358979f / Count;
+				const float Spread = sin(min(HalfSector, 1.57079632679490f));
+				AABB Folded;
+				Folded.Min = vec3(HalfSector < 1.57079632679490f ? InnerRadius * cos(HalfSector) : -OuterRadius, -OuterRadius * Spread, Region.Min.z);
+				Folded.Max = vec3(OuterRadius, OuterRadius * Spread, Region.Max.z);
+				return Folded;
+			}
+		}
+		else if (Opcode == OPCODE_MIRROR_AXES)
+		{
+			AABB Folded = Region;
+			for (int Axis = 0; Axis < 3; ++Axis)
+			{
+				if (NodeParams[Axis] != 0.0 && Region.Max[Axis] <= 0.0)
+				{
+					Folded.Min[Axis] = -Region.Max[Axis];
+					Folded.Max[Axis] = -Region.Min[Axis];
+				}
+				else if (NodeParams[Axis] != 0.0 && Region.Min[Axis] < 0.0)
+				{
+					Folded.Min[Axis] = 0.0;
+					Folded.Max[Axis] = max(-Region.Min[Axis], Region.Max[Axis]);
+				}
+			}
+			return Folded;
+		}
+		else
+		{
+			// The region's nearest and furthest corners from the plane say which side it is on.
+			const vec3 Plane = Normal();
+			const vec3 Nearest = mix(Region.Max, Region.Min, step(vec3(0.0), Plane));
+			const vec3 Furthest = mix(Region.Min, Region.Max, step(vec3(0.0), Plane));
+			if (dot(Nearest, Plane) >= NodeParams[3])
+			{
+				return Region;
+			}
+			else if (dot(Furthest, Plane) <= NodeParams[3])
+			{
+				return Reflect(Region);
+			}
+			else
+			{
+				const AABB Reflected = Reflect(Region);
+				return { min(Region.Min, Reflected.Min), max(Region.Max, Reflected.Max) };
+			}
+		}
+	}
+
+	// Returns the bounds of the copies of the given child space bounds.
+	AABB Unfold(const AABB& ChildBounds)
+	{
+		AABB Repeated;
+		if (Opcode == OPCODE_REPEAT_GRID)
+		{
+			Repeated.Min = ChildBounds.Min + Period() * Low();
+			Repeated.Max = ChildBounds.Max + Period() * High();
+		}
+		else if (Opcode == OPCODE_MIRROR_AXES)
+		{
+			// Only the part of the child on the positive side of each axis is evaluated.
+			Repeated = ChildBounds;
+			for (int Axis = 0; Axis < 3; ++Axis)
+			{
+				if (NodeParams[Axis] != 0.0)
+				{
+					Repeated.Max[Axis] = max(ChildBounds.Max[Axis], 0.0f);
+					Repeated.Min[Axis] = -Repeated.Max[Axis];
+				}
+			}
+		}
+		else if (Opcode == OPCODE_MIRROR_PLANE)
+		{
+			const AABB Reflected = Reflect(ChildBounds);
+			Repeated.Min = min(ChildBounds.Min, Reflected.Min);
+			Repeated.Max = max(ChildBounds.Max, Reflected.Max);
+		}
+		else
+		{
+			float Radius = 0.0;
+			Radius = max(Radius, length(ChildBounds.Min.xy()));
+			Radius = max(Radius, length(ChildBounds.Max.xy()));
+			Radius = max(Radius, length(vec2(ChildBounds.Min.x, ChildBounds.Max.y)));
+			Radius = max(Radius, length(vec2(ChildBounds.Max.x, ChildBounds.Min.y)));
+			Repeated.Min = vec3(-Radius, -Radius, ChildBounds.Min.z);
+			Repeated.Max = vec3(Radius, Radius, ChildBounds.Max.z);
+		}
+
+		if (all(lessThan(abs(Repeated.Min), vec3(INFINITY))) && all(lessThan(abs(Repeated.Max), vec3(INFINITY))))
+		{
+			return Transform.Apply(Repeated);
+		}
+		else
+		{
+			return SymmetricalBounds(vec3(INFINITY));
+		}
 	}
 
 	virtual float Eval(vec3 Point)
 	{
-		return Child->Eval(Point);
+		return Child->Eval(Fold(Transform.ApplyInverse(Point))) * Transform.AccumulatedScale;
 	}
 
 	virtual SDFNode* Clip(vec3 Point, float Radius)
 	{
-		SDFNode* NewChild = Child->Clip(Point, Radius);
-		if (NewChild)
+		// Points near the edge of a cell are also affected by the neighboring cells, so the child is
+		// not clipped.
+		if (Eval(Point) <= Radius)
 		{
-			return new PaintNode(Color, NewChild);
+			return this;
 		}
 		else
 		{
@@ -952,442 +3146,964 @@ struct PaintNode : public SDFNode
 		}
 	}
 
+	virtual Interval EvalInterval(const AABB& Region)
+	{
+		const float Scale = Transform.AccumulatedScale;
+		Interval Range = Child->EvalInterval(Fold(Transform.ApplyInverse(Region)));
+		Range.Min *= Scale;
+		Range.Max *= Scale;
+		return Range;
+	}
+
+	virtual SDFNode* Clip(const AABB& Region, float Margin, SDFArena* Arena)
+	{
+		const float Scale = Transform.AccumulatedScale;
+		const AABB Folded = Fold(Transform.ApplyInverse(Region));
+		if (Child->EvalInterval(Folded).Min * Scale > Margin)
+		{
+			return nullptr;
+		}
+
+		SDFNode* NewChild = Child->Clip(Folded, Margin / Scale, Arena);
+		if (NewChild == Child)
+		{
+			return this;
+		}
+		else if (NewChild)
+		{
+			return ArenaNew<FoldNode>(Arena, NewChild, Opcode, NodeParams, Transform);
+		}
+		return nullptr;
+	}
+
 	virtual SDFNode* Copy()
 	{
-		return new PaintNode(Color, Child->Copy());
+		return new FoldNode(Child->Copy(), Opcode, NodeParams, Transform);
 	}
 
-	virtual AABB Bounds()
+	virtual AABB ComputeBounds()
 	{
-		return Child->Bounds();
+		return Unfold(Child->Bounds());
 	}
 
-	virtual AABB InnerBounds()
+	virtual AABB ComputeInnerBounds()
 	{
-		return Child->InnerBounds();
+		return Unfold(Child->InnerBounds());
 	}
 
 	virtual std::string Compile(const bool WithOpcodes, std::vector<float>& TreeParams, std::string& Point)
 	{
+		const std::string TransformedPoint = Transform.Compile(WithOpcodes, TreeParams, Point);
 		if (WithOpcodes)
 		{
-			TreeParams.push_back(AsFloat(OPCODE_PAINT));
+			TreeParams.push_back(AsFloat(Opcode));
 		}
-		const int Offset = (int)TreeParams.size();
-		TreeParams.push_back(Color.r);
-		TreeParams.push_back(Color.g);
-		TreeParams.push_back(Color.b);
-		std::string ColorParams = MakeParamList(Offset, 3);
-		return fmt::format("MaterialDist(vec3({}), {})", ColorParams, Child->Compile(WithOpcodes, TreeParams, Point));
+
+		// Shaders aren't required to handle infinities, so unlimited repetition is clamped to the
+		// largest finite cell index instead.
+		const float Largest = std::numeric_limits<float>::max();
+		ParamsT Clamped = NodeParams;
+		for (float& Param : Clamped)
+		{
+			Param = glm::clamp(Param, -Largest, Largest);
+		}
+		const int Offset = StoreParams(TreeParams, Clamped.data(), ParamCount());
+
+		std::string FoldedPoint;
+		if (Opcode == OPCODE_REPEAT_GRID)
+		{
+			FoldedPoint = fmt::format("RepeatGrid({}, vec3({}), vec3({}), vec3({}))", TransformedPoint,
+				MakeParamList(Offset, 3), MakeParamList(Offset + 3, 3), MakeParamList(Offset + 6, 3));
+		}
+		else if (Opcode == OPCODE_REPEAT_POLAR)
+		{
+			FoldedPoint = fmt::format("RepeatPolar({}, PARAMS[{}])", TransformedPoint, Offset);
+		}
+		else if (Opcode == OPCODE_MIRROR_AXES)
+		{
+			FoldedPoint = fmt::format("MirrorAxes({}, vec3({}))", TransformedPoint, MakeParamList(Offset, 3));
+		}
+		else
+		{
+			FoldedPoint = fmt::format("MirrorPlane({}, vec3({}), PARAMS[{}])", TransformedPoint, MakeParamList(Offset, 3), Offset + 3);
+		}
+
+		std::string CompiledChild = Child->Compile(WithOpcodes, TreeParams, FoldedPoint);
+		if (WithOpcodes)
+		{
+			TreeParams.push_back(AsFloat(OPCODE_FOLD_END));
+		}
+
+		if (Transform.AccumulatedScale != 1.0)
+		{
+			if (WithOpcodes)
+			{
+				TreeParams.push_back(AsFloat(OPCODE_SCALE));
+			}
+			const int ScaleOffset = TreeParams.size();
+			TreeParams.push_back(Transform.AccumulatedScale);
+			CompiledChild = fmt::format("ScaleOp({}, PARAMS[{}])", CompiledChild, ScaleOffset);
+		}
+		return CompiledChild;
 	}
 
-	virtual uint32_t StackSize(const uint32_t Depth)
+	virtual uint32_t ComputeStackSize(const uint32_t Depth)
 	{
-		return Child->StackSize(Depth);
+		// The point the child is entered with is saved in the three slots above the child's result.
+		return Child->StackSize(Depth + 3);
 	}
 
 	virtual std::string Pretty()
 	{
-		return Child->Pretty();
+		const char* Name = "MirrorPlane";
+		switch (Opcode)
+		{
+		case OPCODE_REPEAT_GRID:
+			Name = "RepeatGrid";
+			break;
+		case OPCODE_REPEAT_POLAR:
+			Name = "RepeatPolar";
+			break;
+		case OPCODE_MIRROR_AXES:
+			Name = "MirrorAxes";
+			break;
+		}
+		return Transform.Pretty(fmt::format("{}({})", Name, Child->Pretty()));
 	}
 
 	virtual void Move(vec3 Offset)
 	{
-		Child->Move(Offset);
+		Transform.Move(Offset);
+		Rehash();
 	}
 
 	virtual void Rotate(quat Rotation)
 	{
-		Child->Rotate(Rotation);
+		Transform.Rotate(Rotation);
+		Rehash();
 	}
 
 	virtual void Scale(float Scale)
 	{
-		Child->Rotate(Rotation);
+		Transform.Scale(Scale);
+		Rehash();
+	}
+
+	virtual void ApplyMaterial(vec3 InColor, bool Force)
+	{
+		Child->ApplyMaterial(InColor, Force);
+		Rehash();
 	}
 
-	virtual bool HasPaint()
+	virtual bool ComputeHasPaint()
 	{
-		return true;
+		return Child->HasPaint();
 	}
 
-	virtual bool HasFiniteBounds()
+	virtual bool ComputeHasFiniteBounds()
 	{
+		if (Opcode == OPCODE_REPEAT_GRID)
+		{
+			return Child->HasFiniteBounds() && all(lessThan(abs(Low()), vec3(INFINITY))) && all(lessThan(abs(High()), vec3(INFINITY)));
+		}
 		return Child->HasFiniteBounds();
 	}
 
-	virtual vec4 Sample(vec3 Point)
+	virtual MaterialDist EvalMaterial(vec3 Point)
 	{
-		return vec4(Color, 1.0);
+		const MaterialDist Material = Child->EvalMaterial(Fold(Transform.ApplyInverse(Point)));
+		return { Material.Color, Material.Dist * Transform.AccumulatedScale };
 	}
 
-	virtual int LeafCount()
+	virtual int ComputeLeafCount()
 	{
 		return Child->LeafCount();
 	}
 
-	virtual bool operator==(SDFNode& Other)
+	virtual size_t ComputeHash()
 	{
-		PaintNode* OtherPaint = dynamic_cast<PaintNode*>(&Other);
-		if (OtherPaint)
+		size_t Hash = HashCombine(HashCombine(Opcode, Child->Hash()), Transform.Hash());
+		for (const float& Param : NodeParams)
 		{
-			return Color == OtherPaint->Color && *Child == *(OtherPaint->Child);
+			Hash = HashFloat(Hash, Param);
 		}
-		return false;
+		return Hash;
 	}
 
-	virtual ~PaintNode()
+	virtual void InternOperands()
 	{
-		Assert(RefCount == 0);
+		SDFNode* Canonical = SDF::Intern(Child);
 		Child->Release();
+		Child = Canonical;
 	}
-};
-#endif
 
-
-struct FlateNode : public SDFNode
-{
-	SDFNode* Child;
-	float Radius;
-
-	FlateNode(SDFNode* InChild, float InRadius)
-		: Child(InChild)
-		, Radius(InRadius)
+	virtual void ReleaseOperands()
 	{
-		Child->Hold();
+		if (Child)
+		{
+			Child->Release();
+			Child = nullptr;
+		}
 	}
 
-	virtual float Eval(vec3 Point)
+	virtual bool Equals(SDFNode& Other)
 	{
-		return Child->Eval(Point) - Radius;
+		FoldNode* OtherRepeat = dynamic_cast<FoldNode*>(&Other);
+		return OtherRepeat &&
+			OtherRepeat->Opcode == Opcode &&
+			OtherRepeat->NodeParams == NodeParams &&
+			OtherRepeat->Transform == Transform &&
+			*Child == *(OtherRepeat->Child);
 	}
 
-	virtual SDFNode* Clip(vec3 Point, float ClipRadius)
+	virtual SDFNode* Simplify(bool Exact)
 	{
-		if (Eval(Point) <= ClipRadius)
+		SDFNode* NewChild = Child->Simplify(Exact);
+		if (!NewChild)
 		{
-			SDFNode* NewChild = Child->Clip(Point, ClipRadius + Radius);
-			return new FlateNode(NewChild, Radius);
+			return nullptr;
+		}
+
+		SDFNode* Simplified = this;
+		TransformMachine NewTransform = Transform;
+		const bool TransformChanged = NewTransform.Simplify();
+		FoldNode* Nested = dynamic_cast<FoldNode*>(NewChild);
+		if (Opcode == OPCODE_MIRROR_AXES && Nested && Nested->Opcode == OPCODE_MIRROR_AXES &&
+			Nested->Transform.Kind == TransformMachine::State::Identity)
+		{
+			// Mirrors across the axes of the same space combine into one.
+			ParamsT Combined = NodeParams;
+			for (int Axis = 0; Axis < 3; ++Axis)
+			{
+				Combined[Axis] = max(NodeParams[Axis], Nested->NodeParams[Axis]);
+			}
+			Simplified = SDF::Intern(new FoldNode(Nested->Child, Opcode, Combined, NewTransform));
+		}
+		else if (TransformChanged || NewChild != Child)
+		{
+			Simplified = SDF::Intern(new FoldNode(NewChild, Opcode, NodeParams, NewTransform));
 		}
 		else
 		{
-			return nullptr;
+			Simplified->Hold();
 		}
+
+		NewChild->Release();
+		return Simplified;
 	}
 
-	virtual SDFNode* Copy()
+	virtual ~FoldNode()
 	{
-		return new FlateNode(Child->Copy(), Radius);
+		Assert(RefCount == 0);
+		ReleaseOperands();
 	}
+};
 
-	virtual AABB Bounds()
+
+// Every live interned node, keyed by structural hash.  Nodes remove themselves when deleted.
+static std::unordered_multimap<size_t, SDFNode*> InternedNodes;
+static std::mutex InternedNodesCS;
+
+
+// InternedNodesCS must be held when calling this.
+static void EraseInterned(size_t Hash, SDFNode* Node)
+{
+	auto [Start, End] = InternedNodes.equal_range(Hash);
+	for (auto Cursor = Start; Cursor != End; ++Cursor)
 	{
-		AABB ChildBounds = Child->Bounds();
-		ChildBounds.Max += vec3(Radius * 2);
-		ChildBounds.Min -= vec3(Radius * 2);
-		return ChildBounds;
+		if (Cursor->second == Node)
+		{
+			InternedNodes.erase(Cursor);
+			break;
+		}
 	}
+}
+
 
-	virtual AABB InnerBounds()
+SDFNode::~SDFNode()
+{
+	Assert(RefCount == 0);
+	if (Interned)
 	{
-		AABB ChildBounds = Child->InnerBounds();
-		ChildBounds.Max += vec3(Radius * 2);
-		ChildBounds.Min -= vec3(Radius * 2);
-		return ChildBounds;
+		std::scoped_lock Lock(InternedNodesCS);
+		EraseInterned(StructureHash, this);
 	}
+}
 
-	virtual std::string Compile(const bool WithOpcodes, std::vector<float>& TreeParams, std::string& Point)
+
+void SDFNode::ReleaseInterned()
+{
+	size_t Count = RefCount.load();
+	while (Count > 1)
 	{
-		std::string CompiledChild = Child->Compile(WithOpcodes, TreeParams, Point);
-		if (WithOpcodes)
+		if (RefCount.compare_exchange_weak(Count, Count - 1))
 		{
-			TreeParams.push_back(AsFloat(OPCODE_FLATE));
+			return;
 		}
-		const int Offset = TreeParams.size();
-		TreeParams.push_back(Radius);
-		return fmt::format("FlateOp({}, PARAMS[{}])", CompiledChild, Offset);
 	}
 
-	virtual uint32_t StackSize(const uint32_t Depth)
+	// This might be the last reference, in which case the node must leave the intern table in the
+	// same critical section so that SDF::Intern can't return it while it is being deleted.
 	{
-		return Child->StackSize(Depth);
+		std::scoped_lock Lock(InternedNodesCS);
+		Assert(RefCount > 0);
+		if (--RefCount > 0)
+		{
+			return;
+		}
+		EraseInterned(StructureHash, this);
+		Interned = false;
 	}
+	delete this;
+}
 
-	virtual std::string Pretty()
+
+namespace SDF
+{
+	SDFNode* Intern(SDFNode* Node)
 	{
-		return fmt::format("FlateOp({})", Child->Pretty());
+		if (Node->Interned)
+		{
+			Node->Hold();
+			return Node;
+		}
+
+		// Operands are interned first, so the comparisons below only need to compare pointers.
+		Node->InternOperands();
+
+		SDFNode* Canonical = nullptr;
+		{
+			std::scoped_lock Lock(InternedNodesCS);
+			auto [Start, End] = InternedNodes.equal_range(Node->StructureHash);
+			for (auto Cursor = Start; Cursor != End; ++Cursor)
+			{
+				if (Node->Equals(*(Cursor->second)))
+				{
+					Canonical = Cursor->second;
+					break;
+				}
+			}
+			if (!Canonical)
+			{
+				InternedNodes.insert({ Node->StructureHash, Node });
+				Node->Interned = true;
+				Node->Hold();
+				return Node;
+			}
+
+			// Nodes are held as they enter the table, and leave it in the same critical section that
+			// their last reference is released in.  So the canonical node is still live here, and
+			// holding it before the lock is released keeps a concurrent release from deleting it.
+			Assert(Canonical->RefCount > 0);
+			Canonical->Hold();
+		}
+
+		if (Node->RefCount == 0)
+		{
+			delete Node;
+		}
+		return Canonical;
 	}
 
-	virtual void Move(vec3 Offset)
+	void Align(SDFNode* Tree, vec3 Anchors)
 	{
-		Child->Move(Offset);
+		const vec3 Alignment = Anchors * vec3(0.5) + vec3(0.5);
+		const AABB Bounds = Tree->InnerBounds();
+		const vec3 Offset = mix(Bounds.Min, Bounds.Max, Alignment) * vec3(-1.0);
+		Tree->Move(Offset);
 	}
 
-	virtual void Rotate(quat Rotation)
+	// The following functions perform rotations on SDFNode trees.
+	void RotateX(SDFNode* Tree, float Degrees)
 	{
-		Child->Rotate(Rotation);
+		float R = radians(Degrees) * .5;
+		float S = sin(R);
+		float C = cos(R);
+		Tree->Rotate(quat(C, S, 0, 0));
 	}
 
-	virtual void Scale(float Scale)
+	void RotateY(SDFNode* Tree, float Degrees)
 	{
-		Child->Scale(Scale);
+		float R = radians(Degrees) * .5;
+		float S = sin(R);
+		float C = cos(R);
+		Tree->Rotate(quat(C, 0, S, 0));
 	}
 
-	virtual void ApplyMaterial(vec3 InColor, bool Force)
+	void RotateZ(SDFNode* Tree, float Degrees)
 	{
-		Child->ApplyMaterial(InColor, Force);
+		float R = radians(Degrees) * .5;
+		float S = sin(R);
+		float C = cos(R);
+		Tree->Rotate(quat(C, 0, 0, S));
 	}
 
-	virtual bool HasPaint()
+
+	// The following functions construct Brush nodes.
+	SDFNode* Sphere(float Radius)
 	{
-		return Child->HasPaint();
+		return Intern(new BrushNode(OPCODE_SPHERE, { Radius }));
 	}
 
-	virtual bool HasFiniteBounds()
+	SDFNode* Ellipsoid(float RadipodeX, float RadipodeY, float RadipodeZ)
 	{
-		return Child->HasFiniteBounds();
+		return Intern(new BrushNode(OPCODE_ELLIPSOID, { RadipodeX, RadipodeY, RadipodeZ }));
 	}
 
-	virtual vec4 Sample(vec3 Point)
+	SDFNode* Box(float ExtentX, float ExtentY, float ExtentZ)
 	{
-		return Child->Sample(Point);
+		return Intern(new BrushNode(OPCODE_BOX, { ExtentX, ExtentY, ExtentZ }));
 	}
 
-	virtual int LeafCount()
+	SDFNode* Torus(float MajorRadius, float MinorRadius)
 	{
-		return Child->LeafCount();
+		return Intern(new BrushNode(OPCODE_TORUS, { MajorRadius, MinorRadius }));
 	}
 
-	virtual bool operator==(SDFNode& Other)
+	SDFNode* Cylinder(float Radius, float Extent)
 	{
-		FlateNode* OtherFlate = dynamic_cast<FlateNode*>(&Other);
-		return (OtherFlate && OtherFlate->Radius == Radius && *Child == *(OtherFlate->Child));
+		return Intern(new BrushNode(OPCODE_CYLINDER, { Radius, Extent }));
 	}
 
-	virtual ~FlateNode()
+	SDFNode* Plane(float NormalX, float NormalY, float NormalZ)
 	{
-		Assert(RefCount == 0);
-		Child->Release();
+		vec3 Normal = normalize(vec3(NormalX, NormalY, NormalZ));
+		return Intern(new BrushNode(OPCODE_PLANE, { Normal.x, Normal.y, Normal.z }));
 	}
-};
-
-
-AABB SymmetricalBounds(vec3 High)
-{
-	return { High * vec3(-1), High };
-}
 
+	SDFNode* Cone(float Radius, float Height)
+	{
+		float Tangent = Radius / Height;
+		return Intern(new BrushNode(OPCODE_CONE, { Tangent, Height }));
+	}
 
-namespace SDF
-{
-	void Align(SDFNode* Tree, vec3 Anchors)
+	SDFNode* Coninder(float RadiusL, float RadiusH, float Height)
 	{
-		const vec3 Alignment = Anchors * vec3(0.5) + vec3(0.5);
-		const AABB Bounds = Tree->InnerBounds();
-		const vec3 Offset = mix(Bounds.Min, Bounds.Max, Alignment) * vec3(-1.0);
-		Tree->Move(Offset);
+		float HalfHeight = Height * .5;
+		return Intern(new BrushNode(OPCODE_CONINDER, { RadiusL, RadiusH, HalfHeight }));
 	}
 
-	// The following functions perform rotations on SDFNode trees.
-	void RotateX(SDFNode* Tree, float Degrees)
+	// The following functions construct CSG set operator nodes.
+	SDFNode* Union(SDFNode* LHS, SDFNode* RHS)
 	{
-		float R = radians(Degrees) * .5;
-		float S = sin(R);
-		float C = cos(R);
-		Tree->Rotate(quat(C, S, 0, 0));
+		std::vector<SDFNode*> Operands;
+		GatherUnionOperands(LHS, Operands);
+		GatherUnionOperands(RHS, Operands);
+		if (Operands.size() >= MinUnionNodeSize)
+		{
+			return Intern(new UnionNode(std::move(Operands)));
+		}
+		SetMixin Eval = std::bind(SDFMath::UnionOp, _1, _2);
+		return Intern(new SetNode<SetFamily::Union, false>(Eval, LHS, RHS, 0.0));
 	}
 
-	void RotateY(SDFNode* Tree, float Degrees)
+	SDFNode* Diff(SDFNode* LHS, SDFNode* RHS)
 	{
-		float R = radians(Degrees) * .5;
-		float S = sin(R);
-		float C = cos(R);
-		Tree->Rotate(quat(C, 0, S, 0));
+		SetMixin Eval = std::bind(SDFMath::DiffOp, _1, _2);
+		return Intern(new SetNode<SetFamily::Diff, false>(Eval, LHS, RHS, 0.0));
 	}
 
-	void RotateZ(SDFNode* Tree, float Degrees)
+	SDFNode* Inter(SDFNode* LHS, SDFNode* RHS)
 	{
-		float R = radians(Degrees) * .5;
-		float S = sin(R);
-		float C = cos(R);
-		Tree->Rotate(quat(C, 0, 0, S));
+		SetMixin Eval = std::bind(SDFMath::InterOp, _1, _2);
+		return Intern(new SetNode<SetFamily::Inter, false>(Eval, LHS, RHS, 0.0));
 	}
 
-
-	// The following functions construct Brush nodes.
-	SDFNode* Sphere(float Radius)
+	SDFNode* BlendUnion(float Threshold, SDFNode* LHS, SDFNode* RHS)
 	{
-		std::array<float, 1> Params = { Radius };
-
-		BrushMixin Eval = std::bind(SDFMath::SphereBrush, _1, Radius);
-
-		AABB Bounds = SymmetricalBounds(vec3(Radius));
-		return new BrushNode(OPCODE_SPHERE, "SphereBrush", Params, Eval, Bounds);
+		SetMixin Eval = std::bind(SDFMath::SmoothUnionOp, _1, _2, Threshold);
+		return Intern(new SetNode<SetFamily::Union, true>(Eval, (SDFNode*)LHS, (SDFNode*)RHS, Threshold));
 	}
 
-	SDFNode* Ellipsoid(float RadipodeX, float RadipodeY, float RadipodeZ)
+	SDFNode* BlendDiff(float Threshold, SDFNode* LHS, SDFNode* RHS)
 	{
-		std::array<float, 3> Params = { RadipodeX, RadipodeY, RadipodeZ };
-
-		using EllipsoidBrushPtr = float(*)(vec3, vec3);
-		BrushMixin Eval = std::bind((EllipsoidBrushPtr)SDFMath::EllipsoidBrush, _1, vec3(RadipodeX, RadipodeY, RadipodeZ));
-
-		AABB Bounds = SymmetricalBounds(vec3(RadipodeX, RadipodeY, RadipodeZ));
-		return new BrushNode(OPCODE_ELLIPSOID, "EllipsoidBrush", Params, Eval, Bounds);
+		SetMixin Eval = std::bind(SDFMath::SmoothDiffOp, _1, _2, Threshold);
+		return Intern(new SetNode<SetFamily::Diff, true>(Eval, (SDFNode*)LHS, (SDFNode*)RHS, Threshold));
 	}
 
-	SDFNode* Box(float ExtentX, float ExtentY, float ExtentZ)
+	SDFNode* BlendInter(float Threshold, SDFNode* LHS, SDFNode* RHS)
 	{
-		std::array<float, 3> Params = { ExtentX, ExtentY, ExtentZ };
-
-		using BoxBrushPtr = float(*)(vec3, vec3);
-		BrushMixin Eval = std::bind((BoxBrushPtr)SDFMath::BoxBrush, _1, vec3(ExtentX, ExtentY, ExtentZ));
-
-		AABB Bounds = SymmetricalBounds(vec3(ExtentX, ExtentY, ExtentZ));
-		return new BrushNode(OPCODE_BOX, "BoxBrush", Params, Eval, Bounds);
+		SetMixin Eval = std::bind(SDFMath::SmoothInterOp, _1, _2, Threshold);
+		return Intern(new SetNode<SetFamily::Inter, true>(Eval, (SDFNode*)LHS, (SDFNode*)RHS, Threshold));
 	}
 
-	SDFNode* Torus(float MajorRadius, float MinorRadius)
+	SDFNode* Flate(SDFNode* Node, float Radius)
 	{
-		std::array<float, 2> Params = { MajorRadius, MinorRadius };
-
-		BrushMixin Eval = std::bind(SDFMath::TorusBrush, _1, MajorRadius, MinorRadius);
-
-		float Radius = MajorRadius + MinorRadius;
-		AABB Bounds = SymmetricalBounds(vec3(Radius, Radius, MinorRadius));
-
-		return new BrushNode(OPCODE_TORUS, "TorusBrush", Params, Eval, Bounds);
+		return Intern(new FlateNode(Node, Radius));
 	}
 
-	SDFNode* Cylinder(float Radius, float Extent)
+	SDFNode* RepeatGrid(SDFNode* Node, vec3 Period, vec3 Count)
 	{
-		std::array<float, 2> Params = { Radius, Extent };
-
-		BrushMixin Eval = std::bind(SDFMath::CylinderBrush, _1, Radius, Extent);
+		FoldNode::ParamsT Params = {};
+		for (int Axis = 0; Axis < 3; ++Axis)
+		{
+			if (Period[Axis] <= 0.0 || (Count[Axis] != 0.0 && Count[Axis] < 2.0))
+			{
+				Params[Axis] = 1.0;
+			}
+			else if (Count[Axis] == 0.0)
+			{
+				Params[Axis] = Period[Axis];
+				Params[Axis + 3] = -INFINITY;
+				Params[Axis + 6] = INFINITY;
+			}
+			else
+			{
+				Params[Axis] = Period[Axis];
+				Params[Axis + 6] = floor(Count[Axis]) - 1.0f;
+			}
+		}
+		return Intern(new FoldNode(Node, OPCODE_REPEAT_GRID, Params, TransformMachine()));
+	}
 
-		AABB Bounds = SymmetricalBounds(vec3(Radius, Radius, Extent));
-		return new BrushNode(OPCODE_CYLINDER, "CylinderBrush", Params, Eval, Bounds);
+	SDFNode* RepeatPolar(SDFNode* Node, int Count)
+	{
+		FoldNode::ParamsT Params = {};
+		Params[0] = float(max(Count, 1));
+		return Intern(new FoldNode(Node, OPCODE_REPEAT_POLAR, Params, TransformMachine()));
 	}
 
-	SDFNode* Plane(float NormalX, float NormalY, float NormalZ)
+	SDFNode* Mirror(SDFNode* Node, bvec3 Axes)
 	{
-		vec3 Normal = normalize(vec3(NormalX, NormalY, NormalZ));
-		std::array<float, 3> Params = { Normal.x, Normal.y, Normal.z };
+		FoldNode::ParamsT Params = {};
+		Params[0] = Axes.x ? 1.0 : 0.0;
+		Params[1] = Axes.y ? 1.0 : 0.0;
+		Params[2] = Axes.z ? 1.0 : 0.0;
+		return Intern(new FoldNode(Node, OPCODE_MIRROR_AXES, Params, TransformMachine()));
+	}
 
-		using PlanePtr = float(*)(vec3, vec3);
-		BrushMixin Eval = std::bind((PlanePtr)SDFMath::Plane, _1, Normal);
+	SDFNode* Mirror(SDFNode* Node, vec3 Normal, float Offset)
+	{
+		const vec3 Plane = normalize(Normal);
+		FoldNode::ParamsT Params = {};
+		Params[0] = Plane.x;
+		Params[1] = Plane.y;
+		Params[2] = Plane.z;
+		Params[3] = Offset;
+		return Intern(new FoldNode(Node, OPCODE_MIRROR_PLANE, Params, TransformMachine()));
+	}
 
-		AABB Unbound = SymmetricalBounds(vec3(INFINITY, INFINITY, INFINITY));
-		if (Normal.x == -1.0)
+	SDFNode* Simplify(SDFNode* Tree)
+	{
+		SDFNode* Simplified = Tree->Simplify(false);
+		if (!Simplified)
 		{
-			Unbound.Min.x = 0.0;
+			// There is no way to represent an empty model, so empty trees are left as they are.
+			Tree->Hold();
+			Simplified = Tree;
 		}
-		else if (Normal.x == 1.0)
+		return Simplified;
+	}
+
+	int Validate(SDFNode* Tree, int SampleCount)
+	{
+		// Sample the tree's bounds with some margin around them, or an arbitrary region around the
+		// origin if the tree is unbounded.
+		AABB TreeBounds;
+		const bool Bounded = FiniteBounds(Tree, TreeBounds);
+		AABB Bounds = AABB{ vec3(-10.0), vec3(10.0) };
+		if (Bounded)
 		{
-			Unbound.Max.x = 0.0;
+			const vec3 Margin = max((TreeBounds.Max - TreeBounds.Min) * vec3(0.25), vec3(0.1));
+			Bounds.Min = TreeBounds.Min - Margin;
+			Bounds.Max = TreeBounds.Max + Margin;
 		}
-		else if (Normal.y == -1.0)
+
+		// Trees of every size are compiled to native code here, not just the ones that are large
+		// enough for SDFInterpreter to use it.
+		const SDFInterpreter Interpreter(Tree);
+		SDFJit* Jit = SDFJit::Create(Interpreter.Params, Interpreter.StackSize);
+		SDFNode* Simplified = Simplify(Tree);
+
+		// Octree cells only keep the operands that may reach the surface within them, so the octree
+		// is also only compared by which side of the surface points within its bounds are on.
+		SDFOctree* Octree = nullptr;
+		if (Bounded)
 		{
-			Unbound.Min.y = 0.0;
+			const vec3 Extent = TreeBounds.Max - TreeBounds.Min;
+			Octree = SDFOctree::Create(Tree, max(max(Extent.x, Extent.y), Extent.z) / 16.0f);
 		}
-		else if (Normal.y == 1.0)
+
+		auto Matches = [](float Expected, float Found, float Tolerance) -> bool
 		{
-			Unbound.Max.y = 0.0;
-		}
-		else if (Normal.z == -1.0)
+			return Expected == Found || abs(Expected - Found) <= Tolerance * max(1.0f, abs(Expected));
+		};
+
+		int Mismatches = 0;
+		auto Report = [&](const char* Kind, vec3 Point, float Expected, float Found)
 		{
-			Unbound.Min.z = 0.0;
+			if (++Mismatches <= 8)
+			{
+				fmt::print("{} mismatch at ({}, {}, {}): expected {}, found {}\n", Kind, Point.x, Point.y, Point.z, Expected, Found);
+			}
+		};
+
+		std::default_random_engine RNG(SampleCount);
+		std::uniform_real_distribution<float> Roll(0.0, 1.0);
+		for (int i = 0; i < SampleCount; ++i)
+		{
+			const vec3 Alpha = vec3(Roll(RNG), Roll(RNG), Roll(RNG));
+			const vec3 Point = mix(Bounds.Min, Bounds.Max, Alpha);
+
+			const float Expected = Tree->Eval(Point);
+			const float Interpreted = Interpreter.Interpret(Point);
+			if (!Matches(Expected, Interpreted, 0.001))
+			{
+				Report("Interpreter", Point, Expected, Interpreted);
+			}
+			if (Jit)
+			{
+				const float Native = Jit->Eval(Point);
+				if (!Matches(Interpreted, Native, 0.0001))
+				{
+					Report("Native code", Point, Interpreted, Native);
+				}
+			}
+			if (Simplified != Tree)
+			{
+				// Simplifying may change distances away from the surface, but it must not move the
+				// surface, so only the side of the surface the point is on is compared.
+				const float Reduced = Simplified->Eval(Point);
+				if ((Expected < 0.0) != (Reduced < 0.0) && abs(Expected) > 0.001)
+				{
+					Report("Simplified tree", Point, Expected, Reduced);
+				}
+			}
+			if (Octree && all(greaterThanEqual(Point, TreeBounds.Min)) && all(lessThanEqual(Point, TreeBounds.Max)))
+			{
+				const float Clipped = Octree->Eval(Point);
+				if ((Expected < 0.0) != (Clipped < 0.0) && abs(Expected) > 0.001)
+				{
+					Report("Octree", Point, Expected, Clipped);
+				}
+			}
 		}
-		else if (Normal.z == 1.0)
+
+		fmt::print("Validated {} points{}: {} mismatches\n", SampleCount, Jit ? "" : " without native code", Mismatches);
+		if (Jit)
 		{
-			Unbound.Max.z = 0.0;
+			delete Jit;
 		}
-		return new BrushNode(OPCODE_PLANE, "Plane", Params, Eval, Unbound);
+		Simplified->Release();
+		delete Octree;
+		return Mismatches;
 	}
+}
 
-	SDFNode* Cone(float Radius, float Height)
-	{
-		float Tangent = Radius / Height;
-		std::array<float, 2> Params = { Tangent, Height };
 
-		BrushMixin Eval = std::bind(SDFMath::ConeBrush, _1, Tangent, Height);
+// SDFInterpreter function implementations
+SDFInterpreter::SDFInterpreter(SDFNode* Evaluator)
+{
+	std::string Point = "Point";
+	Evaluator->Compile(true, Params, Point);
+	Evaluator->AddTerminus(Params);
+	StackSize = Evaluator->StackSize();
 
-		AABB Bounds = SymmetricalBounds(vec3(Radius, Radius, Height * .5));
-		return new BrushNode(OPCODE_CONE, "ConeBrush", Params, Eval, Bounds);
-	}
+	// Small trees are cheap enough to interpret that they aren't worth an executable page.
+	Jit = Evaluator->LeafCount() >= 8 ? SDFJit::Create(Params, StackSize) : nullptr;
 
-	SDFNode* Coninder(float RadiusL, float RadiusH, float Height)
+#if _DEBUG
+	if (Jit)
 	{
-		float HalfHeight = Height * .5;
-		std::array<float, 3> Params = { RadiusL, RadiusH, HalfHeight };
-
-		BrushMixin Eval = std::bind(SDFMath::ConinderBrush, _1, RadiusL, RadiusH, HalfHeight);
-
-		float MaxRadius = max(RadiusL, RadiusH);
-		AABB Bounds = SymmetricalBounds(vec3(MaxRadius, MaxRadius, HalfHeight));
-		return new BrushNode(OPCODE_CONINDER, "ConinderBrush", Params, Eval, Bounds);
+		// Spot check the generated code against the interpreter.
+		AABB Bounds;
+		if (!FiniteBounds(Evaluator, Bounds))
+		{
+			Bounds = AABB{ vec3(-1.0), vec3(1.0) };
+		}
+		for (int i = 0; i < 27; ++i)
+		{
+			const vec3 Alpha = vec3(i % 3, (i / 3) % 3, i / 9) * vec3(0.5);
+			const vec3 Point = mix(Bounds.Min, Bounds.Max, Alpha) + vec3(0.01, 0.02, 0.03);
+			const float Expected = Interpret(Point);
+			const float Found = Jit->Eval(Point);
+			Assert(abs(Expected - Found) <= 0.0001 * max(1.0, abs(Expected)));
+		}
 	}
+#endif
+}
 
-	// The following functions construct CSG set operator nodes.
-	SDFNode* Union(SDFNode* LHS, SDFNode* RHS)
+SDFInterpreter::~SDFInterpreter()
+{
+	if (Jit)
 	{
-		SetMixin Eval = std::bind(SDFMath::UnionOp, _1, _2);
-		return new SetNode<SetFamily::Union, false>(Eval, LHS, RHS, 0.0);
+		delete Jit;
+		Jit = nullptr;
 	}
+}
 
-	SDFNode* Diff(SDFNode* LHS, SDFNode* RHS)
+float SDFInterpreter::Eval(vec3 Point) const
+{
+	if (Jit)
 	{
-		SetMixin Eval = std::bind(SDFMath::DiffOp, _1, _2);
-		return new SetNode<SetFamily::Diff, false>(Eval, LHS, RHS, 0.0);
+		return Jit->Eval(Point);
 	}
+	return Interpret(Point);
+}
 
-	SDFNode* Inter(SDFNode* LHS, SDFNode* RHS)
-	{
-		SetMixin Eval = std::bind(SDFMath::InterOp, _1, _2);
-		return new SetNode<SetFamily::Inter, false>(Eval, LHS, RHS, 0.0);
+float SDFInterpreter::Interpret(vec3 EvalPoint) const
+{
+	// Most trees are shallow enough for the stack to live in registers or L1, so only
+	// spill to the heap for the pathological cases.
+	float LocalStack[32];
+	std::unique_ptr<float[]> SpillStack;
+	float* Stack = LocalStack;
+	if (StackSize > 32)
+	{
+		SpillStack.reset(new float[StackSize]);
+		Stack = SpillStack.get();
 	}
 
-	SDFNode* BlendUnion(float Threshold, SDFNode* LHS, SDFNode* RHS)
-	{
-		SetMixin Eval = std::bind(SDFMath::SmoothUnionOp, _1, _2, Threshold);
-		return new SetNode<SetFamily::Union, true>(Eval, (SDFNode*)LHS, (SDFNode*)RHS, Threshold);
-	}
+	uint32_t StackPointer = 0;
+	const float* ProgramCounter = Params.data();
+	vec3 Point = EvalPoint;
 
-	SDFNode* BlendDiff(float Threshold, SDFNode* LHS, SDFNode* RHS)
+	while (true)
 	{
-		SetMixin Eval = std::bind(SDFMath::SmoothDiffOp, _1, _2, Threshold);
-		return new SetNode<SetFamily::Diff, true>(Eval, (SDFNode*)LHS, (SDFNode*)RHS, Threshold);
+		const uint32_t Opcode = AsUint(*ProgramCounter++);
+		switch (Opcode)
+		{
+		// Set operators
+		case OPCODE_UNION:
+			--StackPointer;
+			Stack[StackPointer] = SDFMath::UnionOp(Stack[StackPointer], Stack[StackPointer + 1]);
+			break;
+
+		case OPCODE_INTER:
+			--StackPointer;
+			Stack[StackPointer] = SDFMath::InterOp(Stack[StackPointer], Stack[StackPointer + 1]);
+			break;
+
+		case OPCODE_DIFF:
+			--StackPointer;
+			Stack[StackPointer] = SDFMath::DiffOp(Stack[StackPointer], Stack[StackPointer + 1]);
+			break;
+
+		case OPCODE_SMOOTH_UNION:
+			--StackPointer;
+			Stack[StackPointer] = SDFMath::SmoothUnionOp(Stack[StackPointer], Stack[StackPointer + 1], *ProgramCounter++);
+			break;
+
+		case OPCODE_SMOOTH_INTER:
+			--StackPointer;
+			Stack[StackPointer] = SDFMath::SmoothInterOp(Stack[StackPointer], Stack[StackPointer + 1], *ProgramCounter++);
+			break;
+
+		case OPCODE_SMOOTH_DIFF:
+			--StackPointer;
+			Stack[StackPointer] = SDFMath::SmoothDiffOp(Stack[StackPointer], Stack[StackPointer + 1], *ProgramCounter++);
+			break;
+
+		// Brush operands
+		case OPCODE_SPHERE:
+			Stack[StackPointer] = SDFMath::SphereBrush(Point, ProgramCounter[0]);
+			ProgramCounter += 1;
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_ELLIPSOID:
+			Stack[StackPointer] = SDFMath::EllipsoidBrush(Point, ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]);
+			ProgramCounter += 3;
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_BOX:
+			Stack[StackPointer] = SDFMath::BoxBrush(Point, ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]);
+			ProgramCounter += 3;
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_TORUS:
+			Stack[StackPointer] = SDFMath::TorusBrush(Point, ProgramCounter[0], ProgramCounter[1]);
+			ProgramCounter += 2;
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_CYLINDER:
+			Stack[StackPointer] = SDFMath::CylinderBrush(Point, ProgramCounter[0], ProgramCounter[1]);
+			ProgramCounter += 2;
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_PLANE:
+			Stack[StackPointer] = SDFMath::Plane(Point, ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]);
+			ProgramCounter += 3;
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_CONE:
+			Stack[StackPointer] = SDFMath::ConeBrush(Point, ProgramCounter[0], ProgramCounter[1]);
+			ProgramCounter += 2;
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_CONINDER:
+			Stack[StackPointer] = SDFMath::ConinderBrush(Point, ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]);
+			ProgramCounter += 3;
+			Point = EvalPoint;
+			break;
+
+		// Brushes with a built in offset
+		case OPCODE_MOVED_SPHERE:
+			Stack[StackPointer] = SDFMath::SphereBrush(Point - vec3(ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]), ProgramCounter[3]);
+			ProgramCounter += 4;
+			break;
+
+		case OPCODE_MOVED_ELLIPSOID:
+			Stack[StackPointer] = SDFMath::EllipsoidBrush(Point - vec3(ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]), ProgramCounter[3], ProgramCounter[4], ProgramCounter[5]);
+			ProgramCounter += 6;
+			break;
+
+		case OPCODE_MOVED_BOX:
+			Stack[StackPointer] = SDFMath::BoxBrush(Point - vec3(ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]), ProgramCounter[3], ProgramCounter[4], ProgramCounter[5]);
+			ProgramCounter += 6;
+			break;
+
+		// Misc
+		case OPCODE_OFFSET:
+			Point -= vec3(ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]);
+			ProgramCounter += 3;
+			break;
+
+		case OPCODE_MATRIX:
+		{
+			// The matrix is stored in column major order, and is always affine.
+			const float* M = ProgramCounter;
+			Point = vec3(
+				M[0] * Point.x + M[4] * Point.y + M[8] * Point.z + M[12],
+				M[1] * Point.x + M[5] * Point.y + M[9] * Point.z + M[13],
+				M[2] * Point.x + M[6] * Point.y + M[10] * Point.z + M[14]);
+			ProgramCounter += 16;
+			break;
+		}
+
+		case OPCODE_ROTATE:
+		{
+			quat Rotation;
+			Rotation.x = ProgramCounter[3];
+			Rotation.y = ProgramCounter[4];
+			Rotation.z = ProgramCounter[5];
+			Rotation.w = ProgramCounter[6];
+			Point = mat3_cast(Rotation) * (Point - vec3(ProgramCounter[0], ProgramCounter[1], ProgramCounter[2]));
+			ProgramCounter += 7;
+			break;
+		}
+
+		case OPCODE_SCALE:
+			Stack[StackPointer] *= *ProgramCounter++;
+			break;
+
+		case OPCODE_FLATE:
+			Stack[StackPointer] -= *ProgramCounter++;
+			break;
+
+		case OPCODE_PAINT:
+			// Color is not needed to find the distance.
+			ProgramCounter += 3;
+			break;
+
+		case OPCODE_REPEAT_GRID:
+		case OPCODE_REPEAT_POLAR:
+		case OPCODE_MIRROR_AXES:
+		case OPCODE_MIRROR_PLANE:
+			// The point the folded subtree was entered with is saved on the stack for OPCODE_FOLD_END,
+			// and the subtree is evaluated with the folded point instead.
+			Stack[StackPointer++] = EvalPoint.x;
+			Stack[StackPointer++] = EvalPoint.y;
+			Stack[StackPointer++] = EvalPoint.z;
+			EvalPoint = FoldPoint(Opcode, Point, ProgramCounter);
+			ProgramCounter += FoldParamCount(Opcode);
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_FOLD_END:
+			StackPointer -= 3;
+			EvalPoint = vec3(Stack[StackPointer], Stack[StackPointer + 1], Stack[StackPointer + 2]);
+			Stack[StackPointer] = Stack[StackPointer + 3];
+			Point = EvalPoint;
+			break;
+
+		case OPCODE_PUSH:
+			++StackPointer;
+			break;
+
+		case OPCODE_RETURN:
+			return Stack[0];
+
+		default:
+			// Unknown opcode.  This should be unreachable.
+			Assert(false);
+			return INFINITY;
+		}
 	}
+}
 
-	SDFNode* BlendInter(float Threshold, SDFNode* LHS, SDFNode* RHS)
+vec3 SDFInterpreter::Gradient(vec3 Point) const
+{
+	vec3 Gradient;
+	Eval(Point, Gradient);
+	float LengthSquared = dot(Gradient, Gradient);
+	if (LengthSquared > 0.0 && std::isfinite(LengthSquared))
 	{
-		SetMixin Eval = std::bind(SDFMath::SmoothInterOp, _1, _2, Threshold);
-		return new SetNode<SetFamily::Inter, true>(Eval, (SDFNode*)LHS, (SDFNode*)RHS, Threshold);
+		return Gradient / sqrt(LengthSquared);
 	}
-
-	SDFNode* Flate(SDFNode* Node, float Radius)
+	else
 	{
-		return new FlateNode(Node, Radius);
+		// The analytic gradient vanishes at critical points, such as the center of a sphere.
+		return TetrahedralGradient(*this, Point);
 	}
 }
 
+RayHit SDFInterpreter::RayMarch(vec3 RayStart, vec3 RayDir, int MaxIterations, float Epsilon) const
+{
+	return RayMarchEvaluator(*this, RayStart, RayDir, MaxIterations, Epsilon);
+}
+
 
 // SDFOctree function implementations
-SDFOctree* SDFOctree::Create(SDFNode* Evaluator, float TargetSize)
+// Octree cells at this depth and below are built in parallel.  The root is at depth 1, so this
+// splits the work into as many as 512 tasks.
+const int OctreeParallelDepth = 4;
+
+
+SDFOctree* SDFOctree::Create(SDFNode* Evaluator, float TargetSize, ReuseCallback* Reuse)
 {
-	if (Evaluator->HasFiniteBounds())
+	// Bounds containing NaN or infinity would never subdivide down to the target size.
+	AABB Bounds;
+	if (FiniteBounds(Evaluator, Bounds))
 	{
 		// Determine the octree's bounding cube from the evaluator's bounding box.
-		AABB Bounds = Evaluator->Bounds();
 		vec3 Extent = Bounds.Max - Bounds.Min;
 		float Span = max(max(Extent.x, Extent.y), Extent.z);
 		vec3 Padding = (vec3(Span) - Extent) * vec3(0.5);
 		Bounds.Min -= Padding;
 		Bounds.Max += Padding;
 
-		SDFOctree* Tree = new SDFOctree(nullptr, Evaluator, TargetSize, Bounds, 1);
+		SDFOctree* Tree = new SDFOctree(nullptr, new SDFArena(), Evaluator, TargetSize, Bounds);
+		if (!Tree->Terminus)
+		{
+			// The top of the octree is subdivided serially, and then everything below is built in
+			// parallel.  The top levels are merged last, since they depend on their children.
+			std::vector<SDFOctree*> Deferred;
+			Tree->PopulateTop(1, Deferred, Reuse);
+
+			if (Deferred.size() > 0)
+			{
+				std::atomic_int NextTask = 0;
+				Pool([&]()
+				{
+					for (int i = NextTask.fetch_add(1); i < Deferred.size(); i = NextTask.fetch_add(1))
+					{
+						Deferred[i]->Populate(OctreeParallelDepth);
+					}
+				});
+			}
+
+			Tree->MergeTop(1);
+		}
 		if (Tree->Evaluator)
 		{
+			Tree->Linearize(Bounds);
 			return Tree;
 		}
 		else
@@ -1403,17 +4119,19 @@ SDFOctree* SDFOctree::Create(SDFNode* Evaluator, float TargetSize)
 	}
 }
 
-SDFOctree::SDFOctree(SDFOctree* InParent, SDFNode* InEvaluator, float InTargetSize, AABB InBounds, int Depth)
-	: Parent(InParent)
+SDFOctree::SDFOctree(SDFOctree* InParent, SDFArena* InArena, SDFNode* InEvaluator, float InTargetSize, AABB InBounds)
+	: Bounds(InBounds)
 	, TargetSize(InTargetSize)
-	, Bounds(InBounds)
+	, Reused(false)
+	, Parent(InParent)
+	, Arena(InArena)
+	, Interpreter(nullptr)
 {
 	vec3 Extent = Bounds.Max - Bounds.Min;
 	float Span = max(max(Extent.x, Extent.y), Extent.z);
 	Pivot = vec3(Span * 0.5) + Bounds.Min;
 
-	float Radius = length(vec3(Span)) * 0.5;
-	Evaluator = InEvaluator->Clip(Pivot, Radius);
+	Evaluator = InEvaluator->Clip(Bounds, 0.0, Arena);
 	if (Evaluator)
 	{
 		Evaluator->Hold();
@@ -1424,26 +4142,78 @@ SDFOctree::SDFOctree(SDFOctree* InParent, SDFNode* InEvaluator, float InTargetSi
 		LeafCount = 0;
 	}
 
-	Terminus = Span <= TargetSize || Evaluator == nullptr;
-	if (Terminus)
+	// Written so that a NaN span terminates instead of subdividing forever.
+	Terminus = !(Span > TargetSize) || Evaluator == nullptr;
+	for (int i = 0; i < 8; ++i)
+	{
+		Children[i] = nullptr;
+	}
+}
+
+void SDFOctree::Populate(int Depth)
+{
+	// Everything allocated for the children can be freed at once if they are all discarded.
+	const SDFArena::Mark ArenaMark = Arena->GetMark();
+
+	Split();
+	for (SDFOctree* Child : Children)
 	{
-		for (int i = 0; i < 8; ++i)
+		if (Child && !Child->Terminus)
 		{
-			Children[i] = nullptr;
+			Child->Populate(Depth + 1);
 		}
 	}
-	else
+	if (Merge(Depth))
 	{
-		Populate(Depth);
+		Arena->Rewind(ArenaMark);
 	}
 }
 
-void SDFOctree::Populate(int Depth)
+void SDFOctree::PopulateTop(int Depth, std::vector<SDFOctree*>& Deferred, ReuseCallback* Reuse)
+{
+	Split();
+	for (SDFOctree* Child : Children)
+	{
+		if (Child && !Child->Terminus)
+		{
+			if (Depth + 1 >= OctreeParallelDepth)
+			{
+				if (Reuse && (*Reuse)(*Child))
+				{
+					Child->Reused = true;
+				}
+				else
+				{
+					Deferred.push_back(Child);
+				}
+			}
+			else
+			{
+				Child->PopulateTop(Depth + 1, Deferred, Reuse);
+			}
+		}
+	}
+}
+
+void SDFOctree::MergeTop(int Depth)
+{
+	if (Depth + 1 < OctreeParallelDepth)
+	{
+		for (SDFOctree* Child : Children)
+		{
+			if (Child && !Child->Terminus)
+			{
+				Child->MergeTop(Depth + 1);
+			}
+		}
+	}
+
+	// The children of this cell were built on other threads, so there is nothing to rewind here.
+	Merge(Depth);
+}
+
+void SDFOctree::Split()
 {
-	bool Uniform = true;
-	bool Penultimate = true;
-	std::vector<SDFOctree*> Live;
-	Live.reserve(8);
 	for (int i = 0; i < 8; ++i)
 	{
 		AABB ChildBounds = Bounds;
@@ -1471,12 +4241,33 @@ void SDFOctree::Populate(int Depth)
 		{
 			ChildBounds.Max.z = Pivot.z;
 		}
-		Children[i] = new SDFOctree(this, Evaluator, TargetSize, ChildBounds, Depth + 1);
+		Children[i] = new SDFOctree(this, Arena, Evaluator, TargetSize, ChildBounds);
 		if (Children[i]->Evaluator == nullptr)
 		{
 			delete Children[i];
 			Children[i] = nullptr;
 		}
+	}
+}
+
+bool SDFOctree::Merge(int Depth)
+{
+	bool Uniform = true;
+	bool Penultimate = true;
+	std::vector<SDFOctree*> Live;
+	Live.reserve(8);
+	for (int i = 0; i < 8; ++i)
+	{
+		if (Children[i] == nullptr)
+		{
+			continue;
+		}
+		else if (Children[i]->Evaluator == nullptr)
+		{
+			// None of this child's own children were live.
+			delete Children[i];
+			Children[i] = nullptr;
+		}
 		else
 		{
 			Uniform &= *Evaluator == *(Children[i]->Evaluator);
@@ -1491,6 +4282,7 @@ void SDFOctree::Populate(int Depth)
 		Evaluator = nullptr;
 		Penultimate = false;
 		Terminus = true;
+		return true;
 	}
 	else
 	{
@@ -1513,9 +4305,11 @@ void SDFOctree::Populate(int Depth)
 				}
 			}
 			Terminus = true;
+			return true;
 		}
 #endif
 	}
+	return false;
 }
 
 SDFOctree::~SDFOctree()
@@ -1533,53 +4327,130 @@ SDFOctree::~SDFOctree()
 		Evaluator->Release();
 		Evaluator = nullptr;
 	}
+	if (Interpreter)
+	{
+		delete Interpreter;
+		Interpreter = nullptr;
+	}
+	if (!Parent)
+	{
+		delete Arena;
+		Arena = nullptr;
+	}
+}
+
+// Returns the number of bits set in an octree child mask.
+inline uint32_t CountChildren(uint32_t Mask)
+{
+	Mask = Mask - ((Mask >> 1) & 0x55);
+	Mask = (Mask & 0x33) + ((Mask >> 2) & 0x33);
+	return (Mask + (Mask >> 4)) & 0x0F;
 }
 
 SDFNode* SDFOctree::Descend(const vec3 Point, const bool Exact)
 {
-	if (!Terminus)
-	{
-		int i = 0;
+	SDFOctree* Cell = DescendCell(Point, Exact);
+	return Cell ? Cell->Evaluator : nullptr;
+}
+
+SDFOctree* SDFOctree::DescendCell(const vec3 Point, const bool Exact)
+{
+	Assert(Parent == nullptr);
+	vec3 Min = LinearBounds.Min;
+	vec3 Max = LinearBounds.Max;
+	uint32_t Index = 0;
+	while (true)
+	{
+		const LinearNode Node = LinearNodes[Index];
+		if (Node.ChildMask == 0)
+		{
+			return LinearCells[Index];
+		}
+
+		// This must match how the cell bounds are subdivided by SDFOctree::Split.
+		const vec3 Extent = Max - Min;
+		const float Span = max(max(Extent.x, Extent.y), Extent.z);
+		const vec3 Pivot = vec3(Span * 0.5) + Min;
+
+		uint32_t i = 0;
 		if (Point.x > Pivot.x)
 		{
 			i |= 1;
+			Min.x = Pivot.x;
+		}
+		else
+		{
+			Max.x = Pivot.x;
 		}
 		if (Point.y > Pivot.y)
 		{
 			i |= 2;
+			Min.y = Pivot.y;
+		}
+		else
+		{
+			Max.y = Pivot.y;
 		}
 		if (Point.z > Pivot.z)
 		{
 			i |= 4;
+			Min.z = Pivot.z;
 		}
-		SDFOctree* Child = Children[i];
-		if (Child)
+		else
+		{
+			Max.z = Pivot.z;
+		}
+
+		const uint32_t Bit = 1 << i;
+		if (Node.ChildMask & Bit)
 		{
-			SDFNode* Found = Child->Descend(Point);
-			return Found || !Exact ? Found : Evaluator;
+			Index = Node.FirstChild + CountChildren(Node.ChildMask & (Bit - 1));
 		}
-		else if (!Exact)
+		else if (Index == 0 && !Exact)
 		{
 			return nullptr;
 		}
+		else
+		{
+			return LinearCells[Index];
+		}
 	}
-	return Evaluator;
-};
+}
 
-void SDFOctree::Walk(SDFOctree::CallbackType& Callback)
+SDFInterpreter* SDFOctree::GetInterpreter()
 {
-	if (Terminus)
-	{
-		Callback(*this);
-	}
-	else
+	// Interpreters are built lazily, because most octrees are only used to generate shaders.
+	// This may be called from multiple threads during export.
+	std::call_once(InterpreterReady, [&]()
 	{
-		for (SDFOctree* Child : Children)
+		Interpreter = new SDFInterpreter(Evaluator);
+	});
+	return Interpreter;
+}
+
+void SDFOctree::Linearize(const AABB& RootBounds)
+{
+	LinearBounds = RootBounds;
+	LinearNodes.clear();
+	LinearCells.clear();
+	LinearNodes.push_back({ 0, 0 });
+	LinearCells.push_back(this);
+	for (size_t Index = 0; Index < LinearCells.size(); ++Index)
+	{
+		SDFOctree* Cell = LinearCells[Index];
+		LinearNode Node = { (uint32_t)LinearCells.size(), 0 };
+		if (!Cell->Terminus)
 		{
-			if (Child)
+			for (int i = 0; i < 8; ++i)
 			{
-				Child->Walk(Callback);
+				if (Cell->Children[i])
+				{
+					Node.ChildMask |= 1 << i;
+					LinearNodes.push_back({ 0, 0 });
+					LinearCells.push_back(Cell->Children[i]);
+				}
 			}
 		}
+		LinearNodes[Index] = Node;
 	}
 }
@@ -18,6 +18,8 @@
 #include <functional>
 #include <vector>
 #include <string>
+#include <mutex>
+#include <atomic>
 #include "glm_common.h"
 #include "errors.h"
 
@@ -33,6 +35,12 @@ inline float AsFloat(T Word)
 }
 
 
+inline uint32_t AsUint(float Word)
+{
+	return *((uint32_t*)(&Word));
+}
+
+
 struct AABB
 {
 	glm::vec3 Min;
@@ -43,6 +51,11 @@ struct AABB
 		return Max - Min;
 	}
 
+	bool Overlaps(const AABB& Other) const
+	{
+		return glm::all(glm::lessThanEqual(Min, Other.Max)) && glm::all(glm::lessThanEqual(Other.Min, Max));
+	}
+
 	AABB operator+(const glm::vec3& Offset) const
 	{
 		return {
@@ -53,50 +66,123 @@ struct AABB
 };
 
 
+// A conservative range of distances that an SDFNode may return within some region.
+struct Interval
+{
+	float Min;
+	float Max;
+};
+
+
+// A distance paired with the color of the surface it was measured from.  This mirrors the struct of
+// the same name in math.glsl, except that unpainted surfaces have an alpha of zero.
+struct MaterialDist
+{
+	glm::vec4 Color;
+	float Dist;
+};
+
+
+// Transforms are stored as a uniform scale, followed by a rotation, followed by an offset, which is
+// all that Move, Rotate, and Scale can produce.  This is much smaller than the equivalent matrices,
+// which are instead derived when needed.
 struct TransformMachine
 {
-	enum class State
+	enum class State : uint8_t
 	{
 		Identity = 0,
 		Offset = 1,
 		Matrix = 2
 	};
 
-	State FoldState;
+	glm::quat Rotation;
+	glm::vec3 Offset;
 	float AccumulatedScale;
-
-	glm::mat4 LastFold;
-	glm::mat4 LastFoldInverse;
-
-	bool OffsetPending;
-	glm::vec3 OffsetRun;
-	bool RotatePending;
-	glm::quat RotateRun;
+	State Kind;
 
 	TransformMachine();
 	void Reset();
-	void FoldOffset();
-	void FoldRotation();
-	void Fold();
 	void Move(glm::vec3 Offset);
 	void Rotate(glm::quat Rotation);
 	void Scale(float ScaleBy);
-	glm::vec3 ApplyInverse(glm::vec3 Point);
-	glm::vec3 Apply(glm::vec3 Point);
-	AABB Apply(const AABB InBounds);
-	std::string Compile(const bool WithOpcodes, std::vector<float>& TreeParams, std::string Point);
-	std::string Pretty(std::string Brush);
-	bool operator==(TransformMachine& Other);
+	bool Simplify();
+	glm::mat4 ToWorld() const;
+	glm::mat4 ToLocal() const;
+
+	// These are called for every brush evaluated on the CPU, so they are defined here to be inlined.
+	glm::vec3 ApplyInverse(glm::vec3 Point) const
+	{
+		if (Kind == State::Identity)
+		{
+			return Point;
+		}
+		else if (Kind == State::Offset)
+		{
+			return Point - Offset;
+		}
+		else
+		{
+			// Rotate by the conjugate of Rotation, which is its inverse.  This is written out by hand, as
+			// it is measurably faster than the equivalent glm expression.
+			const float X = Point.x - Offset.x;
+			const float Y = Point.y - Offset.y;
+			const float Z = Point.z - Offset.z;
+			const float QX = -Rotation.x;
+			const float QY = -Rotation.y;
+			const float QZ = -Rotation.z;
+			const float TX = 2.0f * (QY * Z - QZ * Y);
+			const float TY = 2.0f * (QZ * X - QX * Z);
+			const float TZ = 2.0f * (QX * Y - QY * X);
+			const float InverseScale = 1.0f / AccumulatedScale;
+			return glm::vec3(
+				(X + Rotation.w * TX + (QY * TZ - QZ * TY)) * InverseScale,
+				(Y + Rotation.w * TY + (QZ * TX - QX * TZ)) * InverseScale,
+				(Z + Rotation.w * TZ + (QX * TY - QY * TX)) * InverseScale);
+		}
+	}
+
+	glm::vec3 Apply(glm::vec3 Point) const
+	{
+		if (Kind == State::Identity)
+		{
+			return Point;
+		}
+		else if (Kind == State::Offset)
+		{
+			return Point + Offset;
+		}
+		else
+		{
+			return Rotation * (Point * AccumulatedScale) + Offset;
+		}
+	}
+
+	AABB Apply(const AABB InBounds) const;
+	AABB ApplyInverse(const AABB InBounds) const;
+	std::string Compile(const bool WithOpcodes, std::vector<float>& TreeParams, std::string Point) const;
+	std::string Pretty(std::string Brush) const;
+	bool operator==(const TransformMachine& Other) const;
+	size_t Hash() const;
 
 private:
 
-	AABB ApplyOffset(const AABB InBounds);
-	AABB ApplyMatrix(const AABB InBounds);
-	std::string CompileOffset(const bool WithOpcodes, std::vector<float>& TreeParams, std::string Point);
-	std::string CompileMatrix(const bool WithOpcodes, std::vector<float>& TreeParams, std::string Point);
+	AABB ApplyMatrix(const AABB InBounds, const glm::mat4& Matrix) const;
+	std::string CompileOffset(const bool WithOpcodes, std::vector<float>& TreeParams, std::string Point) const;
+	std::string CompileRotation(const bool WithOpcodes, std::vector<float>& TreeParams, std::string Point) const;
+	std::string CompileMatrix(const bool WithOpcodes, std::vector<float>& TreeParams, std::string Point) const;
 };
 
 
+struct SDFNode;
+struct SDFArena;
+
+
+namespace SDF
+{
+	SDFNode* Intern(SDFNode* Node);
+}
+
+
 struct RayHit
 {
 	bool Hit;
@@ -111,15 +197,52 @@ struct SDFNode
 
 	virtual SDFNode* Clip(glm::vec3 Point, float Radius) = 0;
 
+	// Returns the range of distances this node may produce for any point within the given region.
+	virtual Interval EvalInterval(const AABB& Region) = 0;
+
+	// Returns a version of this node with every operand removed that cannot affect distances at or
+	// below Margin within the given region, or nullptr if the node is further than Margin from all
+	// points within the region.  This is the box counterpart of Clip, and is used by SDFOctree.
+	// Subtrees that survive unchanged are returned as-is rather than copied, so only the nodes
+	// along paths where operands were dropped are new.  These are allocated from Arena when one
+	// is provided.
+	virtual SDFNode* Clip(const AABB& Region, float Margin, SDFArena* Arena = nullptr) = 0;
+
 	virtual SDFNode* Copy() = 0;
 
-	virtual AABB Bounds() = 0;
+	// The following whole subtree queries are answered from values cached by Rehash, so they don't
+	// need to walk the tree.
+	AABB Bounds() const
+	{
+		return CachedBounds;
+	}
 
-	virtual AABB InnerBounds() = 0;
+	AABB InnerBounds() const
+	{
+		return CachedInnerBounds;
+	}
 
-	virtual std::string Compile(const bool WithOpcodes, std::vector<float>& TreeParams, std::string& Point) = 0;
+	uint32_t StackSize(const uint32_t Depth = 1) const
+	{
+		return Depth + CachedStackGrowth;
+	}
+
+	bool HasPaint() const
+	{
+		return CachedHasPaint;
+	}
 
-	virtual uint32_t StackSize(const uint32_t Depth = 1) = 0;
+	bool HasFiniteBounds() const
+	{
+		return CachedHasFiniteBounds;
+	}
+
+	int LeafCount() const
+	{
+		return CachedLeafCount;
+	}
+
+	virtual std::string Compile(const bool WithOpcodes, std::vector<float>& TreeParams, std::string& Point) = 0;
 
 	void AddTerminus(std::vector<float>& TreeParams);
 
@@ -127,6 +250,10 @@ struct SDFNode
 
 	glm::vec3 Gradient(glm::vec3 Point);
 
+	// Evaluate many points at once with the batched interpreter.  This compiles the tree first,
+	// so this is only worthwhile for large batches.
+	void EvalBatch(const glm::vec3* Points, float* Out, size_t Count);
+
 	virtual void Move(glm::vec3 Offset) = 0;
 
 	virtual void Rotate(glm::quat Rotation) = 0;
@@ -135,15 +262,56 @@ struct SDFNode
 
 	virtual void ApplyMaterial(glm::vec3 Color, bool Force) = 0;
 
-	virtual bool HasPaint() = 0;
+	// Evaluates the distance and the surface color together in a single traversal, following the same
+	// color selection rules as the interpreter shader.
+	virtual MaterialDist EvalMaterial(glm::vec3 Point) = 0;
+
+	// Structural comparison.  Identical subtrees are usually the same object once interned, and
+	// differing subtrees usually have differing hashes, so this rarely needs to recurse.
+	bool operator==(SDFNode& Other)
+	{
+		if (this == &Other)
+		{
+			return true;
+		}
+		else if (StructureHash != Other.StructureHash || (Interned && Other.Interned))
+		{
+			return false;
+		}
+		return Equals(Other);
+	}
+
+	// Full comparison against a node with the same hash.  Operands should be compared with
+	// operator== instead of Equals.
+	virtual bool Equals(SDFNode& Other) = 0;
+
+	// Replace this node's operands with their interned equivalents.
+	virtual void InternOperands() = 0;
 
-	virtual bool HasFiniteBounds() = 0;
+	// Release and forget this node's operands.  This is used by SDFArena to tear down nodes.
+	virtual void ReleaseOperands() = 0;
 
-	virtual glm::vec4 Sample(glm::vec3 Point) = 0;
+	// Find where this tree differs from Previous.  The bounds of each pair of differing subtrees
+	// are padded by Margin and appended to Changed.  Subtrees with infinite bounds add an infinite
+	// region.  Octree cells outside of these regions clip to equivalent trees in both versions.
+	virtual void Diff(SDFNode* Previous, float Margin, std::vector<AABB>& Changed);
 
-	virtual int LeafCount() = 0;
+	// Returns an equivalent tree with redundant operands and transforms removed, or nullptr if the
+	// tree is empty.  The result may be this node, one of its operands, or a new interned node, and
+	// is held on behalf of the caller.  If Exact is true, the distances must be preserved, such as
+	// for the operands of blends and flates.  Otherwise only the surface must be preserved, which
+	// allows operands to be removed when their bounds show they can't affect it.
+	virtual SDFNode* Simplify(bool Exact);
+
+	size_t Hash() const
+	{
+		return StructureHash;
+	}
 
-	virtual bool operator==(SDFNode& Other) = 0;
+	bool IsInterned() const
+	{
+		return Interned;
+	}
 
 	RayHit RayMarch(glm::vec3 RayStart, glm::vec3 RayDir, int MaxIterations = 100, float Epsilon = 0.001);
 
@@ -152,33 +320,147 @@ struct SDFNode
 		return !(*this == Other);
 	}
 
+	// Hold and Release may be called from any thread.
 	void Hold()
 	{
-		++RefCount;
+		RefCount.fetch_add(1, std::memory_order_relaxed);
 	}
 
 	void Release()
 	{
-		Assert(RefCount > 0);
-		--RefCount;
-		if (RefCount == 0)
+		if (Interned)
 		{
-			delete this;
+			ReleaseInterned();
+		}
+		else
+		{
+			const size_t LastCount = RefCount.fetch_sub(1, std::memory_order_acq_rel);
+			Assert(LastCount > 0);
+			if (LastCount == 1 && !InArena)
+			{
+				delete this;
+			}
 		}
 	}
 
-	virtual ~SDFNode()
-	{
-		Assert(RefCount == 0);
-	};
+	virtual ~SDFNode();
 
 protected:
-	size_t RefCount = 0;
+	std::atomic<size_t> RefCount = 0;
+
+	// Hash of this node's parameters and the hashes of its operands.  This must be updated by
+	// calling Rehash whenever the node is modified.
+	size_t StructureHash = 0;
+
+	// Cached results of the Compute functions below, which are also updated by Rehash.  Operands
+	// are always modified before the nodes that own them, so these only need to look at the
+	// cached values of the operands.  Interned nodes are never modified, so these may be read
+	// from any thread.
+	AABB CachedBounds;
+	AABB CachedInnerBounds;
+	uint32_t CachedStackGrowth = 0;
+	int CachedLeafCount = 0;
+	bool CachedHasPaint = false;
+	bool CachedHasFiniteBounds = false;
+
+	// Interned nodes may be shared by any number of trees, and so must not be modified.
+	bool Interned = false;
+
+	// Arena nodes are freed by their SDFArena rather than when released.
+	bool InArena = false;
+
+	virtual size_t ComputeHash() = 0;
+
+	virtual AABB ComputeBounds() = 0;
+
+	virtual AABB ComputeInnerBounds() = 0;
+
+	// Stack sizes always grow by the same amount regardless of the starting depth, so only the
+	// growth from a depth of one is cached.
+	virtual uint32_t ComputeStackSize(const uint32_t Depth) = 0;
+
+	virtual bool ComputeHasPaint() = 0;
+
+	virtual bool ComputeHasFiniteBounds() = 0;
+
+	virtual int ComputeLeafCount() = 0;
+
+	void Rehash()
+	{
+		Assert(!Interned);
+		StructureHash = ComputeHash();
+		CachedBounds = ComputeBounds();
+		CachedInnerBounds = ComputeInnerBounds();
+		CachedStackGrowth = ComputeStackSize(1) - 1;
+		CachedHasPaint = ComputeHasPaint();
+		CachedHasFiniteBounds = ComputeHasFiniteBounds();
+		CachedLeafCount = ComputeLeafCount();
+	}
+
+	friend SDFNode* SDF::Intern(SDFNode* Node);
+	friend struct SDFArena;
+
+private:
+	void ReleaseInterned();
+};
+
+
+struct SDFJit;
+
+
+// Domain folds for repetition and mirroring, which are shared by the CPU interpreters.  Params
+// points at the parameters of the fold instruction.
+int FoldParamCount(uint32_t Opcode);
+glm::vec3 FoldPoint(uint32_t Opcode, glm::vec3 Point, const float* Params);
+float FoldPolarAngle(glm::vec3 Point, const float* Params);
+
+
+// This runs the same bytecode that is generated for the shader interpreter, but on the CPU.
+// This avoids the virtual dispatch and transform overhead of SDFNode::Eval, and so this is
+// preferred for workloads that evaluate the same static tree many times, such as exports.
+// Large trees are also compiled to native code where possible, which Eval will then use.
+struct SDFInterpreter
+{
+	std::vector<float> Params;
+	uint32_t StackSize;
+	SDFJit* Jit;
+
+	SDFInterpreter(SDFNode* Evaluator);
+	SDFInterpreter(const SDFInterpreter&) = delete;
+	~SDFInterpreter();
+	float Eval(glm::vec3 Point) const;
+	float Interpret(glm::vec3 Point) const;
+	glm::vec3 Gradient(glm::vec3 Point) const;
+	RayHit RayMarch(glm::vec3 RayStart, glm::vec3 RayDir, int MaxIterations = 100, float Epsilon = 0.001) const;
+
+	// Find the distance and the unnormalized gradient in one pass with forward mode automatic
+	// differentiation.  This is defined in sdf_dual.cpp.
+	float Eval(glm::vec3 Point, glm::vec3& Gradient) const;
+
+	// Evaluate several points per instruction.  This is defined in sdf_batch.cpp.
+	void EvalBatch(const glm::vec3* Points, float* Out, size_t Count) const;
 };
 
 
 namespace SDF
 {
+	// Returns the canonical instance of the given tree, which is held on behalf of the caller and
+	// should be released by the caller.  If an equal tree was already interned, then Node is deleted
+	// unless something holds it, so Node should not be used after calling this.  The brush and set
+	// operator constructors below also return held, interned nodes.
+	SDFNode* Intern(SDFNode* Node);
+
+	// Returns Tree with redundant structure removed.  This should be applied to trees before they
+	// are compiled.  Tree is returned as is if there is nothing to remove.  The returned tree is
+	// held, and should be released by the caller.
+	SDFNode* Simplify(SDFNode* Tree);
+
+	// Compares SDFNode::Eval against the bytecode interpreter, and the interpreter against native
+	// code, at points sampled in and around the tree's bounds.  The simplified tree and the octree
+	// of bounded trees are also checked for points that moved to the other side of the surface.
+	// Mismatches are printed, and the number of them is returned.
+	int Validate(SDFNode* Tree, int SampleCount = 1000);
+
 	void Align(SDFNode* Tree, glm::vec3 Anchors);
 
 	void RotateX(SDFNode* Tree, float Degrees);
@@ -216,6 +498,23 @@ namespace SDF
 	SDFNode* BlendInter(float Threshold, SDFNode* LHS, SDFNode* RHS);
 
 	SDFNode* Flate(SDFNode* Node, float Radius);
+
+	// Repeats Node in a grid of cells Period apart.  Each axis has Count copies going from the
+	// origin in the positive direction, or repeats without limit in both directions where Count is
+	// zero.  Axes with a Count of one or a Period of zero are not repeated.
+	SDFNode* RepeatGrid(SDFNode* Node, glm::vec3 Period, glm::vec3 Count);
+
+	// Repeats Node Count times around the Z axis.  Node should be placed around the positive X
+	// axis, where the first copy is.
+	SDFNode* RepeatPolar(SDFNode* Node, int Count);
+
+	// Mirrors Node across each of the given axes, so that Node only needs to cover the positive
+	// side of them.
+	SDFNode* Mirror(SDFNode* Node, glm::bvec3 Axes);
+
+	// Mirrors Node across the plane with the given normal, which is Offset from the origin.  Node
+	// only needs to cover the side of the plane the normal points to.
+	SDFNode* Mirror(SDFNode* Node, glm::vec3 Normal, float Offset);
 }
 
 
@@ -225,39 +524,93 @@ struct SDFOctree
 	glm::vec3 Pivot;
 	float TargetSize;
 	bool Terminus;
+	bool Reused;
 	int LeafCount;
 	SDFNode* Evaluator;
 	SDFOctree* Children[8];
 	SDFOctree* Parent;
 
-	static SDFOctree* Create(SDFNode* Evaluator, float TargetSize = 0.25);
+	// Clipped evaluators are allocated from this, which is shared by the whole octree and owned
+	// by the root node.
+	SDFArena* Arena;
+
+	SDFInterpreter* Interpreter;
+	std::once_flag InterpreterReady;
+
+	// Pointer free copy of the octree's structure, which is what Descend and Walk traverse.  Cells
+	// are stored breadth first with siblings in Morton order, so the children of a cell are stored
+	// contiguously, and the cell's mask bits say which of them are present.  Cell pivots are found
+	// from LinearBounds while descending rather than stored.  These are only set on the root.
+	struct LinearNode
+	{
+		uint32_t FirstChild;
+		uint8_t ChildMask;
+	};
+	AABB LinearBounds;
+	std::vector<LinearNode> LinearNodes;
+	std::vector<SDFOctree*> LinearCells;
+
+	// If Reuse is provided, it is called on each cell at the depth where building the octree is
+	// split into parallel tasks.  If it returns true, the cell is not subdivided and is marked as
+	// Reused, so that the caller can substitute the results of a previous build for it.  The
+	// callback may update the cell's Bounds and Terminus to match the cell it stands in for.
+	using ReuseCallback = std::function<bool(SDFOctree& Cell)>;
+	static SDFOctree* Create(SDFNode* Evaluator, float TargetSize = 0.25, ReuseCallback* Reuse = nullptr);
 	void Populate(int Depth);
 	~SDFOctree();
+
+	// These may only be called on the root of the octree.  If Exact is false, these will return
+	// nullptr for points within the root's culled octants.
 	SDFNode* Descend(const glm::vec3 Point, const bool Exact=true);
+	SDFOctree* DescendCell(const glm::vec3 Point, const bool Exact = true);
 
-	using CallbackType = std::function<void(SDFOctree&)>;
-	void Walk(CallbackType& Callback);
+	SDFInterpreter* GetInterpreter();
+
+	// Calls Callback on every terminal or reused cell.  This may only be called on the root of the
+	// octree.
+	template<typename CallbackT>
+	void Walk(CallbackT& Callback)
+	{
+		for (SDFOctree* Cell : LinearCells)
+		{
+			if (Cell->Terminus || Cell->Reused)
+			{
+				Callback(*Cell);
+			}
+		}
+	}
 
 	float Eval(glm::vec3 Point, const bool Exact = true)
 	{
-		SDFNode* Node = Descend(Point, Exact);
-		if (!Exact && !Node)
+		SDFOctree* Cell = DescendCell(Point, Exact);
+		if (!Exact && !Cell)
 		{
 			return INFINITY;
 		}
-		return Node->Eval(Point);
+		return Cell->GetInterpreter()->Eval(Point);
 	}
 	glm::vec3 Gradient(glm::vec3 Point)
 	{
-		SDFNode* Node = Descend(Point);
-		return Node->Gradient(Point);
+		SDFOctree* Cell = DescendCell(Point);
+		return Cell->GetInterpreter()->Gradient(Point);
+	}
+	float Eval(glm::vec3 Point, glm::vec3& Gradient)
+	{
+		SDFOctree* Cell = DescendCell(Point);
+		return Cell->GetInterpreter()->Eval(Point, Gradient);
 	}
-	glm::vec3 Sample(glm::vec3 Point)
+	void EvalBatch(const glm::vec3* Points, float* Out, size_t Count, const bool Exact = true);
+	MaterialDist EvalMaterial(glm::vec3 Point)
 	{
 		SDFNode* Node = Descend(Point);
-		return Node->Sample(Point);
+		return Node->EvalMaterial(Point);
 	}
 
 private:
-	SDFOctree(SDFOctree* InParent, SDFNode* InEvaluator, float InTargetSize, AABB InBounds, int Depth);
+	SDFOctree(SDFOctree* InParent, SDFArena* InArena, SDFNode* InEvaluator, float InTargetSize, AABB InBounds);
+	void Split();
+	bool Merge(int Depth);
+	void PopulateTop(int Depth, std::vector<SDFOctree*>& Deferred, ReuseCallback* Reuse);
+	void MergeTop(int Depth);
+	void Linearize(const AABB& RootBounds);
 };
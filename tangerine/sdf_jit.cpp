@@ -0,0 +1,862 @@
+// Copyright 2022 Aeva Palecek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sdf_jit.h"
+
+#if ENABLE_SDF_JIT
+
+#include <cmath>
+#include <cstring>
+#include <glm/gtc/type_ptr.hpp>
+#include "sdf_evaluator.h"
+#include "../shaders/defines.h"
+
+#if _WIN64
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN 1
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX 1
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+
+using namespace glm;
+
+
+// Defined in sdf_evaluator.cpp, which compiles all of math.glsl.
+namespace SDFMath
+{
+	float ConeBrush(vec3 Point, float Tangent, float Height);
+	float ConinderBrush(vec3 Point, float RadiusL, float RadiusH, float Height);
+}
+
+
+namespace
+{
+	// The generated code calls these for brushes that aren't worth inlining.
+	float JitConeBrush(const float* Point, const float* Params)
+	{
+		return SDFMath::ConeBrush(vec3(Point[0], Point[1], Point[2]), Params[0], Params[1]);
+	}
+
+	float JitConinderBrush(const float* Point, const float* Params)
+	{
+		return SDFMath::ConinderBrush(vec3(Point[0], Point[1], Point[2]), Params[0], Params[1], Params[2]);
+	}
+}
+
+
+namespace X64
+{
+	enum GPR : uint8_t
+	{
+		RAX = 0,
+		RCX = 1,
+		RDX = 2,
+		RBX = 3,
+		RSP = 4,
+		RBP = 5,
+		RSI = 6,
+		RDI = 7,
+		R12 = 12,
+		R13 = 13
+	};
+
+#if _WIN64
+	const GPR Arg0 = RCX;
+	const GPR Arg1 = RDX;
+#else
+	const GPR Arg0 = RDI;
+	const GPR Arg1 = RSI;
+#endif
+
+	// Scalar SSE opcodes, which all share the F3 0F prefix.
+	enum SSE : uint8_t
+	{
+		MOVSS_LOAD = 0x10,
+		MOVSS_STORE = 0x11,
+		SQRTSS = 0x51,
+		ADDSS = 0x58,
+		MULSS = 0x59,
+		SUBSS = 0x5C,
+		MINSS = 0x5D,
+		DIVSS = 0x5E,
+		MAXSS = 0x5F
+	};
+
+	// Packed SSE opcodes that are only used on registers.
+	enum PackedSSE : uint8_t
+	{
+		MOVAPS = 0x28,
+		ANDPS = 0x54,
+		XORPS = 0x57
+	};
+
+	struct Assembler
+	{
+		std::vector<uint8_t> Bytes;
+
+		void Emit(uint8_t Byte)
+		{
+			Bytes.push_back(Byte);
+		}
+
+		void Emit32(uint32_t Word)
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				Emit((Word >> (i * 8)) & 0xFF);
+			}
+		}
+
+		void Emit64(uint64_t Word)
+		{
+			for (int i = 0; i < 8; ++i)
+			{
+				Emit((Word >> (i * 8)) & 0xFF);
+			}
+		}
+
+		void Rex(bool Wide, int Reg, int Base)
+		{
+			uint8_t Prefix = 0x40 | (Wide ? 8 : 0) | ((Reg & 8) ? 4 : 0) | ((Base & 8) ? 1 : 0);
+			if (Prefix != 0x40)
+			{
+				Emit(Prefix);
+			}
+		}
+
+		// [Base + Disp] with a 32 bit displacement.
+		void Memory(int Reg, int Base, int32_t Disp)
+		{
+			Emit(0x80 | ((Reg & 7) << 3) | (Base & 7));
+			if ((Base & 7) == RSP)
+			{
+				// RSP and R12 can only be used as a base address with a SIB byte.
+				Emit(0x24);
+			}
+			Emit32(uint32_t(Disp));
+		}
+
+		void Register(int Reg, int RM)
+		{
+			Emit(0xC0 | ((Reg & 7) << 3) | (RM & 7));
+		}
+
+		void Scalar(SSE Op, int Xmm, GPR Base, int32_t Disp)
+		{
+			Emit(0xF3);
+			Rex(false, Xmm, Base);
+			Emit(0x0F);
+			Emit(Op);
+			Memory(Xmm, Base, Disp);
+		}
+
+		void Scalar(SSE Op, int Dst, int Src)
+		{
+			Emit(0xF3);
+			Rex(false, Dst, Src);
+			Emit(0x0F);
+			Emit(Op);
+			Register(Dst, Src);
+		}
+
+		void Packed(PackedSSE Op, int Dst, int Src)
+		{
+			Rex(false, Dst, Src);
+			Emit(0x0F);
+			Emit(Op);
+			Register(Dst, Src);
+		}
+
+		void Push(GPR Reg)
+		{
+			Rex(false, 0, Reg);
+			Emit(0x50 + (Reg & 7));
+		}
+
+		void Pop(GPR Reg)
+		{
+			Rex(false, 0, Reg);
+			Emit(0x58 + (Reg & 7));
+		}
+
+		void Move(GPR Dst, GPR Src)
+		{
+			Rex(true, Src, Dst);
+			Emit(0x89);
+			Register(Src, Dst);
+		}
+
+		// Returns the offset of the immediate, so that it may be patched later.
+		size_t MoveImmediate(GPR Dst, uint64_t Immediate)
+		{
+			Rex(true, 0, Dst);
+			Emit(0xB8 + (Dst & 7));
+			const size_t Offset = Bytes.size();
+			Emit64(Immediate);
+			return Offset;
+		}
+
+		void LoadAddress(GPR Dst, GPR Base, int32_t Disp)
+		{
+			Rex(true, Dst, Base);
+			Emit(0x8D);
+			Memory(Dst, Base, Disp);
+		}
+
+		void AdjustStack(int32_t Bytes)
+		{
+			// sub rsp, imm32 or add rsp, imm32
+			Rex(true, 0, RSP);
+			Emit(0x81);
+			Emit(Bytes > 0 ? 0xEC : 0xC4);
+			Emit32(uint32_t(Bytes > 0 ? Bytes : -Bytes));
+		}
+
+		void CallRAX()
+		{
+			Emit(0xFF);
+			Emit(0xD0);
+		}
+
+		void Return()
+		{
+			Emit(0xC3);
+		}
+	};
+}
+
+
+using namespace X64;
+
+
+// Generates the machine code for a program.  Register use is fixed:  RBX holds the address of the
+// input point, R12 holds the address of the scratch area on the machine stack, and R13 holds the
+// address of the constant pool.  All three are callee saved on both Windows and SysV.  Only XMM0
+// through XMM5 are used, as the rest are callee saved on Windows.
+struct JitCompiler
+{
+	Assembler Asm;
+	std::vector<float>& Constants;
+	GPR PointBase = RBX;
+	int32_t StackBase = 16;
+	int32_t AbsMask;
+	int32_t SignMask;
+	int32_t One;
+	int32_t Quarter;
+
+	JitCompiler(std::vector<float>& InConstants)
+		: Constants(InConstants)
+	{
+		AbsMask = AddConstant(AsFloat(uint32_t(0x7FFFFFFF)));
+		SignMask = AddConstant(AsFloat(uint32_t(0x80000000)));
+		One = AddConstant(1.0);
+		Quarter = AddConstant(0.25);
+	}
+
+	int32_t AddConstant(float Value)
+	{
+		Constants.push_back(Value);
+		return int32_t(Constants.size() - 1);
+	}
+
+	void LoadConstant(int Xmm, int32_t Index)
+	{
+		Asm.Scalar(MOVSS_LOAD, Xmm, R13, Index * 4);
+	}
+
+	void ApplyConstant(SSE Op, int Xmm, int32_t Index)
+	{
+		Asm.Scalar(Op, Xmm, R13, Index * 4);
+	}
+
+	void LoadPoint(int Xmm, int Axis)
+	{
+		Asm.Scalar(MOVSS_LOAD, Xmm, PointBase, Axis * 4);
+	}
+
+	void LoadSlot(int Xmm, uint32_t Slot)
+	{
+		Asm.Scalar(MOVSS_LOAD, Xmm, R12, StackBase + Slot * 4);
+	}
+
+	void StoreSlot(int Xmm, uint32_t Slot)
+	{
+		Asm.Scalar(MOVSS_STORE, Xmm, R12, StackBase + Slot * 4);
+	}
+
+	void Zero(int Xmm)
+	{
+		Asm.Packed(XORPS, Xmm, Xmm);
+	}
+
+	void Copy(int Dst, int Src)
+	{
+		Asm.Packed(MOVAPS, Dst, Src);
+	}
+
+	void Abs(int Xmm, int Scratch)
+	{
+		LoadConstant(Scratch, AbsMask);
+		Asm.Packed(ANDPS, Xmm, Scratch);
+	}
+
+	void Negate(int Xmm, int Scratch)
+	{
+		LoadConstant(Scratch, SignMask);
+		Asm.Packed(XORPS, Xmm, Scratch);
+	}
+
+	// Xmm = sqrt(Xmm * Xmm + Other * Other).  Other is clobbered.
+	void Hypot(int Xmm, int Other)
+	{
+		Asm.Scalar(MULSS, Xmm, Xmm);
+		Asm.Scalar(MULSS, Other, Other);
+		Asm.Scalar(ADDSS, Xmm, Other);
+		Asm.Scalar(SQRTSS, Xmm, Xmm);
+	}
+
+	// XMM0 = length(Point.xy)
+	void RadialLength()
+	{
+		LoadPoint(0, 0);
+		LoadPoint(1, 1);
+		Hypot(0, 1);
+	}
+
+	void Prologue(int32_t FrameSize)
+	{
+		Asm.Push(RBX);
+		Asm.Push(R12);
+		Asm.Push(R13);
+		Asm.AdjustStack(FrameSize);
+		Asm.Move(RBX, Arg0);
+		// The first 32 bytes are left alone, as Windows callees may use them as spill space.
+		Asm.LoadAddress(R12, RSP, 32);
+	}
+
+	void Epilogue(int32_t FrameSize)
+	{
+		Asm.AdjustStack(-FrameSize);
+		Asm.Pop(R13);
+		Asm.Pop(R12);
+		Asm.Pop(RBX);
+		Asm.Return();
+	}
+
+	void Call(float(*Function)(const float*, const float*), int32_t ParamIndex)
+	{
+		Asm.LoadAddress(Arg0, PointBase, 0);
+		Asm.LoadAddress(Arg1, R13, ParamIndex * 4);
+		Asm.MoveImmediate(RAX, uint64_t(Function));
+		Asm.CallRAX();
+	}
+
+	void SphereBrush(int32_t Params)
+	{
+		LoadPoint(0, 0);
+		LoadPoint(1, 1);
+		LoadPoint(2, 2);
+		Asm.Scalar(MULSS, 0, 0);
+		Asm.Scalar(MULSS, 1, 1);
+		Asm.Scalar(MULSS, 2, 2);
+		Asm.Scalar(ADDSS, 0, 1);
+		Asm.Scalar(ADDSS, 0, 2);
+		Asm.Scalar(SQRTSS, 0, 0);
+		ApplyConstant(SUBSS, 0, Params);
+	}
+
+	void EllipsoidBrush(int32_t Params)
+	{
+		// K0 = length(Point / Radipodes)
+		for (int Axis = 0; Axis < 3; ++Axis)
+		{
+			LoadPoint(Axis, Axis);
+			ApplyConstant(DIVSS, Axis, Params + Axis);
+			Asm.Scalar(MULSS, Axis, Axis);
+		}
+		Asm.Scalar(ADDSS, 0, 1);
+		Asm.Scalar(ADDSS, 0, 2);
+		Asm.Scalar(SQRTSS, 3, 0);
+
+		// K1 = length(Point / (Radipodes * Radipodes))
+		for (int Axis = 0; Axis < 3; ++Axis)
+		{
+			const float Radipode = Constants[Params + Axis];
+			const int32_t Squared = AddConstant(Radipode * Radipode);
+			LoadPoint(Axis, Axis);
+			ApplyConstant(DIVSS, Axis, Squared);
+			Asm.Scalar(MULSS, Axis, Axis);
+		}
+		Asm.Scalar(ADDSS, 0, 1);
+		Asm.Scalar(ADDSS, 0, 2);
+		Asm.Scalar(SQRTSS, 4, 0);
+
+		// K0 * (K0 - 1.0) / K1
+		Copy(0, 3);
+		ApplyConstant(SUBSS, 3, One);
+		Asm.Scalar(MULSS, 0, 3);
+		Asm.Scalar(DIVSS, 0, 4);
+	}
+
+	void BoxBrush(int32_t Params)
+	{
+		// A = abs(Point) - Extent
+		for (int Axis = 0; Axis < 3; ++Axis)
+		{
+			LoadPoint(Axis, Axis);
+			Abs(Axis, 5);
+			ApplyConstant(SUBSS, Axis, Params + Axis);
+		}
+
+		// min(max(max(A.x, A.y), A.z), 0.0)
+		Zero(4);
+		Copy(3, 0);
+		Asm.Scalar(MAXSS, 3, 1);
+		Asm.Scalar(MAXSS, 3, 2);
+		Asm.Scalar(MINSS, 3, 4);
+
+		// length(max(A, 0.0))
+		for (int Axis = 0; Axis < 3; ++Axis)
+		{
+			Asm.Scalar(MAXSS, Axis, 4);
+			Asm.Scalar(MULSS, Axis, Axis);
+		}
+		Asm.Scalar(ADDSS, 0, 1);
+		Asm.Scalar(ADDSS, 0, 2);
+		Asm.Scalar(SQRTSS, 0, 0);
+
+		Asm.Scalar(ADDSS, 0, 3);
+	}
+
+	void TorusBrush(int32_t Params)
+	{
+		RadialLength();
+		ApplyConstant(SUBSS, 0, Params);
+		LoadPoint(1, 2);
+		Hypot(0, 1);
+		ApplyConstant(SUBSS, 0, Params + 1);
+	}
+
+	void CylinderBrush(int32_t Params)
+	{
+		// D = abs(vec2(length(Point.xy), Point.z)) - vec2(Radius, Extent)
+		RadialLength();
+		ApplyConstant(SUBSS, 0, Params);
+		LoadPoint(1, 2);
+		Abs(1, 5);
+		ApplyConstant(SUBSS, 1, Params + 1);
+
+		// min(max(D.x, D.y), 0.0)
+		Zero(4);
+		Copy(2, 0);
+		Asm.Scalar(MAXSS, 2, 1);
+		Asm.Scalar(MINSS, 2, 4);
+
+		// length(max(D, 0.0))
+		Asm.Scalar(MAXSS, 0, 4);
+		Asm.Scalar(MAXSS, 1, 4);
+		Hypot(0, 1);
+
+		Asm.Scalar(ADDSS, 0, 2);
+	}
+
+	void Plane(int32_t Params)
+	{
+		for (int Axis = 0; Axis < 3; ++Axis)
+		{
+			LoadPoint(Axis, Axis);
+			ApplyConstant(MULSS, Axis, Params + Axis);
+		}
+		Asm.Scalar(ADDSS, 0, 1);
+		Asm.Scalar(ADDSS, 0, 2);
+	}
+
+	// Loads the operands of a set operator into XMM0 and XMM1.
+	void LoadOperands(uint32_t StackPointer)
+	{
+		LoadSlot(0, StackPointer);
+		LoadSlot(1, StackPointer + 1);
+	}
+
+	// XMM3 = H * H * 0.25 / Threshold, where H = max(Threshold - abs(XMM2), 0.0)
+	void BlendTerm(int32_t Threshold)
+	{
+		Abs(2, 5);
+		LoadConstant(3, Threshold);
+		Asm.Scalar(SUBSS, 3, 2);
+		Zero(4);
+		Asm.Scalar(MAXSS, 3, 4);
+		Asm.Scalar(MULSS, 3, 3);
+		ApplyConstant(MULSS, 3, Quarter);
+		ApplyConstant(DIVSS, 3, Threshold);
+	}
+
+	void Offset(int32_t Params)
+	{
+		for (int Axis = 0; Axis < 3; ++Axis)
+		{
+			LoadPoint(0, Axis);
+			ApplyConstant(SUBSS, 0, Params + Axis);
+			Asm.Scalar(MOVSS_STORE, 0, R12, Axis * 4);
+		}
+		PointBase = R12;
+	}
+
+	void Matrix(int32_t Params)
+	{
+		// The matrix is stored in column major order, and is always affine.
+		LoadPoint(0, 0);
+		LoadPoint(1, 1);
+		LoadPoint(2, 2);
+		for (int Row = 0; Row < 3; ++Row)
+		{
+			Copy(3, 0);
+			ApplyConstant(MULSS, 3, Params + Row);
+			Copy(4, 1);
+			ApplyConstant(MULSS, 4, Params + Row + 4);
+			Asm.Scalar(ADDSS, 3, 4);
+			Copy(4, 2);
+			ApplyConstant(MULSS, 4, Params + Row + 8);
+			Asm.Scalar(ADDSS, 3, 4);
+			ApplyConstant(ADDSS, 3, Params + Row + 12);
+			Asm.Scalar(MOVSS_STORE, 3, R12, Row * 4);
+		}
+		PointBase = R12;
+	}
+
+	void Rotate(int32_t Params)
+	{
+		// The offset and quaternion are expanded into an affine matrix while generating the code, so
+		// this costs the same as OPCODE_MATRIX at run time.
+		quat Rotation;
+		Rotation.x = Constants[Params + 3];
+		Rotation.y = Constants[Params + 4];
+		Rotation.z = Constants[Params + 5];
+		Rotation.w = Constants[Params + 6];
+		const vec3 Origin = vec3(Constants[Params], Constants[Params + 1], Constants[Params + 2]);
+		const mat4 Transform = mat4(mat3_cast(Rotation)) * translate(identity<mat4>(), -Origin);
+		const int32_t Cells = int32_t(Constants.size());
+		for (int i = 0; i < 16; ++i)
+		{
+			AddConstant(value_ptr(Transform)[i]);
+		}
+		Matrix(Cells);
+	}
+
+	bool Compile(const std::vector<float>& Params, uint32_t StackSize, size_t& PoolPatch, int32_t& FrameSize)
+	{
+		// Scratch space for the transformed point, followed by the stack.
+		FrameSize = 32 + StackBase + int32_t(StackSize) * 4;
+		FrameSize = (FrameSize + 15) & ~15;
+
+		Prologue(FrameSize);
+		PoolPatch = Asm.MoveImmediate(R13, 0);
+
+		uint32_t StackPointer = 0;
+		size_t Cursor = 0;
+		while (Cursor < Params.size())
+		{
+			const uint32_t Opcode = AsUint(Params[Cursor++]);
+			const int32_t Next = int32_t(Cursor);
+
+			switch (Opcode)
+			{
+			// Set operators
+			case OPCODE_UNION:
+				--StackPointer;
+				LoadSlot(0, StackPointer);
+				Asm.Scalar(MINSS, 0, R12, StackBase + (StackPointer + 1) * 4);
+				StoreSlot(0, StackPointer);
+				break;
+
+			case OPCODE_INTER:
+				--StackPointer;
+				LoadSlot(0, StackPointer);
+				Asm.Scalar(MAXSS, 0, R12, StackBase + (StackPointer + 1) * 4);
+				StoreSlot(0, StackPointer);
+				break;
+
+			case OPCODE_DIFF:
+				--StackPointer;
+				LoadOperands(StackPointer);
+				Negate(1, 5);
+				Asm.Scalar(MAXSS, 0, 1);
+				StoreSlot(0, StackPointer);
+				break;
+
+			case OPCODE_SMOOTH_UNION:
+				--StackPointer;
+				LoadOperands(StackPointer);
+				Copy(2, 0);
+				Asm.Scalar(SUBSS, 2, 1);
+				BlendTerm(Next);
+				Asm.Scalar(MINSS, 0, 1);
+				Asm.Scalar(SUBSS, 0, 3);
+				StoreSlot(0, StackPointer);
+				Cursor += 1;
+				break;
+
+			case OPCODE_SMOOTH_INTER:
+				--StackPointer;
+				LoadOperands(StackPointer);
+				Copy(2, 0);
+				Asm.Scalar(SUBSS, 2, 1);
+				BlendTerm(Next);
+				Asm.Scalar(MAXSS, 0, 1);
+				Asm.Scalar(ADDSS, 0, 3);
+				StoreSlot(0, StackPointer);
+				Cursor += 1;
+				break;
+
+			case OPCODE_SMOOTH_DIFF:
+				--StackPointer;
+				LoadOperands(StackPointer);
+				Copy(2, 0);
+				Asm.Scalar(ADDSS, 2, 1);
+				BlendTerm(Next);
+				Negate(1, 5);
+				Asm.Scalar(MAXSS, 0, 1);
+				Asm.Scalar(ADDSS, 0, 3);
+				StoreSlot(0, StackPointer);
+				Cursor += 1;
+				break;
+
+			// Brush operands
+			case OPCODE_SPHERE:
+				SphereBrush(Next);
+				Cursor += 1;
+				break;
+
+			case OPCODE_ELLIPSOID:
+				EllipsoidBrush(Next);
+				Cursor += 3;
+				break;
+
+			case OPCODE_BOX:
+				BoxBrush(Next);
+				Cursor += 3;
+				break;
+
+			case OPCODE_TORUS:
+				TorusBrush(Next);
+				Cursor += 2;
+				break;
+
+			case OPCODE_CYLINDER:
+				CylinderBrush(Next);
+				Cursor += 2;
+				break;
+
+			case OPCODE_PLANE:
+				Plane(Next);
+				Cursor += 3;
+				break;
+
+			case OPCODE_CONE:
+				Call(JitConeBrush, Next);
+				Cursor += 2;
+				break;
+
+			case OPCODE_CONINDER:
+				Call(JitConinderBrush, Next);
+				Cursor += 3;
+				break;
+
+			// Brushes with a built in offset
+			case OPCODE_MOVED_SPHERE:
+				Offset(Next);
+				SphereBrush(Next + 3);
+				Cursor += 4;
+				break;
+
+			case OPCODE_MOVED_ELLIPSOID:
+				Offset(Next);
+				EllipsoidBrush(Next + 3);
+				Cursor += 6;
+				break;
+
+			case OPCODE_MOVED_BOX:
+				Offset(Next);
+				BoxBrush(Next + 3);
+				Cursor += 6;
+				break;
+
+			// Misc
+			case OPCODE_OFFSET:
+				Offset(Next);
+				Cursor += 3;
+				break;
+
+			case OPCODE_MATRIX:
+				Matrix(Next);
+				Cursor += 16;
+				break;
+
+			case OPCODE_ROTATE:
+				Rotate(Next);
+				Cursor += 7;
+				break;
+
+			case OPCODE_SCALE:
+				LoadSlot(0, StackPointer);
+				ApplyConstant(MULSS, 0, Next);
+				StoreSlot(0, StackPointer);
+				Cursor += 1;
+				break;
+
+			case OPCODE_FLATE:
+				LoadSlot(0, StackPointer);
+				ApplyConstant(SUBSS, 0, Next);
+				StoreSlot(0, StackPointer);
+				Cursor += 1;
+				break;
+
+			case OPCODE_PAINT:
+				Cursor += 3;
+				break;
+
+			case OPCODE_REPEAT_GRID:
+			case OPCODE_REPEAT_POLAR:
+			case OPCODE_MIRROR_AXES:
+			case OPCODE_MIRROR_PLANE:
+			case OPCODE_FOLD_END:
+				// Domain folds are left to the interpreter.
+				return false;
+
+			case OPCODE_PUSH:
+				++StackPointer;
+				break;
+
+			case OPCODE_RETURN:
+				LoadSlot(0, 0);
+				Epilogue(FrameSize);
+				return true;
+
+			default:
+				// Unknown opcode.  Let the caller fall back to the interpreter.
+				return false;
+			}
+
+			// Brushes leave their result in XMM0.
+			if ((Opcode >= OPCODE_SPHERE && Opcode <= OPCODE_CONINDER) ||
+				(Opcode >= OPCODE_MOVED_SPHERE && Opcode <= OPCODE_MOVED_BOX))
+			{
+				StoreSlot(0, StackPointer);
+				PointBase = RBX;
+			}
+		}
+		return false;
+	}
+};
+
+
+SDFJit* SDFJit::Create(const std::vector<float>& Params, uint32_t StackSize)
+{
+	SDFJit* Jit = new SDFJit();
+	Jit->Constants = Params;
+
+	JitCompiler Compiler(Jit->Constants);
+	size_t PoolPatch;
+	int32_t FrameSize;
+	if (!Compiler.Compile(Params, StackSize, PoolPatch, FrameSize))
+	{
+		delete Jit;
+		return nullptr;
+	}
+
+	// The constant pool is final now, so its address can be written into the code.
+	std::vector<uint8_t>& Bytes = Compiler.Asm.Bytes;
+	const uint64_t PoolAddress = uint64_t(Jit->Constants.data());
+	memcpy(Bytes.data() + PoolPatch, &PoolAddress, sizeof(PoolAddress));
+
+	Jit->CodeSize = Bytes.size();
+#if _WIN64
+	void* Code = VirtualAlloc(nullptr, Jit->CodeSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (Code)
+	{
+		memcpy(Code, Bytes.data(), Jit->CodeSize);
+		DWORD OldProtect;
+		if (!VirtualProtect(Code, Jit->CodeSize, PAGE_EXECUTE_READ, &OldProtect))
+		{
+			VirtualFree(Code, 0, MEM_RELEASE);
+			Code = nullptr;
+		}
+		else
+		{
+			FlushInstructionCache(GetCurrentProcess(), Code, Jit->CodeSize);
+		}
+	}
+#else
+	void* Code = mmap(nullptr, Jit->CodeSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (Code == MAP_FAILED)
+	{
+		Code = nullptr;
+	}
+	else
+	{
+		memcpy(Code, Bytes.data(), Jit->CodeSize);
+		if (mprotect(Code, Jit->CodeSize, PROT_READ | PROT_EXEC) != 0)
+		{
+			munmap(Code, Jit->CodeSize);
+			Code = nullptr;
+		}
+	}
+#endif
+
+	if (!Code)
+	{
+		delete Jit;
+		return nullptr;
+	}
+	Jit->Code = Code;
+	Jit->Entry = (EntryPoint)Code;
+	return Jit;
+}
+
+
+SDFJit::~SDFJit()
+{
+	if (Code)
+	{
+#if _WIN64
+		VirtualFree(Code, 0, MEM_RELEASE);
+#else
+		munmap(Code, CodeSize);
+#endif
+		Code = nullptr;
+	}
+}
+
+
+#else
+
+
+SDFJit* SDFJit::Create(const std::vector<float>& Params, uint32_t StackSize)
+{
+	return nullptr;
+}
+
+
+SDFJit::~SDFJit()
+{
+}
+
+
+#endif
@@ -0,0 +1,59 @@
+
+// Copyright 2022 Aeva Palecek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include "glm_common.h"
+
+
+#ifndef ENABLE_SDF_JIT
+#if defined(__x86_64__) || defined(_M_X64)
+#define ENABLE_SDF_JIT 1
+#else
+#define ENABLE_SDF_JIT 0
+#endif
+#endif
+
+
+// Native x86-64 code generated from the bytecode used by SDFInterpreter.  The generated
+// function is straight-line scalar SSE code with the tree's parameters baked in, so evaluating
+// it has none of the interpreter's dispatch overhead.  The simpler brushes are inlined, and the
+// cone brushes call back into the regular math functions.
+struct SDFJit
+{
+	// Returns nullptr if the JIT is disabled, the platform is unsupported, the bytecode contains
+	// something the code generator doesn't know about, or executable memory isn't available.
+	static SDFJit* Create(const std::vector<float>& Params, uint32_t StackSize);
+
+	float Eval(glm::vec3 Point) const
+	{
+		return Entry(&Point.x);
+	}
+
+	~SDFJit();
+
+private:
+	using EntryPoint = float(*)(const float* Point);
+
+	SDFJit() = default;
+	SDFJit(const SDFJit&) = delete;
+
+	std::vector<float> Constants;
+	void* Code = nullptr;
+	size_t CodeSize = 0;
+	EntryPoint Entry = nullptr;
+};
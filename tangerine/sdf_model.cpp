@@ -15,6 +15,7 @@
 
 #include "sdf_model.h"
 #include "profiling.h"
+#include "shape_compiler.h"
 
 
 std::vector<SDFModel*> LiveModels;
@@ -165,9 +166,14 @@ bool DeliverMouseScroll(glm::vec3 Origin, glm::vec3 RayDir, int ScrollX, int Scr
 RayHit SDFModel::RayMarch(glm::vec3 RayStart, glm::vec3 RayDir, int MaxIterations, float Epsilon)
 {
 	glm::vec3 RelativeOrigin = Transform.ApplyInverse(RayStart);
-	glm::mat3 Rotation = (glm::mat3)Transform.LastFoldInverse;
+	glm::mat3 Rotation = (glm::mat3)Transform.ToLocal();
 	glm::vec3 RelativeRayDir = Rotation * RayDir;
-	return Evaluator->RayMarch(RelativeOrigin, RelativeRayDir, 1000);
+	if (!Interpreter)
+	{
+		// Picking evaluates the whole tree many times per query, so this is worth compiling.
+		Interpreter = new SDFInterpreter(Evaluator);
+	}
+	return Interpreter->RayMarch(RelativeOrigin, RelativeRayDir, 1000);
 }
 
 
@@ -203,8 +209,11 @@ void SDFModel::CompileNextShader()
 
 SDFModel::SDFModel(SDFNode* InEvaluator, const float VoxelSize)
 {
-	InEvaluator->Hold();
-	Evaluator = InEvaluator;
+	if (Validating)
+	{
+		ValidationMismatches += SDF::Validate(InEvaluator);
+	}
+	Evaluator = SDF::Simplify(InEvaluator);
 	Compile(VoxelSize);
 
 	TransformBuffer.DebugName = "Instance Transforms Buffer";
@@ -227,6 +236,12 @@ SDFModel::~SDFModel()
 	}
 
 	// If the Evaluator is nullptr, then this SDFModel was moved into a new instance, and less stuff needs to be deleted.
+	if (Interpreter)
+	{
+		delete Interpreter;
+		Interpreter = nullptr;
+	}
+
 	if (Evaluator)
 	{
 		Evaluator->Release();
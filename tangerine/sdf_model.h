@@ -24,6 +24,7 @@
 struct SDFModel
 {
 	SDFNode* Evaluator = nullptr;
+	SDFInterpreter* Interpreter = nullptr;
 
 	bool Visible = true;
 	TransformMachine Transform;
@@ -13,6 +13,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <map>
+#include <algorithm>
 #include "sdf_rendering.h"
 #include "sdf_model.h"
 #include "profiling.h"
@@ -106,8 +108,39 @@ ProgramTemplate::ProgramTemplate(std::string InDebugName, std::string InPrettyTr
 	DistSource = InDistSource;
 }
 
+// Shaders that have been compiled or are being compiled, by source.  Models that are recompiled
+// after a small edit will mostly generate the same shaders as before, and these are shared
+// instead of being compiled again.
+static std::map<std::string, std::weak_ptr<ShaderEnvelope>> LiveShaders;
+static size_t LiveShadersPruneSize = 256;
+
+
 void ProgramTemplate::StartCompile()
 {
+	// Use a very long average window for draw time queries to reduce the likelihood of strobing in the heatmap view.
+	DepthQuery.Create(1000);
+
+	auto Found = LiveShaders.find(DistSource);
+	if (Found != LiveShaders.end())
+	{
+		std::shared_ptr<ShaderEnvelope> Existing = Found->second.lock();
+		if (Existing && !Existing->Failed.load())
+		{
+			Compiled = Existing;
+			return;
+		}
+	}
+	else if (LiveShaders.size() >= LiveShadersPruneSize)
+	{
+		// Forget shaders that are no longer used by any model.
+		for (auto Entry = LiveShaders.begin(); Entry != LiveShaders.end();)
+		{
+			Entry = Entry->second.expired() ? LiveShaders.erase(Entry) : std::next(Entry);
+		}
+		LiveShadersPruneSize = std::max(LiveShadersPruneSize, LiveShaders.size() * 2);
+	}
+	LiveShaders[DistSource] = Compiled;
+
 	std::unique_ptr<ShaderProgram> NewShader;
 	NewShader.reset(new ShaderProgram());
 	NewShader->AsyncSetup(
@@ -115,9 +148,6 @@ void ProgramTemplate::StartCompile()
 		  {GL_FRAGMENT_SHADER, GeneratedShader("math.glsl", DistSource, "cluster_draw.fs.glsl")} },
 		DebugName.c_str());
 	AsyncCompile(std::move(NewShader), Compiled);
-
-	// Use a very long average window for draw time queries to reduce the likelihood of strobing in the heatmap view.
-	DepthQuery.Create(1000);
 }
 
 ShaderProgram* ProgramTemplate::GetCompiledShader()
@@ -163,10 +193,9 @@ void SDFModel::Draw(
 
 	int NextOctreeID = 0;
 
-	Transform.Fold();
 	TransformUpload TransformData = {
-		Transform.LastFold,
-		Transform.LastFoldInverse
+		Transform.ToWorld(),
+		Transform.ToLocal()
 	};
 	TransformBuffer.Upload((void*)&TransformData, sizeof(TransformUpload));
 	TransformBuffer.Bind(GL_UNIFORM_BUFFER, 1);
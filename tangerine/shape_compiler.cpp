@@ -15,6 +15,11 @@
 
 #include <map>
 #include <unordered_map>
+#include <unordered_set>
+#include <tuple>
+#include <fstream>
+#include <random>
+#include <cstring>
 #include "fmt/format.h"
 
 #include "extern.h"
@@ -65,6 +70,383 @@ void UseRoundedStackSize()
 }
 
 
+std::filesystem::path ShapeCacheDir;
+void UseShapeCache(const std::filesystem::path& CacheDir)
+{
+	ShapeCacheDir = CacheDir;
+}
+
+
+bool Validating = false;
+int ValidationMismatches = 0;
+void ValidateEvaluators()
+{
+	Validating = true;
+}
+
+
+// Shape cache files store the VariantsMap generated for a model, so that reloading an unchanged
+// model can skip building and walking its octree.  The file is a header followed by flat arrays
+// that refer to each other by index rather than by pointer, so the whole file is read in one go
+// and nothing needs to be fixed up after loading.  The cache key is stored in the file as well,
+// so a hash collision is just a cache miss.  Increment ShapeCacheVersion whenever the layout or
+// the generated GLSL changes.
+const uint32_t ShapeCacheVersion = 1;
+const char ShapeCacheMagic[8] = { 'T', 'G', 'S', 'H', 'A', 'P', 'E', 'S' };
+
+
+struct ShapeCacheHeader
+{
+	char Magic[8];
+	uint32_t Version;
+	uint32_t KeyWords;
+	uint32_t VariantCount;
+	uint32_t GroupCount;
+	uint32_t ParamCount;
+	uint32_t BoundsCount;
+	uint32_t StringBytes;
+};
+
+
+struct ShapeCacheVariant
+{
+	uint32_t SourceOffset;
+	uint32_t SourceLength;
+	uint32_t PrettyOffset;
+	uint32_t PrettyLength;
+	int32_t LeafCount;
+	uint32_t StackSize;
+	uint32_t FirstGroup;
+	uint32_t GroupCount;
+};
+
+
+// A parameter block and the voxels that use it.
+struct ShapeCacheGroup
+{
+	uint32_t FirstParam;
+	uint32_t ParamCount;
+	uint32_t FirstBounds;
+	uint32_t BoundsCount;
+};
+
+
+static_assert(sizeof(AABB) == sizeof(float) * 6);
+
+
+// The key is everything that the generated VariantsMap depends on.  The interpreter bytecode for
+// the whole tree is used to identify the model, since it already encodes every brush, operator,
+// parameter, and material.
+std::vector<uint32_t> ShapeCacheKey(SDFNode* Evaluator, const float VoxelSize)
+{
+	std::vector<float> Bytecode;
+	std::string Point = "Point";
+	Evaluator->Compile(true, Bytecode, Point);
+	Evaluator->AddTerminus(Bytecode);
+
+	std::vector<uint32_t> Key;
+	Key.reserve(Bytecode.size() + 3);
+	Key.push_back(AsUint(VoxelSize));
+	Key.push_back(Interpreted);
+	Key.push_back(RoundStackSize);
+	for (const float Word : Bytecode)
+	{
+		Key.push_back(AsUint(Word));
+	}
+	return Key;
+}
+
+
+uint64_t HashShapeCacheKey(const std::vector<uint32_t>& Key)
+{
+	// FNV-1a
+	uint64_t Hash = 0xcbf29ce484222325ull;
+	for (const uint32_t Word : Key)
+	{
+		for (int Byte = 0; Byte < 4; ++Byte)
+		{
+			Hash ^= (Word >> (Byte * 8)) & 0xFF;
+			Hash *= 0x100000001b3ull;
+		}
+	}
+	return Hash;
+}
+
+
+inline size_t PadWords(size_t Bytes)
+{
+	return (Bytes + 3) / 4;
+}
+
+
+bool ReadShapeCache(const std::filesystem::path& Path, const std::vector<uint32_t>& Key, VariantsMap& Voxels)
+{
+	std::ifstream File(Path, std::ios::binary | std::ios::ate);
+	if (!File.is_open())
+	{
+		return false;
+	}
+	const size_t FileSize = (size_t)File.tellg();
+	if (FileSize < sizeof(ShapeCacheHeader) || FileSize % 4 != 0)
+	{
+		return false;
+	}
+	std::vector<uint32_t> Blob(FileSize / 4);
+	File.seekg(0);
+	File.read((char*)Blob.data(), FileSize);
+	if (!File)
+	{
+		return false;
+	}
+
+	const ShapeCacheHeader& Header = *(ShapeCacheHeader*)Blob.data();
+	if (memcmp(Header.Magic, ShapeCacheMagic, sizeof(ShapeCacheMagic)) != 0 ||
+		Header.Version != ShapeCacheVersion ||
+		Header.KeyWords != Key.size())
+	{
+		return false;
+	}
+
+	const size_t KeyStart = PadWords(sizeof(ShapeCacheHeader));
+	const size_t VariantsStart = KeyStart + Header.KeyWords;
+	const size_t GroupsStart = VariantsStart + PadWords(sizeof(ShapeCacheVariant)) * Header.VariantCount;
+	const size_t ParamsStart = GroupsStart + PadWords(sizeof(ShapeCacheGroup)) * Header.GroupCount;
+	const size_t BoundsStart = ParamsStart + Header.ParamCount;
+	const size_t StringsStart = BoundsStart + PadWords(sizeof(AABB)) * Header.BoundsCount;
+	const size_t TotalWords = StringsStart + PadWords(Header.StringBytes);
+	if (TotalWords != Blob.size() ||
+		memcmp(Blob.data() + KeyStart, Key.data(), Key.size() * sizeof(uint32_t)) != 0)
+	{
+		return false;
+	}
+
+	const ShapeCacheVariant* Variants = (ShapeCacheVariant*)(Blob.data() + VariantsStart);
+	const ShapeCacheGroup* Groups = (ShapeCacheGroup*)(Blob.data() + GroupsStart);
+	const float* Params = (float*)(Blob.data() + ParamsStart);
+	const AABB* Bounds = (AABB*)(Blob.data() + BoundsStart);
+	const char* Strings = (char*)(Blob.data() + StringsStart);
+
+	VariantsMap Loaded;
+	for (uint32_t v = 0; v < Header.VariantCount; ++v)
+	{
+		const ShapeCacheVariant& Variant = Variants[v];
+		if ((uint64_t)Variant.SourceOffset + Variant.SourceLength > Header.StringBytes ||
+			(uint64_t)Variant.PrettyOffset + Variant.PrettyLength > Header.StringBytes ||
+			(uint64_t)Variant.FirstGroup + Variant.GroupCount > Header.GroupCount)
+		{
+			return false;
+		}
+
+		std::string Source(Strings + Variant.SourceOffset, Variant.SourceLength);
+		std::string Pretty(Strings + Variant.PrettyOffset, Variant.PrettyLength);
+		ShaderInfo& Info = Loaded[Source];
+		Info.Pretty = Pretty;
+		Info.LeafCount = Variant.LeafCount;
+		Info.StackSize = Variant.StackSize;
+
+		for (uint32_t g = Variant.FirstGroup; g < Variant.FirstGroup + Variant.GroupCount; ++g)
+		{
+			const ShapeCacheGroup& Group = Groups[g];
+			if ((uint64_t)Group.FirstParam + Group.ParamCount > Header.ParamCount ||
+				(uint64_t)Group.FirstBounds + Group.BoundsCount > Header.BoundsCount)
+			{
+				return false;
+			}
+			ParamsVec GroupParams(Params + Group.FirstParam, Params + Group.FirstParam + Group.ParamCount);
+			BoundsVec GroupBounds(Bounds + Group.FirstBounds, Bounds + Group.FirstBounds + Group.BoundsCount);
+			Info.Params.insert({ std::move(GroupParams), std::move(GroupBounds) });
+		}
+	}
+
+	Voxels.swap(Loaded);
+	return true;
+}
+
+
+void WriteShapeCache(const std::filesystem::path& Path, const std::vector<uint32_t>& Key, const VariantsMap& Voxels)
+{
+	std::vector<ShapeCacheVariant> Variants;
+	std::vector<ShapeCacheGroup> Groups;
+	std::vector<float> Params;
+	std::vector<AABB> Bounds;
+	std::string Strings;
+
+	Variants.reserve(Voxels.size());
+	for (auto& [Source, VariantInfo] : Voxels)
+	{
+		ShapeCacheVariant Variant;
+		Variant.SourceOffset = (uint32_t)Strings.size();
+		Variant.SourceLength = (uint32_t)Source.size();
+		Strings += Source;
+		Variant.PrettyOffset = (uint32_t)Strings.size();
+		Variant.PrettyLength = (uint32_t)VariantInfo.Pretty.size();
+		Strings += VariantInfo.Pretty;
+		Variant.LeafCount = VariantInfo.LeafCount;
+		Variant.StackSize = VariantInfo.StackSize;
+		Variant.FirstGroup = (uint32_t)Groups.size();
+		Variant.GroupCount = (uint32_t)VariantInfo.Params.size();
+		Variants.push_back(Variant);
+
+		for (auto& [GroupParams, Instances] : VariantInfo.Params)
+		{
+			Groups.push_back({ (uint32_t)Params.size(), (uint32_t)GroupParams.size(), (uint32_t)Bounds.size(), (uint32_t)Instances.size() });
+			Params.insert(Params.end(), GroupParams.begin(), GroupParams.end());
+			Bounds.insert(Bounds.end(), Instances.begin(), Instances.end());
+		}
+	}
+
+	ShapeCacheHeader Header;
+	memcpy(Header.Magic, ShapeCacheMagic, sizeof(ShapeCacheMagic));
+	Header.Version = ShapeCacheVersion;
+	Header.KeyWords = (uint32_t)Key.size();
+	Header.VariantCount = (uint32_t)Variants.size();
+	Header.GroupCount = (uint32_t)Groups.size();
+	Header.ParamCount = (uint32_t)Params.size();
+	Header.BoundsCount = (uint32_t)Bounds.size();
+	Header.StringBytes = (uint32_t)Strings.size();
+	Strings.resize(PadWords(Strings.size()) * 4, '\0');
+
+	std::error_code Error;
+	std::filesystem::create_directories(Path.parent_path(), Error);
+
+	// Write to a temporary file first, so that other processes sharing the cache never see a
+	// partially written file.
+	std::filesystem::path TempPath = Path;
+	TempPath += fmt::format(".{:08x}.tmp", std::random_device()());
+	{
+		std::ofstream File(TempPath, std::ios::binary | std::ios::trunc);
+		if (!File.is_open())
+		{
+			return;
+		}
+		File.write((char*)&Header, sizeof(Header));
+		File.write((char*)Key.data(), Key.size() * sizeof(uint32_t));
+		File.write((char*)Variants.data(), Variants.size() * sizeof(ShapeCacheVariant));
+		File.write((char*)Groups.data(), Groups.size() * sizeof(ShapeCacheGroup));
+		File.write((char*)Params.data(), Params.size() * sizeof(float));
+		File.write((char*)Bounds.data(), Bounds.size() * sizeof(AABB));
+		File.write(Strings.data(), Strings.size());
+		if (!File)
+		{
+			File.close();
+			std::filesystem::remove(TempPath, Error);
+			return;
+		}
+	}
+	std::filesystem::rename(TempPath, Path, Error);
+	if (Error)
+	{
+		std::filesystem::remove(TempPath, Error);
+	}
+}
+
+
+// The compiled results of one of the octree cells where building the octree is split into
+// parallel tasks, and the final bounds and terminus state of that cell.
+struct CompiledCell
+{
+	AABB Bounds;
+	bool Terminus;
+	VariantsMap Variants;
+};
+
+
+// Cells are identified by their pivot, which is unique among cells of the same depth when the
+// octrees have the same root bounds.
+using CellKey = std::tuple<uint32_t, uint32_t, uint32_t>;
+
+
+CellKey GetCellKey(const SDFOctree& Cell)
+{
+	return { AsUint(Cell.Pivot.x), AsUint(Cell.Pivot.y), AsUint(Cell.Pivot.z) };
+}
+
+
+// The compiled cells of a recently compiled model.  When a similar model is compiled later, cells
+// that don't overlap with any of the differences between the two models are copied from here
+// instead of being built and compiled again.
+struct CompileRecord
+{
+	SDFNode* Evaluator;
+	AABB TreeBounds;
+	float VoxelSize;
+	bool Interpreted;
+	bool RoundStackSize;
+	std::map<CellKey, CompiledCell> Cells;
+
+	~CompileRecord()
+	{
+		Evaluator->Release();
+	}
+};
+
+
+// Most recent last.
+std::vector<CompileRecord*> CompileRecords;
+const size_t MaxCompileRecords = 4;
+
+
+// Find the recently compiled model that has the fewest differences from the given evaluator.
+CompileRecord* FindSimilarModel(SDFNode* Evaluator, const AABB& TreeBounds, const float VoxelSize, std::vector<AABB>& Changed)
+{
+	CompileRecord* Best = nullptr;
+	std::vector<AABB> Differences;
+	for (CompileRecord* Record : CompileRecords)
+	{
+		if (Record->VoxelSize == VoxelSize &&
+			Record->Interpreted == Interpreted &&
+			Record->RoundStackSize == RoundStackSize &&
+			Record->TreeBounds.Min == TreeBounds.Min &&
+			Record->TreeBounds.Max == TreeBounds.Max)
+		{
+			Differences.clear();
+			Evaluator->Diff(Record->Evaluator, 0.0, Differences);
+			if (!Best || Differences.size() < Changed.size())
+			{
+				Best = Record;
+				Changed.swap(Differences);
+			}
+		}
+	}
+	return Best;
+}
+
+
+void AddCompileRecord(CompileRecord* NewRecord, CompileRecord* Replaces)
+{
+	for (size_t i = 0; i < CompileRecords.size(); ++i)
+	{
+		if (CompileRecords[i] == Replaces)
+		{
+			CompileRecords.erase(CompileRecords.begin() + i);
+			delete Replaces;
+			break;
+		}
+	}
+	if (CompileRecords.size() >= MaxCompileRecords)
+	{
+		delete CompileRecords[0];
+		CompileRecords.erase(CompileRecords.begin());
+	}
+	CompileRecords.push_back(NewRecord);
+}
+
+
+void MergeVariants(VariantsMap& Into, const VariantsMap& From)
+{
+	for (auto& [Source, VariantInfo] : From)
+	{
+		auto VariantsInsert = Into.insert({ Source, { ParamsMap(), VariantInfo.Pretty, VariantInfo.LeafCount, VariantInfo.StackSize } });
+		ParamsMap& Variant = (*(VariantsInsert.first)).second.Params;
+		for (auto& [Params, Voxels] : VariantInfo.Params)
+		{
+			BoundsVec& Instances = Variant[Params];
+			Instances.insert(Instances.end(), Voxels.begin(), Voxels.end());
+		}
+	}
+}
+
+
 // Iterate over a voxel grid and generate sources and parameter buffers to populate a new model.
 void SDFModel::Compile(const float VoxelSize)
 {
@@ -74,13 +456,95 @@ void SDFModel::Compile(const float VoxelSize)
 	VariantsMap Voxels;
 	uint32_t SubtreeIndex = 0;
 
+	std::vector<uint32_t> CacheKey;
+	std::filesystem::path CachePath;
+	bool CacheHit = false;
+	if (!ShapeCacheDir.empty())
+	{
+		BeginEvent("Read Shape Cache");
+		CacheKey = ShapeCacheKey(Evaluator, VoxelSize);
+		CachePath = ShapeCacheDir / fmt::format("{:016x}.shape", HashShapeCacheKey(CacheKey));
+		CacheHit = ReadShapeCache(CachePath, CacheKey, Voxels);
+		EndEvent();
+	}
+
+	if (!CacheHit)
 	{
+		CompileRecord* NewRecord = new CompileRecord();
+		Evaluator->Hold();
+		NewRecord->Evaluator = Evaluator;
+		NewRecord->VoxelSize = VoxelSize;
+		NewRecord->Interpreted = Interpreted;
+		NewRecord->RoundStackSize = RoundStackSize;
+
+		std::vector<AABB> Changed;
+		CompileRecord* Previous = nullptr;
+		if (Evaluator->HasFiniteBounds())
+		{
+			BeginEvent("Diff Evaluator");
+			NewRecord->TreeBounds = Evaluator->Bounds();
+			Previous = FindSimilarModel(Evaluator, NewRecord->TreeBounds, VoxelSize, Changed);
+			EndEvent();
+		}
+
+		// Cells that the octree offered for reuse.  Every leaf below one of these is compiled into
+		// that cell's record, and everything else is compiled into TopVariants.
+		std::unordered_set<SDFOctree*> Candidates;
+		VariantsMap TopVariants;
+
+		SDFOctree::ReuseCallback Reuse = [&](SDFOctree& Cell) -> bool
+		{
+			Candidates.insert(&Cell);
+			if (Previous)
+			{
+				for (const AABB& Region : Changed)
+				{
+					if (Cell.Bounds.Overlaps(Region))
+					{
+						return false;
+					}
+				}
+				auto Found = Previous->Cells.find(GetCellKey(Cell));
+				if (Found != Previous->Cells.end())
+				{
+					Cell.Bounds = Found->second.Bounds;
+					Cell.Terminus = Found->second.Terminus;
+					return true;
+				}
+			}
+			return false;
+		};
+
 		BeginEvent("Build Octree");
-		SDFOctree* Octree = SDFOctree::Create(Evaluator, VoxelSize);
+		SDFOctree* Octree = SDFOctree::Create(Evaluator, VoxelSize, &Reuse);
 		EndEvent();
 
-		SDFOctree::CallbackType Thunk = [&](SDFOctree& Leaf)
+		auto Thunk = [&](SDFOctree& Leaf)
 		{
+			// Candidate cells are only ever deleted after every cell has been created, so a live
+			// cell can't share an address with a deleted candidate.
+			SDFOctree* Cell = &Leaf;
+			while (Cell && Candidates.count(Cell) == 0)
+			{
+				Cell = Cell->Parent;
+			}
+
+			if (Leaf.Reused)
+			{
+				NewRecord->Cells[GetCellKey(Leaf)] = std::move(Previous->Cells[GetCellKey(Leaf)]);
+				return;
+			}
+
+			VariantsMap* Target = &TopVariants;
+			if (Cell)
+			{
+				auto CellInsert = NewRecord->Cells.insert({ GetCellKey(*Cell), CompiledCell() });
+				CompiledCell& Compiled = (*(CellInsert.first)).second;
+				Compiled.Bounds = Cell->Bounds;
+				Compiled.Terminus = Cell->Terminus;
+				Target = &Compiled.Variants;
+			}
+
 			std::vector<float> Params;
 			std::string Point = "Point";
 			std::string GLSL = Leaf.Evaluator->Compile(Interpreted, Params, Point);
@@ -105,7 +569,7 @@ void SDFModel::Compile(const float VoxelSize)
 			}
 
 			ShaderInfo VariantInfo = { ParamsMap(), Pretty, Leaf.LeafCount, StackSize };
-			auto VariantsInsert = Voxels.insert({ GLSL, VariantInfo });
+			auto VariantsInsert = Target->insert({ GLSL, VariantInfo });
 			ParamsMap& Variant = (*(VariantsInsert.first)).second.Params;
 
 			auto ParamsInsert = Variant.insert({ Params, BoundsVec() });
@@ -121,9 +585,32 @@ void SDFModel::Compile(const float VoxelSize)
 		}
 		EndEvent();
 
+		BeginEvent("Gather Cells");
+		MergeVariants(Voxels, TopVariants);
+		for (auto& [Key, Compiled] : NewRecord->Cells)
+		{
+			MergeVariants(Voxels, Compiled.Variants);
+		}
+		if (Octree)
+		{
+			AddCompileRecord(NewRecord, Previous);
+		}
+		else
+		{
+			delete NewRecord;
+		}
+		EndEvent();
+
 		BeginEvent("Delete Octree");
 		delete Octree;
 		EndEvent();
+
+		if (!ShapeCacheDir.empty())
+		{
+			BeginEvent("Write Shape Cache");
+			WriteShapeCache(CachePath, CacheKey, Voxels);
+			EndEvent();
+		}
 	}
 
 	BeginEvent("Emit GLSL");
@@ -143,7 +630,7 @@ void SDFModel::Compile(const float VoxelSize)
 				"\tuint SubtreeIndex;\n"
 				"\tfloat PARAMS[];\n"
 				"}};\n\n"
-				"MaterialDist Interpret(const vec3 EvalPoint);\n",
+				"MaterialDist Interpret(vec3 EvalPoint);\n",
 				MaxIterations,
 				VariantInfo.StackSize);
 		}
@@ -15,13 +15,24 @@
 
 #pragma once
 
+#include <filesystem>
 #include "sdf_evaluator.h"
 
 extern int MaxIterations;
 extern bool Interpreted;
+extern bool Validating;
+extern int ValidationMismatches;
 
 void OverrideMaxIterations(int MaxIterationsOverride);
 void UseInterpreter();
 void UseRoundedStackSize();
 
+// Compiled models are cached in the given directory, keyed by the model's contents and the compiler
+// settings.  An empty path disables the cache.
+void UseShapeCache(const std::filesystem::path& CacheDir);
+
+// Each new model's evaluator is checked with SDF::Validate, and the number of mismatches found is
+// added to ValidationMismatches.
+void ValidateEvaluators();
+
 void CompileEvaluator(SDFNode* Evaluator, const float VoxelSize = 0.25);
@@ -0,0 +1,227 @@
+// Copyright 2022 Aeva Palecek
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// This provides a minimal packet type for evaluating several SDF queries at once.  The width
+// of the packet depends on what the compiler is allowed to target:  AVX2 builds use 8 lanes,
+// other x86-64 builds use 4 lanes of SSE2, and everything else gets a portable 4 lane fallback.
+// Comparisons return a lane mask of the same type, which is only meaningful to Select.
+
+#if defined(__AVX2__)
+#define SIMD_AVX2 1
+#define SIMD_LANES 8
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2 1
+#define SIMD_LANES 4
+#include <emmintrin.h>
+#else
+#define SIMD_LANES 4
+#include <cmath>
+#endif
+
+
+#if SIMD_AVX2
+struct FloatN
+{
+	__m256 V;
+
+	FloatN() = default;
+	FloatN(__m256 InV) : V(InV) {}
+	FloatN(float Scalar) : V(_mm256_set1_ps(Scalar)) {}
+
+	static FloatN Load(const float* Src) { return _mm256_loadu_ps(Src); }
+	void Store(float* Dst) const { _mm256_storeu_ps(Dst, V); }
+};
+
+inline FloatN operator+(FloatN LHS, FloatN RHS) { return _mm256_add_ps(LHS.V, RHS.V); }
+inline FloatN operator-(FloatN LHS, FloatN RHS) { return _mm256_sub_ps(LHS.V, RHS.V); }
+inline FloatN operator*(FloatN LHS, FloatN RHS) { return _mm256_mul_ps(LHS.V, RHS.V); }
+inline FloatN operator/(FloatN LHS, FloatN RHS) { return _mm256_div_ps(LHS.V, RHS.V); }
+inline FloatN operator&(FloatN LHS, FloatN RHS) { return _mm256_and_ps(LHS.V, RHS.V); }
+inline FloatN operator|(FloatN LHS, FloatN RHS) { return _mm256_or_ps(LHS.V, RHS.V); }
+inline FloatN operator<(FloatN LHS, FloatN RHS) { return _mm256_cmp_ps(LHS.V, RHS.V, _CMP_LT_OQ); }
+inline FloatN operator>(FloatN LHS, FloatN RHS) { return _mm256_cmp_ps(LHS.V, RHS.V, _CMP_GT_OQ); }
+inline FloatN operator<=(FloatN LHS, FloatN RHS) { return _mm256_cmp_ps(LHS.V, RHS.V, _CMP_LE_OQ); }
+inline FloatN min(FloatN LHS, FloatN RHS) { return _mm256_min_ps(LHS.V, RHS.V); }
+inline FloatN max(FloatN LHS, FloatN RHS) { return _mm256_max_ps(LHS.V, RHS.V); }
+inline FloatN sqrt(FloatN Value) { return _mm256_sqrt_ps(Value.V); }
+inline FloatN Select(FloatN Mask, FloatN IfTrue, FloatN IfFalse) { return _mm256_blendv_ps(IfFalse.V, IfTrue.V, Mask.V); }
+inline FloatN abs(FloatN Value) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), Value.V); }
+inline FloatN operator-(FloatN Value) { return _mm256_xor_ps(_mm256_set1_ps(-0.0f), Value.V); }
+
+#elif SIMD_SSE2
+struct FloatN
+{
+	__m128 V;
+
+	FloatN() = default;
+	FloatN(__m128 InV) : V(InV) {}
+	FloatN(float Scalar) : V(_mm_set1_ps(Scalar)) {}
+
+	static FloatN Load(const float* Src) { return _mm_loadu_ps(Src); }
+	void Store(float* Dst) const { _mm_storeu_ps(Dst, V); }
+};
+
+inline FloatN operator+(FloatN LHS, FloatN RHS) { return _mm_add_ps(LHS.V, RHS.V); }
+inline FloatN operator-(FloatN LHS, FloatN RHS) { return _mm_sub_ps(LHS.V, RHS.V); }
+inline FloatN operator*(FloatN LHS, FloatN RHS) { return _mm_mul_ps(LHS.V, RHS.V); }
+inline FloatN operator/(FloatN LHS, FloatN RHS) { return _mm_div_ps(LHS.V, RHS.V); }
+inline FloatN operator&(FloatN LHS, FloatN RHS) { return _mm_and_ps(LHS.V, RHS.V); }
+inline FloatN operator|(FloatN LHS, FloatN RHS) { return _mm_or_ps(LHS.V, RHS.V); }
+inline FloatN operator<(FloatN LHS, FloatN RHS) { return _mm_cmplt_ps(LHS.V, RHS.V); }
+inline FloatN operator>(FloatN LHS, FloatN RHS) { return _mm_cmpgt_ps(LHS.V, RHS.V); }
+inline FloatN operator<=(FloatN LHS, FloatN RHS) { return _mm_cmple_ps(LHS.V, RHS.V); }
+inline FloatN min(FloatN LHS, FloatN RHS) { return _mm_min_ps(LHS.V, RHS.V); }
+inline FloatN max(FloatN LHS, FloatN RHS) { return _mm_max_ps(LHS.V, RHS.V); }
+inline FloatN sqrt(FloatN Value) { return _mm_sqrt_ps(Value.V); }
+inline FloatN Select(FloatN Mask, FloatN IfTrue, FloatN IfFalse) { return _mm_or_ps(_mm_and_ps(Mask.V, IfTrue.V), _mm_andnot_ps(Mask.V, IfFalse.V)); }
+inline FloatN abs(FloatN Value) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), Value.V); }
+inline FloatN operator-(FloatN Value) { return _mm_xor_ps(_mm_set1_ps(-0.0f), Value.V); }
+
+#else
+struct FloatN
+{
+	float V[SIMD_LANES];
+
+	FloatN() = default;
+	FloatN(float Scalar)
+	{
+		for (int i = 0; i < SIMD_LANES; ++i) V[i] = Scalar;
+	}
+
+	static FloatN Load(const float* Src)
+	{
+		FloatN Result;
+		for (int i = 0; i < SIMD_LANES; ++i) Result.V[i] = Src[i];
+		return Result;
+	}
+	void Store(float* Dst) const
+	{
+		for (int i = 0; i < SIMD_LANES; ++i) Dst[i] = V[i];
+	}
+};
+
+#define SIMD_FALLBACK_BINARY(Name, Expr) \
+inline FloatN Name(FloatN LHS, FloatN RHS) \
+{ \
+	FloatN Result; \
+	for (int i = 0; i < SIMD_LANES; ++i) \
+	{ \
+		const float L = LHS.V[i]; \
+		const float R = RHS.V[i]; \
+		Result.V[i] = Expr; \
+	} \
+	return Result; \
+}
+
+#define SIMD_FALLBACK_UNARY(Name, Expr) \
+inline FloatN Name(FloatN Value) \
+{ \
+	FloatN Result; \
+	for (int i = 0; i < SIMD_LANES; ++i) \
+	{ \
+		const float X = Value.V[i]; \
+		Result.V[i] = Expr; \
+	} \
+	return Result; \
+}
+
+inline float MaskBits(bool Condition)
+{
+	return Condition ? -1.0f : 0.0f;
+}
+
+SIMD_FALLBACK_BINARY(operator+, L + R)
+SIMD_FALLBACK_BINARY(operator-, L - R)
+SIMD_FALLBACK_BINARY(operator*, L * R)
+SIMD_FALLBACK_BINARY(operator/, L / R)
+SIMD_FALLBACK_BINARY(operator&, MaskBits(L != 0.0f && R != 0.0f))
+SIMD_FALLBACK_BINARY(operator|, MaskBits(L != 0.0f || R != 0.0f))
+SIMD_FALLBACK_BINARY(operator<, MaskBits(L < R))
+SIMD_FALLBACK_BINARY(operator>, MaskBits(L > R))
+SIMD_FALLBACK_BINARY(operator<=, MaskBits(L <= R))
+SIMD_FALLBACK_BINARY(min, std::fmin(L, R))
+SIMD_FALLBACK_BINARY(max, std::fmax(L, R))
+SIMD_FALLBACK_UNARY(sqrt, std::sqrt(X))
+SIMD_FALLBACK_UNARY(abs, std::fabs(X))
+SIMD_FALLBACK_UNARY(operator-, -X)
+
+inline FloatN Select(FloatN Mask, FloatN IfTrue, FloatN IfFalse)
+{
+	FloatN Result;
+	for (int i = 0; i < SIMD_LANES; ++i)
+	{
+		Result.V[i] = Mask.V[i] != 0.0f ? IfTrue.V[i] : IfFalse.V[i];
+	}
+	return Result;
+}
+
+#undef SIMD_FALLBACK_BINARY
+#undef SIMD_FALLBACK_UNARY
+#endif
+
+
+inline FloatN clamp(FloatN Value, FloatN Low, FloatN High)
+{
+	return min(max(Value, Low), High);
+}
+
+
+inline FloatN sign(FloatN Value)
+{
+	const FloatN Zero(0.0f);
+	return Select(Value > Zero, FloatN(1.0f), Select(Value < Zero, FloatN(-1.0f), Zero));
+}
+
+
+// Structure-of-arrays vector types for packets of points.
+struct Vec2N
+{
+	FloatN x;
+	FloatN y;
+};
+
+
+struct Vec3N
+{
+	FloatN x;
+	FloatN y;
+	FloatN z;
+};
+
+
+inline FloatN dot(const Vec2N& LHS, const Vec2N& RHS)
+{
+	return LHS.x * RHS.x + LHS.y * RHS.y;
+}
+
+
+inline FloatN dot(const Vec3N& LHS, const Vec3N& RHS)
+{
+	return LHS.x * RHS.x + LHS.y * RHS.y + LHS.z * RHS.z;
+}
+
+
+inline FloatN length(const Vec2N& Vector)
+{
+	return sqrt(dot(Vector, Vector));
+}
+
+
+inline FloatN length(const Vec3N& Vector)
+{
+	return sqrt(dot(Vector, Vector));
+}
@@ -1170,7 +1170,7 @@ void RenderUI(SDL_Window* Window, bool& Live)
 	static bool ExportSkipRefine;
 	static int ExportRefinementSteps;
 	static ExportFormat ExportMeshFormat;
-	static bool ExportPointCloud;
+	static ExportMode ExportMeshMode;
 	static float MagicaGridSize = 1.0;
 	static int MagicaColorIndex = 0;
 	static std::string ExportPath;
@@ -1345,7 +1345,7 @@ void RenderUI(SDL_Window* Window, bool& Live)
 				ExportPath = Results[0].string();
 				ExportMeshFormat = ExportFormatForPath(ExportPath);
 
-				ExportPointCloud = ExportMeshFormat == ExportFormat::PLY;
+				ExportMeshMode = ExportMeshFormat == ExportFormat::PLY ? ExportMode::PointCloud : ExportMode::Grid;
 
 				ShowExportOptions = true;
 
@@ -1657,9 +1657,22 @@ void RenderUI(SDL_Window* Window, bool& Live)
 						ImGui::InputFloat("Voxel Size", &ExportStepSize);
 						ImGui::InputFloat("Unit Scale", &ExportScale);
 					}
+					if (ImGui::RadioButton("Uniform", ExportMeshMode == ExportMode::Grid))
+					{
+						ExportMeshMode = ExportMode::Grid;
+					}
+					ImGui::SameLine();
+					if (ImGui::RadioButton("Adaptive", ExportMeshMode == ExportMode::DualContouring))
+					{
+						ExportMeshMode = ExportMode::DualContouring;
+					}
 					if (ExportMeshFormat == ExportFormat::PLY)
 					{
-						ImGui::Checkbox("Point Cloud Only", &ExportPointCloud);
+						ImGui::SameLine();
+						if (ImGui::RadioButton("Point Cloud Only", ExportMeshMode == ExportMode::PointCloud))
+						{
+							ExportMeshMode = ExportMode::PointCloud;
+						}
 					}
 					if (ImGui::Button("Start"))
 					{
@@ -1670,12 +1683,12 @@ void RenderUI(SDL_Window* Window, bool& Live)
 								ExportSplitStep[1],
 								ExportSplitStep[2]);
 							int RefinementSteps = ExportSkipRefine ? 0 : ExportRefinementSteps;
-							MeshExport(TreeEvaluator, ExportPath, ModelBounds.Min, ModelBounds.Max, VoxelSize, RefinementSteps, ExportMeshFormat, ExportPointCloud, ExportScale);
+							MeshExport(TreeEvaluator, ExportPath, ModelBounds.Min, ModelBounds.Max, VoxelSize, RefinementSteps, ExportMeshFormat, ExportMeshMode, ExportScale);
 						}
 						else
 						{
 							glm::vec3 VoxelSize = glm::vec3(ExportStepSize);
-							MeshExport(TreeEvaluator, ExportPath, ModelBounds.Min, ModelBounds.Max, VoxelSize, DefaultExportRefinementSteps, ExportMeshFormat, ExportPointCloud, ExportScale);
+							MeshExport(TreeEvaluator, ExportPath, ModelBounds.Min, ModelBounds.Max, VoxelSize, DefaultExportRefinementSteps, ExportMeshFormat, ExportMeshMode, ExportScale);
 						}
 						ShowExportOptions = false;
 					}
@@ -1809,6 +1822,7 @@ StatusCode Boot(int argc, char* argv[])
 	HeadlessMode = false;
 	bool LoadFromStandardIn = false;
 	Language PipeRuntime = Language::Unknown;
+	bool UseCache = true;
 	{
 		int Cursor = 0;
 		while (Cursor < Args.size())
@@ -1854,6 +1868,18 @@ StatusCode Boot(int argc, char* argv[])
 				Cursor += 1;
 				continue;
 			}
+			else if (Args[Cursor] == "--validate")
+			{
+				ValidateEvaluators();
+				Cursor += 1;
+				continue;
+			}
+			else if (Args[Cursor] == "--no-cache")
+			{
+				UseCache = false;
+				Cursor += 1;
+				continue;
+			}
 			else
 			{
 				std::cout << "Invalid commandline arg(s).\n";
@@ -1862,6 +1888,11 @@ StatusCode Boot(int argc, char* argv[])
 		}
 	}
 
+	if (UseCache)
+	{
+		UseShapeCache(Installed.CacheDir);
+	}
+
 	{
 		std::cout << "Setting up SDL2... ";
 		SDL_SetMainReady();
@@ -1999,6 +2030,11 @@ StatusCode Boot(int argc, char* argv[])
 		ReadInputModel(PipeRuntime);
 	}
 
+	if (ValidationMismatches > 0)
+	{
+		std::cout << "Validation failed with " << ValidationMismatches << " mismatches.\n";
+	}
+
 	if (HeadlessMode)
 	{
 		// There's a frame of delay before an error message would appear, so just process the DearImGui events twice.
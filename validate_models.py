@@ -0,0 +1,29 @@
+import glob
+import subprocess
+
+
+# Loads each of the example models headlessly, and checks that the bytecode interpreter and the
+# native code generated for it agree with the evaluator tree at sampled points, and that
+# simplifying the tree or building an octree for it doesn't move its surface.
+if __name__ == "__main__":
+    runtimes = { ".lua": "--lua", ".rkt": "--racket" }
+    failed = []
+
+    paths = sorted(glob.glob("models/*.lua") + glob.glob("models/*.rkt"))
+    for path in paths:
+        runtime = runtimes[path[path.rindex("."):]]
+        with open(path, "rb") as infile:
+            model_source = infile.read()
+
+        proc = subprocess.run(f"./tangerine.exe {runtime} --headless 64 64 --validate --no-cache", capture_output=True, input=model_source)
+        output = proc.stdout.decode("utf-8", errors="replace")
+        if "BEGIN RAW IMAGE" in output:
+            output = output[:output.index("BEGIN RAW IMAGE")]
+
+        if "Validated" not in output or "Validation failed" in output:
+            print(output)
+            failed.append(path)
+        print(f"{path}: {'FAILED' if path in failed else 'ok'}")
+
+    print(f"{len(paths) - len(failed)} of {len(paths)} models passed")
+    assert(len(failed) == 0)